@@ -5,6 +5,8 @@
 // see file LICENSE for further details
 
 #include "PEImage.h"
+#include "inflate.h"
+#include "stats.h"
 
 extern "C" {
 #include "mscvpdb.h"
@@ -17,6 +19,10 @@ extern "C" {
 #include <direct.h>
 #include <share.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
 #include <vector>
 
 #ifdef UNICODE
@@ -35,18 +41,30 @@ PEImage::PEImage(const TCHAR* iname)
 , hdr32(0)
 , hdr64(0)
 , fd(-1)
-, debug_aranges(0)
+, debug_aranges(0), debug_aranges_length(0)
 , debug_pubnames(0)
 , debug_pubtypes(0)
+, debug_gnu_pubnames(0), debug_gnu_pubnames_length(0)
+, debug_names(0), debug_names_length(0)
 , debug_info(0), debug_info_length(0)
+, debug_types(0), debug_types_length(0)
 , debug_abbrev(0), debug_abbrev_length(0)
 , debug_line(0), debug_line_length(0)
+, debug_line_str(0), debug_line_str_length(0)
 , debug_frame(0), debug_frame_length(0)
-, debug_str(0)
+, eh_frame(0), eh_frame_length(0)
+, eh_frame_hdr(0), eh_frame_hdr_length(0)
+, debug_str(0), debug_str_length(0)
 , debug_loc(0), debug_loc_length(0)
+, debug_loclists(0), debug_loclists_length(0)
+, debug_rnglists(0), debug_rnglists_length(0)
+, debug_str_offsets(0), debug_str_offsets_length(0)
+, debug_addr(0), debug_addr_length(0)
 , debug_ranges(0), debug_ranges_length(0)
 , codeSegment(0)
 , linesSegment(-1)
+, ehFrameSegment(-1)
+, ehFrameHdrSegment(-1)
 , reloc(0), reloc_length(0)
 , nsec(0)
 , nsym(0)
@@ -66,6 +84,8 @@ PEImage::~PEImage()
 		close(fd);
 	if(dump_base)
 		free_aligned(dump_base);
+	for (size_t i = 0; i < inflatedSections.size(); i++)
+		delete [] inflatedSections[i];
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -83,9 +103,10 @@ bool PEImage::readAll(const TCHAR* iname)
 		return setError("Can't get size");
 	dump_total_len = s.st_size;
 
-	dump_base = alloc_aligned(dump_total_len, 0x1000);
+	dump_base = alloc_aligned(dump_total_len + kSectionPadding, 0x1000);
 	if (!dump_base)
 		return setError("Out of memory");
+	memset((char*)dump_base + dump_total_len, 0, kSectionPadding);
 	if (read(fd, dump_base, dump_total_len) != dump_total_len)
 		return setError("Cannot read file");
 
@@ -94,6 +115,20 @@ bool PEImage::readAll(const TCHAR* iname)
 	return true;
 }
 
+bool PEImage::readBuffer(const void* data, unsigned long len)
+{
+	if (dump_base)
+		return setError("file already open");
+
+	dump_total_len = len;
+	dump_base = alloc_aligned(dump_total_len + kSectionPadding, 0x1000);
+	if (!dump_base)
+		return setError("Out of memory");
+	memcpy(dump_base, data, len);
+	memset((char*)dump_base + dump_total_len, 0, kSectionPadding);
+	return true;
+}
+
 ///////////////////////////////////////////////////////////////////////
 bool PEImage::loadExe(const TCHAR* iname)
 {
@@ -163,7 +198,7 @@ bool PEImage::replaceDebugSection (const void* data, int datalen, bool initCV)
 			int off = strtol(name + 1, 0, 10);
 			name = strtable + off;
 		}
-		if (strncmp (name, ".debug_", 7) != 0)
+		if (strncmp (name, ".debug_", 7) != 0 && strncmp (name, ".zdebug_", 8) != 0)
 			firstDWARFsection = -1;
 		else if (firstDWARFsection < 0)
 			firstDWARFsection = s;
@@ -176,7 +211,7 @@ bool PEImage::replaceDebugSection (const void* data, int datalen, bool initCV)
 				break;
 			}
 			strcpy ((char*) sec [s].Name, ".ddebug");
-			printf("warning: .debug not last section, cannot remove section\n");
+			warning(".debug not last section, cannot remove section");
 		}
 		lastVirtualAddress = sec[s].VirtualAddress + sec[s].Misc.VirtualSize;
 	}
@@ -426,7 +461,7 @@ bool PEImage::initDWARFPtr(bool initDbgDir)
 bool PEImage::initDWARFObject()
 {
 	IMAGE_FILE_HEADER* hdr = DPV<IMAGE_FILE_HEADER> (0);
-	if(!dos)
+	if(!hdr)
 		return setError("file too small for COFF header");
 
 	if (hdr->Machine == IMAGE_FILE_MACHINE_UNKNOWN && hdr->NumberOfSections == 0xFFFF)
@@ -455,8 +490,10 @@ bool PEImage::initDWARFObject()
     else
 	    return setError("Unknown object file format");
 
-    if (!symtable || !strtable)
+    if (!symtable || !strtable || strtable > (char*)dump_base + dump_total_len)
 	    return setError("Unknown object file format");
+    if (!DPV<IMAGE_SECTION_HEADER>((char*)sec - (char*)dump_base, nsec * sizeof(IMAGE_SECTION_HEADER)))
+	    return setError("section table beyond end of file");
 
     initDWARFSegments();
     setError(0);
@@ -470,40 +507,169 @@ static DWORD sizeInImage(const IMAGE_SECTION_HEADER& sec)
     return sec.SizeOfRawData < sec.Misc.VirtualSize ? sec.SizeOfRawData : sec.Misc.VirtualSize;
 }
 
+const char* PEImage::getSectionName(int s) const
+{
+	const char* name = (const char*) sec[s].Name;
+	if(name[0] == '/')
+	{
+		int off = strtol(name + 1, 0, 10);
+		if (off < 0 || off >= (char*)dump_base + dump_total_len - strtable)
+			return "";
+		name = strtable + off;
+	}
+	return name;
+}
+
+thread_local unsigned int inflateThreads = 0;
+
+// deflate expands the input by at most about 1032:1
+static const unsigned long long kMaxInflateRatio = 1032;
+
+static void inflateSection(CompressedSection& cs)
+{
+	if (!inflateZlib(cs.src, cs.srclen, (unsigned char*)cs.data, cs.length))
+	{
+		delete [] cs.data;
+		cs.data = 0;
+	}
+}
+
+void PEImage::inflateDWARFSections(std::vector<CompressedSection>& compressed)
+{
+	for(int s = 0; s < nsec; s++)
+	{
+		// GNU style compressed section: "ZLIB", 8 byte big endian uncompressed size, zlib stream
+		const char* name = getSectionName(s);
+		unsigned long len = sizeInImage(sec[s]);
+		unsigned char* p = DPV<unsigned char>(sec[s].PointerToRawData, len);
+		if (strncmp(name, ".zdebug_", 8) != 0 || !p || len < 12 || memcmp(p, "ZLIB", 4) != 0)
+			continue;
+
+		unsigned long long size = 0;
+		for (int i = 4; i < 12; i++)
+			size = (size << 8) | p[i];
+		if (size >= 0x80000000 || size > (len - 12) * kMaxInflateRatio)
+		{
+			warning("invalid size of compressed section %s", name);
+			continue;
+		}
+
+		CompressedSection cs;
+		cs.section = s;
+		cs.src = p + 12;
+		cs.srclen = len - 12;
+		cs.length = (unsigned long) size;
+		cs.data = new (std::nothrow) char[cs.length + kSectionPadding];
+		if (!cs.data)
+		{
+			warning("out of memory decompressing section %s", name);
+			continue;
+		}
+		memset(cs.data + cs.length, 0, kSectionPadding);
+		compressed.push_back(cs);
+	}
+	if (compressed.empty())
+		return;
+
+	// decompress the sections in parallel, largest first
+	std::sort(compressed.begin(), compressed.end(),
+	          [](const CompressedSection& a, const CompressedSection& b) { return a.length > b.length; });
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i; (i = next++) < compressed.size(); )
+			inflateSection(compressed[i]);
+	};
+	unsigned int maxThreads = inflateThreads ? inflateThreads : std::max(std::thread::hardware_concurrency(), 1u);
+	size_t nthreads = std::min<size_t>(maxThreads, compressed.size());
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < nthreads; t++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	for (size_t i = 0; i < compressed.size(); i++)
+	{
+		if (compressed[i].data)
+			inflatedSections.push_back(compressed[i].data);
+		else
+			warning("cannot decompress section %s", getSectionName(compressed[i].section));
+	}
+}
+
 void PEImage::initDWARFSegments()
 {
+	std::vector<CompressedSection> compressed;
+	inflateDWARFSections(compressed);
+
 	for(int s = 0; s < nsec; s++)
 	{
-		const char* name = (const char*) sec[s].Name;
-		if(name[0] == '/')
+		const char* name = getSectionName(s);
+		unsigned long len = sizeInImage(sec[s]);
+		char* p = DPV<char>(sec[s].PointerToRawData, len);
+
+		char dname[64];
+		if (strncmp(name, ".zdebug_", 8) == 0 && strlen(name) < sizeof(dname))
 		{
-			int off = strtol(name + 1, 0, 10);
-			name = strtable + off;
+			// use the decompressed data under the name of the uncompressed section
+			p = 0;
+			for (size_t i = 0; i < compressed.size(); i++)
+				if (compressed[i].section == s)
+				{
+					p = compressed[i].data;
+					len = compressed[i].length;
+				}
+			if (!p)
+				continue;
+			strcpy(dname, ".");
+			strcat(dname, name + 2);
+			name = dname;
 		}
+
 		if(strcmp(name, ".debug_aranges") == 0)
-			debug_aranges = DPV<char>(sec[s].PointerToRawData, sizeInImage(sec[s]));
+			debug_aranges = p, debug_aranges_length = len;
 		if(strcmp(name, ".debug_pubnames") == 0)
-			debug_pubnames = DPV<char>(sec[s].PointerToRawData, sizeInImage(sec[s]));
+			debug_pubnames = p;
 		if(strcmp(name, ".debug_pubtypes") == 0)
-			debug_pubtypes = DPV<char>(sec[s].PointerToRawData, sizeInImage(sec[s]));
+			debug_pubtypes = p;
+		if(strcmp(name, ".debug_gnu_pubnames") == 0)
+			debug_gnu_pubnames = p, debug_gnu_pubnames_length = len;
+		if(strcmp(name, ".debug_names") == 0)
+			debug_names = p, debug_names_length = len;
 		if(strcmp(name, ".debug_info") == 0)
-			debug_info = DPV<char>(sec[s].PointerToRawData, debug_info_length = sizeInImage(sec[s]));
+			debug_info = p, debug_info_length = len;
+		if (strcmp(name, ".debug_types") == 0)
+			debug_types = p, debug_types_length = len;
 		if(strcmp(name, ".debug_abbrev") == 0)
-			debug_abbrev = DPV<char>(sec[s].PointerToRawData, debug_abbrev_length = sizeInImage(sec[s]));
+			debug_abbrev = p, debug_abbrev_length = len;
 		if(strcmp(name, ".debug_line") == 0)
-			debug_line = DPV<char>(sec[linesSegment = s].PointerToRawData, debug_line_length = sizeInImage(sec[s]));
+			debug_line = p, debug_line_length = len, linesSegment = s;
 		if (strcmp(name, ".debug_line_str") == 0)
-			debug_line_str = DPV<char>(sec[s].PointerToRawData, debug_line_str_length = sizeInImage(sec[s]));
+			debug_line_str = p, debug_line_str_length = len;
 		if(strcmp(name, ".debug_frame") == 0)
-			debug_frame = DPV<char>(sec[s].PointerToRawData, debug_frame_length = sizeInImage(sec[s]));
+			debug_frame = p, debug_frame_length = len;
+		if(strcmp(name, ".eh_frame") == 0)
+			eh_frame = p, eh_frame_length = len, ehFrameSegment = s;
+		if(strcmp(name, ".eh_frame_hdr") == 0)
+			eh_frame_hdr = p, eh_frame_hdr_length = len, ehFrameHdrSegment = s;
 		if(strcmp(name, ".debug_str") == 0)
-			debug_str = DPV<char>(sec[s].PointerToRawData, sizeInImage(sec[s]));
+			debug_str = p, debug_str_length = len;
 		if(strcmp(name, ".debug_loc") == 0)
-			debug_loc = DPV<char>(sec[s].PointerToRawData, debug_loc_length = sizeInImage(sec[s]));
+			debug_loc = p, debug_loc_length = len;
+		if(strcmp(name, ".debug_loclists") == 0)
+			debug_loclists = p, debug_loclists_length = len;
+		if(strcmp(name, ".debug_rnglists") == 0)
+			debug_rnglists = p, debug_rnglists_length = len;
+		if(strcmp(name, ".debug_str_offsets") == 0)
+			debug_str_offsets = p, debug_str_offsets_length = len;
+		if(strcmp(name, ".debug_addr") == 0)
+			debug_addr = p, debug_addr_length = len;
 		if(strcmp(name, ".debug_ranges") == 0)
-			debug_ranges = DPV<char>(sec[s].PointerToRawData, debug_ranges_length = sizeInImage(sec[s]));
+			debug_ranges = p, debug_ranges_length = len;
 		if(strcmp(name, ".reloc") == 0)
-			reloc = DPV<char>(sec[s].PointerToRawData, reloc_length = sizeInImage(sec[s]));
+			reloc = p, reloc_length = len;
 		if(strcmp(name, ".text") == 0)
 			codeSegment = s;
 	}
@@ -762,7 +928,7 @@ const char* PEImage::t_findSectionSymbolName(int s) const
 		sym = (SYM*) symtable + i;
         if (sym->SectionNumber == s && sym->StorageClass == IMAGE_SYM_CLASS_EXTERNAL)
         {
-            static char sname[10] = { 0 };
+            static thread_local char sname[10] = { 0 };
 
 		    if (sym->N.Name.Short == 0)
                 return strtable + sym->N.Name.Long;
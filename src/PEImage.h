@@ -11,6 +11,7 @@
 
 #include <windows.h>
 #include <unordered_map>
+#include <vector>
 
 struct OMFDirHeader;
 struct OMFDirEntry;
@@ -22,6 +23,20 @@ struct SymbolInfo
 	bool dllimport;
 };
 
+// a .zdebug_* section and its decompressed contents
+struct CompressedSection
+{
+	int section;
+	const unsigned char* src;
+	unsigned long srclen;
+	char* data;
+	unsigned long length;
+};
+
+// threads decompressing the .zdebug_* sections of the images loaded on this thread,
+// 0 for the number of processors
+extern thread_local unsigned int inflateThreads;
+
 #define IMGHDR(x) (hdr32 ? hdr32->x : hdr64->x)
 
 class PEImage : public LastError
@@ -36,7 +51,7 @@ public:
 	}
 	template<class P> P* DPV(int off, int size) const
 	{
-		if(off < 0 || off + size > dump_total_len)
+		if(off < 0 || size < 0 || off + size > dump_total_len)
 			return 0;
 		return (P*) ((char*) dump_base + off);
 	}
@@ -65,6 +80,7 @@ public:
 	}
 
 	bool readAll(const TCHAR* iname);
+	bool readBuffer(const void* data, unsigned long len);
 	bool loadExe(const TCHAR* iname);
 	bool loadObj(const TCHAR* iname);
 	bool save(const TCHAR* oname);
@@ -88,6 +104,9 @@ public:
 
 	// utilities
 	static void* alloc_aligned(unsigned int size, unsigned int align, unsigned int alignoff = 0);
+	// zero bytes after the loaded file and decompressed sections, so that the DWARF
+	// readers can load a few bytes beyond the data they decode
+	static const int kSectionPadding = 16;
 	static void free_aligned(void* p);
 
 	int countSections() const { return nsec; }
@@ -95,6 +114,7 @@ public:
 	int findSymbol(const char* name, unsigned long& off, bool& dllimport) const;
 	const char* findSectionSymbolName(int s) const;
 	const IMAGE_SECTION_HEADER& getSection(int s) const { return sec[s]; }
+	const char* getSectionName(int s) const;
 	unsigned long long getImageBase() const { return IMGHDR(OptionalHeader.ImageBase); }
     int getRelocationInLineSegment(unsigned int offset) const;
     int getRelocationInSegment(int segment, unsigned int offset) const;
@@ -105,6 +125,7 @@ public:
 
 private:
 	bool _initFromCVDebugDir(IMAGE_DEBUG_DIRECTORY* ddir);
+	void inflateDWARFSections(std::vector<CompressedSection>& compressed);
 
     template<typename SYM> const char* t_findSectionSymbolName(int s) const;
 
@@ -128,24 +149,36 @@ private:
 	bool bigobj;
 	bool dbgfile; // is DBG file
 	std::unordered_map<std::string, SymbolInfo> symbolCache;
+	std::vector<char*> inflatedSections; // decompressed .zdebug_* sections
 
 public:
 	//dwarf
-	char* debug_aranges;
+	char* debug_aranges;  unsigned long debug_aranges_length;
 	char* debug_pubnames;
 	char* debug_pubtypes;
+	char* debug_gnu_pubnames; unsigned long debug_gnu_pubnames_length;
+	char* debug_names;    unsigned long debug_names_length;
 	char* debug_info;     unsigned long debug_info_length;
+	char* debug_types;    unsigned long debug_types_length;
 	char* debug_abbrev;   unsigned long debug_abbrev_length;
 	char* debug_line;     unsigned long debug_line_length;
 	char* debug_line_str; unsigned long debug_line_str_length;
 	char* debug_frame;    unsigned long debug_frame_length;
-	char* debug_str;
+	char* eh_frame;       unsigned long eh_frame_length;
+	char* eh_frame_hdr;   unsigned long eh_frame_hdr_length;
+	char* debug_str;      unsigned long debug_str_length;
 	char* debug_loc;      unsigned long debug_loc_length;
+	char* debug_loclists; unsigned long debug_loclists_length;
+	char* debug_rnglists; unsigned long debug_rnglists_length;
+	char* debug_str_offsets; unsigned long debug_str_offsets_length;
+	char* debug_addr;     unsigned long debug_addr_length;
 	char* debug_ranges;   unsigned long debug_ranges_length;
 	char* reloc;          unsigned long reloc_length;
 
 	int linesSegment;
 	int codeSegment;
+	int ehFrameSegment;
+	int ehFrameHdrSegment;
 	int cv_base;
 };
 
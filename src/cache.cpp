@@ -0,0 +1,95 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "cache.h"
+
+#include <string.h>
+
+thread_local ConversionCache* conversionCache;
+
+// entries not used by this number of conversions are dropped
+static const unsigned int kKeepConversions = 8;
+// the demangled names are dropped when there are more than this
+static const size_t kMaxDemangled = 1 << 20;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+// MurmurHash3_x64_128, seeded with both halves of the previous hash
+ContentHash hashContent(const void* data, size_t len, const ContentHash& seed)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t h1 = seed.a;
+	uint64_t h2 = seed.b;
+
+	for (size_t i = 0; i < len; i += 16)
+	{
+		uint64_t k[2] = { 0, 0 };
+		memcpy(k, p + i, len - i < 16 ? len - i : 16); // the tail is padded with zeros
+
+		k[0] *= c1; k[0] = rotl64(k[0], 31); k[0] *= c2; h1 ^= k[0];
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k[1] *= c2; k[1] = rotl64(k[1], 33); k[1] *= c1; h2 ^= k[1];
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	ContentHash h;
+	h.a = h1;
+	h.b = h2;
+	return h;
+}
+
+void ConversionCache::nextConversion()
+{
+	conversion++;
+	for (auto it = lines.begin(); it != lines.end(); )
+		if (conversion - it->second.lastUse > kKeepConversions)
+			it = lines.erase(it);
+		else
+			++it;
+
+	if (demangled.size() > kMaxDemangled)
+		demangled.clear();
+}
+
+const std::vector<DWARF_LineBlock>* ConversionCache::findLines(const ContentHash& key)
+{
+	auto it = lines.find(key);
+	if (it == lines.end())
+		return 0;
+	it->second.lastUse = conversion;
+	return &it->second.blocks;
+}
+
+void ConversionCache::addLines(const ContentHash& key, const std::vector<DWARF_LineBlock>& blocks)
+{
+	LineEntry& entry = lines[key];
+	entry.blocks = blocks;
+	entry.lastUse = conversion;
+}
@@ -0,0 +1,75 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "readDwarf.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 128-bit hash identifying data that results are derived from
+struct ContentHash
+{
+	uint64_t a, b;
+
+	ContentHash() : a(0), b(0) {}
+	bool operator==(const ContentHash& other) const { return a == other.a && b == other.b; }
+	bool operator!=(const ContentHash& other) const { return !(*this == other); }
+
+	struct Hasher
+	{
+		size_t operator()(const ContentHash& h) const { return (size_t)h.a; }
+	};
+};
+
+// hash LEN bytes at DATA, continuing the hash SEED
+ContentHash hashContent(const void* data, size_t len, const ContentHash& seed = ContentHash());
+
+// abbreviations found in .debug_abbrev by the DIECursors of the last image
+struct DWARF_AbbrevCache
+{
+	ContentHash section; // of .debug_abbrev
+	std::vector<std::pair<std::pair<unsigned, unsigned>, unsigned>> abbrevs; // (table offset, code) -> offset
+};
+
+// Results kept between the conversions of the server (--server) and of --watch, so
+// that converting a relinked image only decodes what has changed. The entries are
+// keyed by the hash of the data they are derived from and are valid for any image.
+class ConversionCache
+{
+public:
+	ConversionCache() : conversion(0) {}
+
+	// start the next conversion, drops the entries not used by the last few conversions
+	void nextConversion();
+
+	// line blocks of the line program with hash KEY, NULL if not cached
+	const std::vector<DWARF_LineBlock>* findLines(const ContentHash& key);
+	void addLines(const ContentHash& key, const std::vector<DWARF_LineBlock>& blocks);
+
+	DWARF_AbbrevCache abbrevs;
+	// demangled D symbols by the buffer size and mangled name
+	std::unordered_map<std::string, std::string> demangled;
+
+private:
+	struct LineEntry
+	{
+		std::vector<DWARF_LineBlock> blocks;
+		unsigned int lastUse;
+	};
+	std::unordered_map<ContentHash, LineEntry, ContentHash::Hasher> lines;
+	unsigned int conversion;
+};
+
+// caches of the conversion running on the current thread, NULL if nothing is kept
+extern thread_local ConversionCache* conversionCache;
+
+#endif //__CACHE_H__
@@ -0,0 +1,584 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "converter.h"
+#include "PEImage.h"
+#include "readDwarf.h"
+#include "spill.h"
+#include "symutil.h"
+#include "stats.h"
+
+#include <direct.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <thread>
+
+ConverterOptions::ConverterOptions()
+: Dversion(2.072), debug(false), demangleSymbols(true), useTypedefEnum(false), dotReplacementChar('@')
+, pdbref(0), statsFile(0), traceFile(0), maxMemory(0)
+{
+}
+
+const char* ConverterOptions::parse(const TCHAR* arg)
+{
+	if (arg[0] != '-')
+		return "unknown option: ";
+	if (arg[1] == '-')
+	{
+		if (T_strncmp(arg, TEXT("--stats="), 8) == 0 && arg[8])
+			statsFile = arg + 8;
+		else if (T_strncmp(arg, TEXT("--trace="), 8) == 0 && arg[8])
+			traceFile = arg + 8;
+		else if (T_strncmp(arg, TEXT("--max-memory="), 13) == 0 && arg[13])
+		{
+			// megabytes, or with suffix K, M or G
+			TCHAR* end;
+			double size = T_strtod(arg + 13, &end);
+			double unit = 1 << 20;
+			if (*end == 'K' || *end == 'k')
+				unit = 1 << 10, end++;
+			else if (*end == 'M' || *end == 'm')
+				end++;
+			else if (*end == 'G' || *end == 'g')
+				unit = 1 << 30, end++;
+			if (*end || size * unit < (1 << 20))
+				return "invalid memory size, at least 1M expected: ";
+			maxMemory = (unsigned long long)(size * unit);
+		}
+		else
+			return "unknown option: ";
+	}
+	else if (arg[1] == 'D')
+		Dversion = T_strtod(arg + 2, 0);
+	else if (arg[1] == 'C')
+		Dversion = 0;
+	else if (arg[1] == 'n')
+		demangleSymbols = false;
+	else if (arg[1] == 'e')
+		useTypedefEnum = true;
+	else if (arg[1] == 'd' && arg[2] == 'e' && arg[3] == 'b') // deb[ug]
+		debug = true;
+	else if (arg[1] == 's' && arg[2])
+		dotReplacementChar = (char)arg[2];
+	else if (arg[1] == 'p' && arg[2])
+		pdbref = arg + 2;
+	else if (arg[1] == 'a' && arg[2])
+	{
+		// -a<address>[-<end-address>], hexadecimal
+		TCHAR* end;
+		CV2PDB::DWARFRange range;
+		range.pclo = T_strtoull(arg + 2, &end, 16);
+		range.pchi = range.pclo + 1;
+		if (*end == '-')
+			range.pchi = T_strtoull(end + 1, &end, 16);
+		if (*end || range.pchi <= range.pclo)
+			return "invalid address range: ";
+		selectAddresses.push_back(range);
+	}
+	else if (arg[1] == 'f' && arg[2])
+	{
+		std::string file = toUTF8(arg + 2);
+		if (file.empty())
+			return "cannot convert file name: ";
+		selectSourceFiles.push_back(file);
+	}
+	else
+		return "unknown option: ";
+	return 0;
+}
+
+static void makefullpath(TCHAR* pdbname)
+{
+	TCHAR* pdbstart = pdbname;
+	TCHAR fullname[260];
+	TCHAR* pfullname = fullname;
+
+	int drive = 0;
+	if (pdbname[0] && pdbname[1] == ':')
+	{
+		if (pdbname[2] == '\\' || pdbname[2] == '/')
+			return;
+		drive = T_toupper (pdbname[0]) - 'A' + 1;
+		pdbname += 2;
+	}
+	else
+	{
+		drive = _getdrive();
+	}
+
+	if (*pdbname != '\\' && *pdbname != '/')
+	{
+		T_getdcwd(drive, pfullname, sizeof(fullname)/sizeof(fullname[0]) - 2);
+		pfullname += T_strlen(pfullname);
+		if (pfullname[-1] != '\\')
+			*pfullname++ = '\\';
+	}
+	else
+	{
+		*pfullname++ = 'a' - 1 + drive;
+		*pfullname++ = ':';
+	}
+	T_strcpy(pfullname, pdbname);
+	T_strcpy(pdbstart, fullname);
+
+	for(TCHAR*p = pdbstart; *p; p++)
+		if (*p == '/')
+			*p = '\\';
+
+	// remove relative parts "./" and "../"
+	while (TCHAR* p = T_strstr (pdbstart, TEXT("\\.\\")))
+		T_strcpy(p, p + 2);
+
+	while (TCHAR* p = T_strstr (pdbstart, TEXT("\\..\\")))
+	{
+		for (TCHAR* q = p - 1; q >= pdbstart; q--)
+			if (*q == '\\')
+			{
+				T_strcpy(q, p + 3);
+				break;
+			}
+	}
+}
+
+// full path of the PDB written for the image OUTNAME
+static void getPDBPath(TCHAR* pdbpath, const TCHAR* outname, const TCHAR* pdbname)
+{
+	if (pdbname)
+		T_strcpy (pdbpath, pdbname);
+	else
+	{
+		T_strcpy (pdbpath, outname);
+		TCHAR *pDot = T_strrchr (pdbpath, '.');
+		if (!pDot || pDot <= T_strrchr (pdbpath, '/') || pDot <= T_strrchr (pdbpath, '\\'))
+			T_strcat (pdbpath, TEXT(".pdb"));
+		else
+			T_strcpy (pDot, TEXT(".pdb"));
+	}
+	makefullpath(pdbpath);
+}
+
+static TCHAR* changeExtension(TCHAR* dbgname, const TCHAR* exename, const TCHAR* ext)
+{
+	T_strcpy(dbgname, exename);
+	TCHAR *pDot = T_strrchr(dbgname, '.');
+	if (!pDot || pDot <= T_strrchr(dbgname, '/') || pDot <= T_strrchr(dbgname, '\\'))
+		T_strcat(dbgname, ext);
+	else
+		T_strcpy(pDot, ext);
+	return dbgname;
+}
+
+std::string toUTF8(const TCHAR* s)
+{
+#ifdef UNICODE
+	char buf[3 * MAX_PATH];
+	if (!WideCharToMultiByte(CP_UTF8, 0, s, -1, buf, sizeof(buf), 0, 0))
+		return std::string();
+	return buf;
+#else
+	return s;
+#endif
+}
+
+tstring fromUTF8(const std::string& s)
+{
+#ifdef UNICODE
+	wchar_t buf[MAX_PATH];
+	if (!MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, buf, MAX_PATH))
+		return tstring();
+	return buf;
+#else
+	return s;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////
+// record buffers larger than this part of --max-memory are moved to temporary files
+static const int kSpillFraction = 16;
+
+Converter::Converter()
+: cache(0)
+{
+	userTypes.data = dwarfTypes.data = udtSymbols.data = 0;
+	userTypes.alloc = dwarfTypes.alloc = udtSymbols.alloc = 0;
+}
+
+Converter::~Converter()
+{
+	freeRecords(userTypes.data);
+	freeRecords(dwarfTypes.data);
+	freeRecords(udtSymbols.data);
+}
+
+bool Converter::fail(const TCHAR* name, const char* msg)
+{
+	errorMessage = toUTF8(name) + ": " + msg;
+	return setError(errorMessage.c_str());
+}
+
+void Converter::lendArenas(CV2PDB& cv2pdb)
+{
+	cv2pdb.userTypes = userTypes.data;
+	cv2pdb.allocUserTypes = userTypes.alloc;
+	cv2pdb.dwarfTypes = dwarfTypes.data;
+	cv2pdb.allocDwarfTypes = dwarfTypes.alloc;
+	cv2pdb.udtSymbols = udtSymbols.data;
+	cv2pdb.allocUdtSymbols = udtSymbols.alloc;
+	userTypes.data = dwarfTypes.data = udtSymbols.data = 0;
+	userTypes.alloc = dwarfTypes.alloc = udtSymbols.alloc = 0;
+}
+
+void Converter::reclaimArenas(CV2PDB& cv2pdb)
+{
+	userTypes.data = cv2pdb.userTypes;
+	userTypes.alloc = cv2pdb.allocUserTypes;
+	dwarfTypes.data = cv2pdb.dwarfTypes;
+	dwarfTypes.alloc = cv2pdb.allocDwarfTypes;
+	udtSymbols.data = cv2pdb.udtSymbols;
+	udtSymbols.alloc = cv2pdb.allocUdtSymbols;
+	cv2pdb.userTypes = cv2pdb.dwarfTypes = cv2pdb.udtSymbols = 0;
+	cv2pdb.cbUserTypes = cv2pdb.cbDwarfTypes = cv2pdb.cbUdtSymbols = 0;
+	cv2pdb.allocUserTypes = cv2pdb.allocDwarfTypes = cv2pdb.allocUdtSymbols = 0;
+}
+
+bool Converter::convert(const TCHAR* exename, const TCHAR* outname, const TCHAR* pdbname)
+{
+	setError("");
+	demangleSymbols = options.demangleSymbols;
+	useTypedefEnum = options.useTypedefEnum;
+	dotReplacementChar = options.dotReplacementChar;
+
+	convStats.clear();
+	convStats.enabled = options.statsFile != 0 || options.traceFile != 0;
+	convStats.tracing = options.traceFile != 0;
+	convStats.beginPhase("loadImage");
+
+	PEImage exe, dbg, *img = NULL;
+	TCHAR dbgname[MAX_PATH];
+
+	if (!exe.loadExe(exename))
+		return fail(exename, exe.getLastError());
+	if (exe.countCVEntries() || exe.hasDWARF())
+		img = &exe;
+	else
+	{
+		// try DBG file alongside executable
+		changeExtension(dbgname, exename, TEXT(".dbg"));
+		struct _stat buffer;
+		if (T_stat(dbgname, &buffer) != 0)
+			return fail(exename, "no codeview debug entries found");
+		if (!dbg.loadExe(dbgname))
+			return fail(dbgname, dbg.getLastError());
+		if (dbg.countCVEntries() == 0)
+			return fail(dbgname, "no codeview debug entries found");
+
+		img = &dbg;
+	}
+
+	// the PDB is written to a temporary file and renamed when it is complete,
+	// so a debugger never loads a partially written PDB
+	TCHAR pdbpath[MAX_PATH], tmppath[MAX_PATH + 4];
+	getPDBPath(pdbpath, outname ? outname : exename, pdbname);
+	T_strcpy(tmppath, pdbpath);
+	T_strcat(tmppath, TEXT(".tmp"));
+
+	bool rc;
+	conversionCache = cache;
+	if (cache)
+		cache->nextConversion();
+	{
+		CV2PDB cv2pdb(*img);
+		cv2pdb.Dversion = options.Dversion;
+		cv2pdb.debug = options.debug;
+		cv2pdb.selectAddresses = options.selectAddresses;
+		cv2pdb.selectSourceFiles = options.selectSourceFiles;
+		if (options.maxMemory)
+			cv2pdb.spillThreshold = (size_t)std::min<unsigned long long>(options.maxMemory / kSpillFraction, SIZE_MAX);
+		cv2pdb.initLibraries();
+
+		// with a memory limit, the buffers are not kept for the next conversion
+		if (!options.maxMemory)
+			lendArenas(cv2pdb);
+		rc = run(cv2pdb, exe, exename, outname ? outname : exename, pdbpath, tmppath);
+		if (!options.maxMemory)
+			reclaimArenas(cv2pdb);
+
+		if (rc)
+		{
+			convStats.beginPhase("cleanup"); // commits the PDB
+			cv2pdb.cleanup(true);
+			convStats.endPhase();
+		}
+	}
+	DIECursor::setContext(0); // saves the abbreviations to the cache
+	conversionCache = 0;
+	if (!rc)
+	{
+		T_unlink(tmppath);
+		return false;
+	}
+	if (!MoveFileEx(tmppath, pdbpath, MOVEFILE_REPLACE_EXISTING))
+	{
+		T_unlink(tmppath);
+		return fail(pdbpath, "cannot replace PDB file");
+	}
+
+	if (options.statsFile && !convStats.write(options.statsFile, exename))
+		return fail(options.statsFile, "cannot write statistics");
+	if (options.traceFile && !convStats.writeTrace(options.traceFile))
+		return fail(options.traceFile, "cannot write trace");
+	return true;
+}
+
+bool Converter::run(CV2PDB& cv2pdb, PEImage& exe, const TCHAR* exename, const TCHAR* outname,
+                    const TCHAR* pdbpath, const TCHAR* tmppath)
+{
+	T_unlink(tmppath);
+
+	// the image refers to the final name of the PDB
+	convStats.beginPhase("openPDB");
+	if(!cv2pdb.openPDB(tmppath, options.pdbref ? options.pdbref : pdbpath))
+		return fail(pdbpath, cv2pdb.getLastError());
+
+	if(exe.hasDWARF())
+	{
+		convStats.beginPhase("relocateDebugLineInfo");
+		if(!exe.relocateDebugLineInfo(0x400000))
+			return fail(exename, exe.getLastError());
+
+		convStats.beginPhase("createDWARFModules");
+		if(!cv2pdb.createDWARFModules())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("addDWARFTypes");
+		if(!cv2pdb.addDWARFTypes())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("addDWARFLines");
+		if(!cv2pdb.addDWARFLines())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("addDWARFPublics");
+		if (!cv2pdb.addDWARFPublics())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("writeDWARFImage");
+		if (!cv2pdb.writeDWARFImage(outname))
+			return fail(outname, cv2pdb.getLastError());
+	}
+	else
+	{
+		convStats.beginPhase("initSegMap");
+		if (!cv2pdb.initSegMap())
+			return fail(exename, cv2pdb.getLastError());
+
+		convStats.beginPhase("initGlobalSymbols");
+		if (!cv2pdb.initGlobalSymbols())
+			return fail(exename, cv2pdb.getLastError());
+
+		convStats.beginPhase("initGlobalTypes");
+		if (!cv2pdb.initGlobalTypes())
+			return fail(exename, cv2pdb.getLastError());
+
+		convStats.beginPhase("createModules");
+		if (!cv2pdb.createModules())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("addTypes");
+		if (!cv2pdb.addTypes())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("addSymbols");
+		if (!cv2pdb.addSymbols())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("addSrcLines");
+		if (!cv2pdb.addSrcLines())
+			return fail(pdbpath, cv2pdb.getLastError());
+		if (options.maxMemory)
+			std::vector<std::vector<unsigned int>>().swap(cv2pdb.srcLineStart); // only needed for the line numbers
+
+		convStats.beginPhase("addPublics");
+		if (!cv2pdb.addPublics())
+			return fail(pdbpath, cv2pdb.getLastError());
+
+		convStats.beginPhase("writeImage");
+		if (!exe.isDBG())
+			if (!cv2pdb.writeImage(outname, exe))
+				return fail(outname, cv2pdb.getLastError());
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+// peak memory of a conversion relative to the size of the image
+static const int kMemoryPerImageByte = 4;
+
+bool BatchConverter::readList(const TCHAR* listfile, std::vector<Item>& items)
+{
+	FILE* f = T_fopen(listfile, TEXT("rb"));
+	if (!f)
+	{
+		errorMessage = toUTF8(listfile) + ": cannot open";
+		return setError(errorMessage.c_str());
+	}
+
+	char line[4 * MAX_PATH];
+	for (int lineno = 1; fgets(line, sizeof(line), f); lineno++)
+	{
+		char* p = line;
+		if (lineno == 1 && strncmp(p, "\xef\xbb\xbf", 3) == 0)
+			p += 3; // UTF-8 BOM
+
+		// split into arguments, "" quotes spaces
+		std::vector<std::string> args;
+		for (;;)
+		{
+			while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+				p++;
+			if (!*p || (*p == '#' && args.empty()))
+				break;
+			std::string arg;
+			bool quoted = false;
+			for (; *p && (quoted || (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')); p++)
+				if (*p == '"')
+					quoted = !quoted;
+				else
+					arg += *p;
+			args.push_back(arg);
+		}
+		if (args.empty())
+			continue;
+
+		Item item;
+		if (args.size() > 3 || (item.exename = fromUTF8(args[0])).empty())
+		{
+			fclose(f);
+			char msg[32];
+			sprintf(msg, "(%d): invalid line", lineno);
+			errorMessage = toUTF8(listfile) + msg;
+			return setError(errorMessage.c_str());
+		}
+		if (args.size() > 1)
+			item.outname = fromUTF8(args[1]);
+		if (args.size() > 2)
+			item.pdbname = fromUTF8(args[2]);
+
+		struct _stat buffer;
+		item.memory = T_stat(item.exename.c_str(), &buffer) == 0 ? (unsigned long long)buffer.st_size * kMemoryPerImageByte : 0;
+		items.push_back(item);
+	}
+	fclose(f);
+	return true;
+}
+
+int BatchConverter::run(const TCHAR* listfile)
+{
+	setError("");
+	items.clear();
+	if (!readList(listfile, items))
+		return -1;
+	std::stable_sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.memory > b.memory; });
+
+	if (!maxMemory)
+		maxMemory = options.maxMemory;
+	if (!maxMemory)
+	{
+		MEMORYSTATUSEX status;
+		status.dwLength = sizeof(status);
+		maxMemory = GlobalMemoryStatusEx(&status) ? status.ullTotalPhys / 2 : 1ULL << 31;
+	}
+	size_t nthreads = jobs > 0 ? jobs : std::max(std::thread::hardware_concurrency(), 1u);
+	nthreads = std::min(nthreads, items.size());
+
+	started.assign(items.size(), false);
+	memoryInUse = 0;
+	running = 0;
+	failures = 0;
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < nthreads; t++)
+		threads.push_back(std::thread(&BatchConverter::worker, this, (unsigned int)nthreads));
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	printf("%d of %d images converted\n", (int)items.size() - failures, (int)items.size());
+	return failures;
+}
+
+// warnings of the image converted by a batch worker
+struct WarningLog
+{
+	std::mutex lock; // tasks of the conversion report from their own threads
+	std::string text;
+};
+
+static void logWarning(void* context, const char* msg)
+{
+	WarningLog* log = (WarningLog*)context;
+	std::lock_guard<std::mutex> guard(log->lock);
+	log->text.append("warning: ").append(msg).append("\n");
+}
+
+void BatchConverter::worker(unsigned int nworkers)
+{
+	CoInitialize(nullptr);
+	// the images are converted in parallel, share the processors for decompressing sections
+	inflateThreads = std::max(std::thread::hardware_concurrency() / nworkers, 1u);
+	WarningLog warnings;
+	warningHandler = logWarning;
+	warningContext = &warnings;
+	Converter converter; // keeps its buffers for the images converted by this thread
+	converter.options = options;
+
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;)
+	{
+		// the largest image fitting into the memory left, any image if nothing else is converted
+		size_t next = items.size();
+		bool pending = false;
+		for (size_t i = 0; i < items.size(); i++)
+			if (!started[i])
+			{
+				pending = true;
+				if (running == 0 || memoryInUse + items[i].memory <= maxMemory)
+				{
+					next = i;
+					break;
+				}
+			}
+		if (!pending)
+			break;
+		if (next == items.size())
+		{
+			done.wait(guard);
+			continue;
+		}
+
+		const Item& item = items[next];
+		started[next] = true;
+		running++;
+		memoryInUse += item.memory;
+		guard.unlock();
+
+		bool ok = converter.convert(item.exename.c_str(), item.outname.empty() ? 0 : item.outname.c_str(),
+		                            item.pdbname.empty() ? 0 : item.pdbname.c_str());
+
+		guard.lock();
+		running--;
+		memoryInUse -= item.memory;
+		printf("%s", warnings.text.c_str());
+		warnings.text.clear();
+		if (ok)
+			printf(SARG ": converted\n", item.exename.c_str());
+		else
+		{
+			failures++;
+			printf("%s\n", converter.getLastError());
+		}
+		done.notify_all();
+	}
+}
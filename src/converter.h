@@ -0,0 +1,165 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __CONVERTER_H__
+#define __CONVERTER_H__
+
+#include "LastError.h"
+#include "cache.h"
+#include "cv2pdb.h"
+
+#include <windows.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef UNICODE
+#define T_toupper	towupper
+#define T_getdcwd	_wgetdcwd
+#define T_strlen	wcslen
+#define T_strcpy	wcscpy
+#define T_strcat	wcscat
+#define T_strstr	wcsstr
+#define T_strcmp	wcscmp
+#define T_strncmp	wcsncmp
+#define T_strtod	wcstod
+#define T_strtoull	_wcstoui64
+#define T_strrchr	wcsrchr
+#define T_unlink	_wremove
+#define T_main		wmain
+#define SARG		"%S"
+#define T_stat		_wstat
+#define T_fopen		_wfopen
+#else
+#define T_toupper	toupper
+#define T_getdcwd	_getdcwd
+#define T_strlen	strlen
+#define T_strcpy	strcpy
+#define T_strcat	strcat
+#define T_strstr	strstr
+#define T_strcmp	strcmp
+#define T_strncmp	strncmp
+#define T_strtod	strtod
+#define T_strtoull	_strtoui64
+#define T_strrchr	strrchr
+#define T_unlink	unlink
+#define T_main		main
+#define SARG		"%s"
+#define T_stat		stat
+#define T_fopen		fopen
+#endif
+
+// Options of a conversion, the defaults are those of the command line without options.
+// The strings are not copied, they must stay valid during the conversion.
+struct ConverterOptions
+{
+	double Dversion;         // -D<version>, 0 for C/C++ (-C)
+	bool debug;              // -debug
+	bool demangleSymbols;    // cleared by -n
+	bool useTypedefEnum;     // -e
+	char dotReplacementChar; // -s<C>
+	const TCHAR* pdbref;     // -p<embedded-pdb>
+	const TCHAR* statsFile;  // --stats=<file>
+	const TCHAR* traceFile;  // --trace=<file>
+
+	// --max-memory=<size> in bytes, 0 for no limit. Type and symbol records are moved to
+	// temporary files and released as soon as possible, trading speed for memory.
+	unsigned long long maxMemory;
+
+	// -a and -f, restrict the conversion of DWARF debug information to some units
+	std::vector<CV2PDB::DWARFRange> selectAddresses;
+	std::vector<std::string> selectSourceFiles;
+
+	ConverterOptions();
+
+	// set the option of the command line argument ARG, returns NULL if successful or the
+	// start of an error message for ARG otherwise. ARG must stay valid like the strings.
+	const char* parse(const TCHAR* arg);
+};
+
+// Converts images in-process, the command line tool is a wrapper around it. Errors
+// are reported by the return value of convert() and getLastError(), not by exiting.
+// A Converter can be used for any number of conversions, it keeps the buffers of the
+// type and symbol records for the next one. Converters on different threads are
+// independent, except for sharing the mspdb DLL loaded by the first conversion.
+class Converter : public LastError
+{
+public:
+	ConverterOptions options;
+	// results of previous conversions reused by the next ones, NULL for none (the default).
+	// Used by the server and --watch, not owned by the converter.
+	ConversionCache* cache;
+
+	Converter();
+	~Converter();
+
+	// convert the debug information of EXENAME (or the DBG file alongside), write the
+	// image to OUTNAME (NULL to rewrite EXENAME) and the PDB to PDBNAME (NULL to use
+	// OUTNAME with extension .pdb)
+	bool convert(const TCHAR* exename, const TCHAR* outname = 0, const TCHAR* pdbname = 0);
+
+private:
+	bool fail(const TCHAR* name, const char* msg);
+	bool run(CV2PDB& cv2pdb, PEImage& exe, const TCHAR* exename, const TCHAR* outname,
+	         const TCHAR* pdbpath, const TCHAR* tmppath);
+
+	// record buffer of CV2PDB, lent to each conversion
+	struct Arena
+	{
+		BYTE* data;
+		int alloc;
+	};
+	void lendArenas(CV2PDB& cv2pdb);
+	void reclaimArenas(CV2PDB& cv2pdb);
+
+	Arena userTypes;
+	Arena dwarfTypes;
+	Arena udtSymbols;
+	std::string errorMessage;
+};
+
+typedef std::basic_string<TCHAR> tstring;
+
+// Converts the images of a list file on a pool of threads (--batch=<file>). Each line
+// of the file has the arguments <exe-file> [new-exe-file] [pdb-file] of a conversion,
+// paths with spaces must be quoted. Empty lines and lines starting with # are ignored.
+// Failed conversions are reported and do not stop the batch.
+class BatchConverter : public LastError
+{
+public:
+	ConverterOptions options;    // for all images
+	int jobs;                    // worker threads, 0 for the number of processors
+	unsigned long long maxMemory; // bytes for the images in conversion, 0 for options.maxMemory or half the physical memory
+
+	BatchConverter() : jobs(0), maxMemory(0) {}
+
+	// returns the number of failed conversions, -1 if the list cannot be read
+	int run(const TCHAR* listfile);
+
+private:
+	struct Item
+	{
+		tstring exename, outname, pdbname;
+		unsigned long long memory; // estimated peak memory of the conversion
+	};
+	bool readList(const TCHAR* listfile, std::vector<Item>& items);
+	void worker(unsigned int nworkers);
+
+	std::vector<Item> items; // largest first
+	std::vector<bool> started;
+	unsigned long long memoryInUse;
+	int running;
+	int failures;
+	std::mutex lock;
+	std::condition_variable done;
+	std::string errorMessage;
+};
+
+std::string toUTF8(const TCHAR* s);
+tstring fromUTF8(const std::string& s);
+
+#endif //__CONVERTER_H__
@@ -8,9 +8,12 @@
 #include "PEImage.h"
 #include "symutil.h"
 #include "cvutil.h"
+#include "spill.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <direct.h>
+#include <algorithm>
 
 #define REMOVE_LF_DERIVED  1  // types wrong by DMD
 #define PRINT_INTERFACEVERSON 0
@@ -25,8 +28,11 @@ CV2PDB::CV2PDB(PEImage& image)
 , globalSymbols(0), cbGlobalSymbols(0), staticSymbols(0), cbStaticSymbols(0)
 , udtSymbols(0), cbUdtSymbols(0), allocUdtSymbols(0)
 , dwarfTypes(0), cbDwarfTypes(0), allocDwarfTypes(0)
-, srcLineStart(0), srcLineSections(0)
+, spillThreshold(0)
 , pointerTypes(0)
+, cfi_index(0)
+, lineQueue(0)
+, dwarfUnitsSelected(false)
 , Dversion(2)
 , debug(false)
 , classEnumType(0), ifaceEnumType(0), cppIfaceEnumType(0), structEnumType(0)
@@ -44,7 +50,6 @@ CV2PDB::CV2PDB(PEImage& image)
 	addStringViewHelper = false;
 	methodListToOneMethod = true;
 	removeMethodLists = true;
-	useTypedefEnum = false;
 	useGlobalMod = true;
 	thisIsNotRef = true;
 	v3 = true;
@@ -55,10 +60,18 @@ CV2PDB::CV2PDB(PEImage& image)
 CV2PDB::~CV2PDB()
 {
 	cleanup(false);
+	free_cfi_index();
 }
 
 bool CV2PDB::cleanup(bool commit)
 {
+	if (lineQueue)
+	{
+		// the conversion failed before the lines were added
+		lineTask.join();
+		delete lineQueue;
+		lineQueue = 0;
+	}
 	if (modules)
 		for (int m = 0; m < countEntries; m++)
 			if (modules[m])
@@ -77,27 +90,31 @@ bool CV2PDB::cleanup(bool commit)
 	if (ipi)
 		ipi->Close();
 	if (pdb)
+	{
+		TraceSpan span("pdb", "commit");
 		pdb->Commit();
+	}
 	if (pdb)
 		pdb->Close();
 
 	if (rsds)
 		delete [] (char*) rsds;
-	if (globalTypes)
-		free(globalTypes);
-	if (userTypes)
-		free(userTypes);
-	if (udtSymbols)
-		free(udtSymbols);
-	if (dwarfTypes)
-		free(dwarfTypes);
+	freeRecords(globalTypes);
+	freeRecords(userTypes);
+	freeRecords(udtSymbols);
+	freeRecords(dwarfTypes);
 	delete [] pointerTypes;
 
-	for(int i = 0; i < srcLineSections; i++)
-		delete [] srcLineStart[i];
-	delete [] srcLineStart;
-	srcLineStart = 0;
-	srcLineSections =  0;
+	srcLineStart.clear();
+	procCFA.clear();
+	locListSummaries.clear();
+	rangeLists.clear();
+	typeSizes.clear();
+	dwarfPublics.clear();
+	dwarfUnitRanges.clear();
+	dwarfUnits.clear();
+	dwarfLineOffsets.clear();
+	dwarfUnitsSelected = false;
 
 	delete [] segFrame2Index;
 	segFrame2Index = 0;
@@ -115,6 +132,7 @@ bool CV2PDB::cleanup(bool commit)
 	udtSymbols = 0;
 	cbUdtSymbols = 0;
 	allocUdtSymbols = 0;
+	dwarfTypes = 0;
 	cbDwarfTypes = 0;
 	allocDwarfTypes = 0;
 	modules = 0;
@@ -866,7 +884,7 @@ void CV2PDB::checkUserTypeAlloc(int size, int add)
 	if (cbUserTypes + size >= allocUserTypes)
 	{
 		allocUserTypes = allocUserTypes * 4 / 3 + size + add;
-		userTypes = (BYTE*) realloc(userTypes, allocUserTypes);
+		userTypes = (BYTE*) reallocRecords(userTypes, allocUserTypes, spillThreshold);
 		if(!userTypes)
 			setError("out of memory");
 	}
@@ -887,7 +905,7 @@ void CV2PDB::checkGlobalTypeAlloc(int size, int add)
 	if (cbGlobalTypes + size > allocGlobalTypes)
 	{
 		allocGlobalTypes = allocGlobalTypes * 4 / 3 + size + add;
-		globalTypes = (unsigned char*) realloc(globalTypes, allocGlobalTypes);
+		globalTypes = (unsigned char*) reallocRecords(globalTypes, allocGlobalTypes, spillThreshold);
 		if(!globalTypes)
 			setError("out of memory");
 	}
@@ -1476,7 +1494,7 @@ const char* CV2PDB::appendDynamicArray(int indexType, int elemType)
 
 	checkUserTypeAlloc();
 
-	static char name[kMaxNameLen];
+	static thread_local char name[kMaxNameLen];
 	nameOfDynamicArray(indexType, elemType, name, sizeof(name));
 
 	// nextUserType: pointer to elemType
@@ -1601,7 +1619,7 @@ int CV2PDB::appendAssocArray(codeview_type* odtype, int keyType, int elemType)
 
 	checkUserTypeAlloc();
 
-	static char name[kMaxNameLen];
+	static thread_local char name[kMaxNameLen];
 	if(Dversion >= 2.068)
 		return appendAssocArray2068(odtype, keyType, elemType);
 
@@ -1768,7 +1786,7 @@ const char* CV2PDB::appendDelegate(int thisType, int funcType)
 	rdtype->fieldlist.len = len1 + len2 + 2;
 	cbUserTypes += rdtype->fieldlist.len + 2;
 
-	static char name[kMaxNameLen];
+	static thread_local char name[kMaxNameLen];
 	nameOfDelegate(thisType, funcType, name, sizeof(name));
 
 	// nextUserType + 3: struct delegate<>
@@ -2144,7 +2162,7 @@ bool CV2PDB::initGlobalTypes()
 			pointerTypes = new int[globalTypeHeader->cTypes];
 			memset(pointerTypes, 0, globalTypeHeader->cTypes * sizeof(*pointerTypes));
 
-			globalTypes = (unsigned char*) malloc(entry->cb + typePrefix);
+			globalTypes = (unsigned char*) reallocRecords(0, entry->cb + typePrefix, spillThreshold);
 			allocGlobalTypes = entry->cb + typePrefix;
 			if (!globalTypes)
 				return setError("Out of memory");
@@ -2628,7 +2646,7 @@ bool CV2PDB::addTypes()
 	return true;
 }
 
-bool CV2PDB::markSrcLineInBitmap(int segIndex, int adr)
+bool CV2PDB::markSrcLineStart(std::vector<std::vector<unsigned int>>& lineStarts, int segIndex, int adr)
 {
 	if (segIndex < 0 || segIndex >= segMap->cSeg)
 		return setError("invalid segment info in line number info");
@@ -2637,30 +2655,21 @@ bool CV2PDB::markSrcLineInBitmap(int segIndex, int adr)
 	if (off < 0 || off >= (int) segMapDesc[segIndex].cbSeg)
 		return setError("invalid segment offset in line number info");
 
-	srcLineStart[segIndex][off] = true;
+	lineStarts[segIndex].push_back(off);
 	return true;
 }
 
-bool CV2PDB::createSrcLineBitmap()
+bool CV2PDB::createSrcLineIndex()
 {
-	if (srcLineStart)
+	if (!srcLineStart.empty())
 		return true;
 	if (!segMap || !segMapDesc || !segFrame2Index)
 		return false;
 
-	srcLineSections = segMap->cSeg;
-	srcLineStart = new char*[srcLineSections];
-	memset(srcLineStart, 0, srcLineSections * sizeof (*srcLineStart));
-
-	for (int s = 0; s < segMap->cSeg; s++)
-	{
-		// cbSeg=-1 found in binary created by Metroworks CodeWarrior, so avoid new char[(size_t)-1]
-		if (segMapDesc[s].cbSeg <= LONG_MAX)
-		{
-			srcLineStart[s] = new char[segMapDesc[s].cbSeg];
-			memset(srcLineStart[s], 0, segMapDesc[s].cbSeg);
-		}
-	}
+	// cbSeg=-1 found in binary created by Metroworks CodeWarrior, but as we only
+	// record line starts, no memory proportional to the segment size is needed.
+	// The index is only published once it is sorted, a failure leaves it unbuilt
+	std::vector<std::vector<unsigned int>> lineStarts(segMap->cSeg);
 
 	for (int m = 0; m < countEntries; m++)
 	{
@@ -2688,11 +2697,11 @@ bool CV2PDB::createSrcLineBitmap()
 					int segIndex = segFrame2Index[sourceLine->Seg];
 
 					 // also mark the start of the line info segment
-					if (!markSrcLineInBitmap(segIndex, lnSegStartEnd[2*s]))
+					if (!markSrcLineStart(lineStarts, segIndex, lnSegStartEnd[2*s]))
 						return false;
 
 					for (int ln = 0; ln < cnt; ln++)
-						if (!markSrcLineInBitmap(segIndex, sourceLine->offset[ln]))
+						if (!markSrcLineStart(lineStarts, segIndex, sourceLine->offset[ln]))
 							return false;
 				}
 			}
@@ -2707,18 +2716,27 @@ bool CV2PDB::createSrcLineBitmap()
 			{
 				int seg = segDesc[s].Seg;
 				int segIndex = seg >= 0 && seg < segMap->cSeg ? segFrame2Index[seg] : -1;
-				if (!markSrcLineInBitmap(segIndex, segDesc[s].Off))
+				if (!markSrcLineStart(lineStarts, segIndex, segDesc[s].Off))
 					return false;
 			}
 		}
 	}
 
+	// sort the line starts of each segment for binary search in getNextSrcLine
+	for (size_t s = 0; s < lineStarts.size(); s++)
+	{
+		std::vector<unsigned int>& starts = lineStarts[s];
+		std::sort(starts.begin(), starts.end());
+		starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+		starts.shrink_to_fit();
+	}
+	srcLineStart.swap(lineStarts);
 	return true;
 }
 
 int CV2PDB::getNextSrcLine(int seg, unsigned int off)
 {
-	if (!createSrcLineBitmap())
+	if (!createSrcLineIndex())
 		return -1;
 
 	int s = segFrame2Index[seg];
@@ -2729,9 +2747,12 @@ int CV2PDB::getNextSrcLine(int seg, unsigned int off)
 	if (off < 0 || off >= segMapDesc[s].cbSeg || off > LONG_MAX)
 		return 0;
 
-	for (off++; off < segMapDesc[s].cbSeg; off++)
-		if (srcLineStart[s][off])
-			break;
+	const std::vector<unsigned int>& starts = srcLineStart[s];
+	std::vector<unsigned int>::const_iterator it = std::upper_bound(starts.begin(), starts.end(), off);
+	if (it == starts.end())
+		off = segMapDesc[s].cbSeg;
+	else
+		off = *it;
 
 	return off + segMapDesc[s].offset;
 }
@@ -2791,6 +2812,7 @@ bool CV2PDB::addSrcLines()
 					                       (unsigned char*) lineInfo, cnt * sizeof(*lineInfo));
 					if (rc <= 0)
 						return setError("cannot add line number info to module");
+					convStats.lineRows += cnt;
 					delete [] lineInfo;
 				}
 			}
@@ -2987,6 +3009,7 @@ bool CV2PDB::addPublics()
 						rc = dbi->AddPublic2(symname, sym->data_v1.segment, sym->data_v1.offset, type);
 					if (rc <= 0)
 						return setError("cannot add public");
+					convStats.publics++;
 					break;
 				}
 			}
@@ -3330,7 +3353,7 @@ void CV2PDB::checkUdtSymbolAlloc(int size, int add)
 	if (cbUdtSymbols + size > allocUdtSymbols)
 	{
 		allocUdtSymbols = allocUdtSymbols * 4 / 3 + size + add;
-		udtSymbols = (BYTE*) realloc(udtSymbols, allocUdtSymbols);
+		udtSymbols = (BYTE*) reallocRecords(udtSymbols, allocUdtSymbols, spillThreshold);
 		if (!udtSymbols)
 			setError("out of memory");
 	}
@@ -3355,12 +3378,14 @@ bool CV2PDB::addSymbols(mspdb::Mod* mod, BYTE* symbols, int cb, bool addGlobals)
 {
 	int prefix = mspdb::vsVersion >= 14 ? 3 : 4; // mod == globmod ? 3 : 4;
 	int words = (cb + cbGlobalSymbols + cbStaticSymbols + cbUdtSymbols + 3) / 4 + prefix;
-	DWORD* data = new DWORD[2 * words + 1000];
+	DWORD* data = (DWORD*) reallocRecords(0, (2 * words + 1000) * sizeof(DWORD), spillThreshold);
+	if (!data)
+		return setError("out of memory");
 
 	int databytes = copySymbols(symbols, cb, (BYTE*) (data + prefix), 0);
 
 	bool rc = writeSymbols(mod, data, databytes, prefix, addGlobals);
-	delete [] data;
+	freeRecords(data);
 	return rc;
 }
 
@@ -3378,6 +3403,10 @@ bool CV2PDB::writeSymbols(mspdb::Mod* mod, DWORD* data, int databytes, int prefi
 	data[2] = databytes + 4 * (prefix - 3);
 	if (prefix > 3)
 		data[3] = 1;
+	BYTE* symbols = (BYTE*) (data + prefix);
+	for (int p = 0; p < databytes; p += ((codeview_symbol*) (symbols + p))->generic.len + 2)
+		convStats.symbols++;
+
 	int rc = mod->AddSymbols((BYTE*) data, ((databytes + 3) / 4 + prefix) * 4);
 	if (rc <= 0)
 		return setError(
@@ -3410,7 +3439,11 @@ bool CV2PDB::addSymbols()
 	DWORD* data = 0;
 	int databytes = 0;
 	if (useGlobalMod)
-		data = new DWORD[2 * img.getCVSize() + 1000]; // enough for all symbols
+	{
+		data = (DWORD*) reallocRecords(0, (2 * img.getCVSize() + 1000) * sizeof(DWORD), spillThreshold); // enough for all symbols
+		if (!data)
+			return setError("out of memory");
+	}
 
 	bool addGlobals = true;
 	for (int m = 0; m < countEntries; m++)
@@ -3438,7 +3471,7 @@ bool CV2PDB::addSymbols()
 	if (useGlobalMod)
 		rc = writeSymbols(globalMod(), data, databytes, prefix, true);
 
-	delete [] data;
+	freeRecords(data);
 	return rc;
 }
 
@@ -12,10 +12,12 @@
 #include "LastError.h"
 #include "mspdb.h"
 #include "readDwarf.h"
+#include "stats.h"
 
 #include <windows.h>
 #include <map>
 #include <unordered_map>
+#include <vector>
 
 extern "C" {
 	#include "mscvpdb.h"
@@ -156,8 +158,8 @@ public:
 	bool addSymbols(int iMod, BYTE* symbols, int cb, bool addGlobals);
 	bool addSymbols();
 
-	bool markSrcLineInBitmap(int segIndex, int adr);
-	bool createSrcLineBitmap();
+	bool markSrcLineStart(std::vector<std::vector<unsigned int>>& lineStarts, int segIndex, int adr);
+	bool createSrcLineIndex();
 	int  getNextSrcLine(int seg, unsigned int off);
 
 	bool writeImage(const TCHAR* opath, PEImage& exeImage);
@@ -179,6 +181,9 @@ public:
 	int  addDWARFBasicType(const char*name, int encoding, int byte_size);
 	int  addDWARFEnum(DWARF_InfoData& enumid, DWARF_CompilationUnit* cu, DIECursor cursor);
 	int  getTypeByDWARFPtr(DWARF_CompilationUnit* cu, byte* ptr);
+	int  findDWARFType(byte* ptr); // -1 if not mapped
+	void mapDWARFType(byte* ptr, int type);
+	void sortDWARFTypeMap();
 	int  getDWARFTypeSize(DWARF_CompilationUnit* cu, byte* ptr);
 	void getDWARFArrayBounds(DWARF_InfoData& arrayid, DWARF_CompilationUnit* cu, DIECursor cursor,
 		int& basetype, int& lowerBound, int& upperBound);
@@ -187,6 +192,39 @@ public:
 	int getDWARFBasicType(int encoding, int byte_size);
 
 	void build_cfi_index();
+	void free_cfi_index();
+	void build_cfa_table();
+	// interpret the line programs on another thread, the lines are added by addDWARFLines
+	void startDWARFLines();
+	const LOCSummary& getLocListSummary(unsigned long off, bool loclists);
+
+	struct DWARFRange
+	{
+		uint64_t pclo, pchi;
+		bool operator<(const DWARFRange& other) const { return pclo < other.pclo; }
+	};
+	// sorted and merged address ranges of the range list at OFF in .debug_ranges
+	// or .debug_rnglists, relative to the base address BASE of the unit
+	const std::vector<DWARFRange>& getDWARFRanges(DWARF_CompilationUnit* cu, unsigned long off, uint64_t base);
+	Location getProcCFA(unsigned int pclo, unsigned int pchi) const;
+
+	struct DWARFUnitRange
+	{
+		uint64_t pclo, pchi;
+		DWARF_CompilationUnit* cu;
+		bool operator<(const DWARFUnitRange& other) const { return pclo < other.pclo; }
+	};
+	// sorted address ranges of all compilation units, from .debug_aranges or the unit DIEs.
+	// Ranges can overlap (e.g. the aranges of COMDAT functions), dwarfUnitRangeEnds
+	// finds the first range reaching an address.
+	void buildDWARFAddressIndex();
+	// restrict the conversion to the units covering selectAddresses or selectSourceFiles
+	bool selectDWARFUnits();
+	bool isDWARFUnitSelected(DWARF_CompilationUnit* cu) const;
+	// address of a function or section and offset of a global variable for their public symbols
+	unsigned long getDWARFEntryPoint(DWARF_InfoData& id, DWARF_CompilationUnit* cu, uint64_t base);
+	int findDWARFGlobalVar(DWARF_InfoData& id, unsigned long& segOff, bool& dllimport);
+	int getDWARFGlobalVarType(DWARF_InfoData& id, DWARF_CompilationUnit* cu, bool dllimport);
 	bool mapTypes();
 	bool createTypes();
 
@@ -195,6 +233,60 @@ public:
 
 	PEImage& img;
 	CFIIndex* cfi_index;
+	mutable ConversionTask cfiTask; // builds cfi_index, joined before it is used
+
+	ConversionTask lineTask;
+	DWARF_LineQueue* lineQueue; // line blocks of startDWARFLines not yet added
+
+	// CFA rule for each procedure, sorted by PC range
+	struct ProcCFA
+	{
+		unsigned int pclo, pchi;
+		Location cfa;
+
+		bool operator<(const ProcCFA& other) const {
+			return pclo < other.pclo || (pclo == other.pclo && pchi < other.pchi);
+		}
+		static bool samePC(const ProcCFA& a, const ProcCFA& b) {
+			return a.pclo == b.pclo && a.pchi == b.pchi;
+		}
+	};
+	std::vector<ProcCFA> procCFA;
+
+	// decoded location lists, indexed by section offset
+	std::unordered_map<unsigned long long, LOCSummary> locListSummaries;
+	// decoded range lists, indexed by section offset and the bases they are relative to
+	struct RangeListKey
+	{
+		unsigned long long off; // the top bit selects .debug_rnglists
+		uint64_t base;          // base address of the unit
+		unsigned long addrBase; // address table of the unit (.debug_rnglists only)
+
+		bool operator==(const RangeListKey& other) const {
+			return off == other.off && base == other.base && addrBase == other.addrBase;
+		}
+		struct Hasher
+		{
+			size_t operator()(const RangeListKey& k) const {
+				return (size_t)((k.off * 0x9e3779b97f4a7c15ull) ^ k.base ^ ((unsigned long long)k.addrBase << 32));
+			}
+		};
+	};
+	std::unordered_map<RangeListKey, std::vector<DWARFRange>, RangeListKey::Hasher> rangeLists;
+
+	// functions and variables from the accelerated name tables in the units that are
+	// not selected, their publics are added without converting the units
+	std::vector<byte*> dwarfPublics;
+
+	std::vector<DWARFUnitRange> dwarfUnitRanges;
+	std::vector<uint64_t> dwarfUnitRangeEnds; // maximum pchi of the ranges up to each index
+	// only convert the units covering these addresses or source files if not empty
+	std::vector<DWARFRange> selectAddresses;
+	std::vector<std::string> selectSourceFiles;
+	// units to convert, sorted, and the .debug_line offsets of their line programs
+	std::vector<DWARF_CompilationUnit*> dwarfUnits;
+	std::vector<unsigned long> dwarfLineOffsets;
+	bool dwarfUnitsSelected;
 
 	mspdb::PDB* pdb;
 	mspdb::DBI *dbi;
@@ -237,6 +329,10 @@ public:
 	int cbDwarfTypes;
 	int allocDwarfTypes;
 
+	// record buffers growing beyond this size are moved to temporary files (--max-memory),
+	// 0 for no limit, see spill.h
+	size_t spillThreshold;
+
 	int nextUserType;
 	int nextDwarfType;
 	int objectType;
@@ -268,14 +364,16 @@ public:
 	bool debug;
 	const char* lastError;
 
-	int srcLineSections;
-	char** srcLineStart; // array of bitmaps per segment, indicating whether src line start is available for corresponding address
+	// sorted offsets of source line starts per segment
+	std::vector<std::vector<unsigned int>> srcLineStart;
 
 	double Dversion;
 
 	// DWARF
 	int codeSegOff;
 	std::unordered_map<byte*, int> mapOffsetToType;
+	std::vector<std::pair<byte*, int>> sortedOffsetToType; // smaller replacement with spillThreshold
+	std::unordered_map<byte*, int> typeSizes; // byte size per type DIE, see getDWARFTypeSize
 
 	// Default lower bound for the current compilation unit. This depends on
 	// the language of the current unit.
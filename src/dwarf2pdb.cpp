@@ -14,12 +14,17 @@
 #include "PEImage.h"
 #include "symutil.h"
 #include "cvutil.h"
+#include "spill.h"
+#include "cache.h"
+#include "stats.h"
 
 #include "dwarf.h"
 
 #include <algorithm>
 #include <assert.h>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 
@@ -29,7 +34,7 @@ void CV2PDB::checkDWARFTypeAlloc(int size, int add)
 	{
 		//allocDwarfTypes += size + add;
 		allocDwarfTypes += allocDwarfTypes/2 + size + add;
-		dwarfTypes = (BYTE*) realloc(dwarfTypes, allocDwarfTypes);
+		dwarfTypes = (BYTE*) reallocRecords(dwarfTypes, allocDwarfTypes, spillThreshold);
 		if (dwarfTypes == nullptr)
 			__debugbreak();
 	}
@@ -156,6 +161,63 @@ CV_X86_REG dwarf_to_amd64_reg(unsigned dwarf_reg)
 	}
 }
 
+// Call Frame Information entry (CIE or FDE)
+class CFIEntry
+{
+public:
+	enum Type
+	{
+		CIE,
+		FDE,
+		Unsupported // CIE or FDE that cannot be decoded
+	};
+
+	byte* ptr;
+	byte* end;
+	byte type;
+	byte* cie; // pointer to the CIE of an FDE
+
+	// CIE
+	byte version;
+	const char* augmentation;
+	byte address_size;
+	byte segment_size;
+	unsigned long code_alignment_factor;
+	unsigned long data_alignment_factor;
+	unsigned long return_address_register;
+	byte* initial_instructions;
+	unsigned long initial_instructions_length;
+	byte fde_encoding;           // DW_EH_PE_* encoding of FDE addresses
+	bool has_augmentation_data;  // 'z' augmentation: FDEs have augmentation data
+	Location initial_cfa;        // CFA rule after the initial instructions
+
+	// FDE
+	unsigned long segment;
+	unsigned long initial_location;
+	unsigned long address_range;
+	byte* instructions;
+	unsigned long instructions_length;
+
+	void setCIE(const CFIEntry& entry)
+	{
+		version = entry.version;
+		augmentation = entry.augmentation;
+		address_size = entry.address_size;
+		segment_size = entry.segment_size;
+		code_alignment_factor = entry.code_alignment_factor;
+		data_alignment_factor = entry.data_alignment_factor;
+		return_address_register = entry.return_address_register;
+		initial_instructions = entry.initial_instructions;
+		initial_instructions_length = entry.initial_instructions_length;
+		fde_encoding = entry.fde_encoding;
+		has_augmentation_data = entry.has_augmentation_data;
+		initial_cfa = entry.initial_cfa;
+	}
+};
+
+// no entry of CFIIndex
+static const unsigned int kNoCFIEntry = ~0u;
+
 // Index for efficient lookups in Call Frame Information entries
 class CFIIndex
 {
@@ -163,10 +225,21 @@ public:
 	// Build the index, which will be tied to IMG.
 	CFIIndex(const PEImage& img);
 
-	// Look for a FDE whose PC range covers the PCLO/PCHI range and return a
-	// pointer to the FDE in the .debug_frame section. Return NULL if no such
-	// FDE exists.
-	byte *lookup(unsigned int pclo, unsigned pchi) const;
+	// Look for the smallest FDE whose PC range covers the PCLO/PCHI range and
+	// return a pointer to the FDE in the .debug_frame or .eh_frame section.
+	// Return NULL if no such FDE exists.
+	byte *lookup(unsigned int pclo, unsigned int pchi) const;
+
+	// Read the FDE at FDE_PTR (as returned by lookup) into ENTRY. The CIE
+	// fields are taken from the cache, including the CFA rule after the
+	// initial instructions.
+	bool readFDE(byte* fde_ptr, CFIEntry& entry) const;
+
+	// Look up the FDEs for all RANGES, which must be sorted by PCLO, in a
+	// single sweep over the index. FDES receives the result of lookup() for
+	// each range.
+	void lookupSorted(const std::vector<std::pair<unsigned int, unsigned int>>& ranges,
+	                  std::vector<byte*>& fdes) const;
 
 private:
 	struct index_entry
@@ -188,145 +261,290 @@ private:
 
 	};
 
+	// Find the smallest entry covering PCLO/PCHI, starting at the smallest
+	// entry of the segment SEG (the one containing PCLO).
+	byte *findCovering(size_t seg, unsigned int pclo, unsigned int pchi) const;
+	bool covers(unsigned int entry, unsigned int pclo, unsigned int pchi) const
+	{
+		return pclo < index[entry].pchi && pchi <= index[entry].pchi;
+	}
+	// Split the address range of the sorted index into segments
+	void buildSegments();
+
+	// Add all FDEs of the .debug_frame or .eh_frame section
+	void addSection(bool ehframe);
+	// Use the binary search table of .eh_frame_hdr instead of reading all FDEs
+	bool initEHFrameHdr();
+	// initial location and FDE of entry I of the .eh_frame_hdr table
+	unsigned int tableLocation(size_t i) const;
+	byte *tableFDE(size_t i) const;
+	// Check the FDE of the last table entry below NEXT, FDEs in .eh_frame
+	// don't overlap, so no other FDE can cover PCLO.
+	byte *lookupTable(size_t next, unsigned int pclo, unsigned int pchi) const;
+	// Replay the initial instructions of CIE into its initial CFA rule
+	void replayCIE(CFIEntry& cie) const;
+
+	const PEImage& img;
 	std::vector<index_entry> index;
+
+	// decoded CIEs, indexed by their address
+	mutable std::unordered_map<byte*, CFIEntry> cies;
+
+	// binary search table of .eh_frame_hdr sorted by the initial location,
+	// if set, FDEs and CIEs of .eh_frame are only read when looked up
+	byte* hdrTable;
+	size_t hdrCount;
+	unsigned long long hdrVaddr;   // the table is relative to .eh_frame_hdr
+	unsigned long long frameVaddr; // address of .eh_frame
+
+	// The start and end addresses of the FDEs split the address range into
+	// segments. segStart[s] is the start of segment s, segSmallest[s] the
+	// smallest entry covering it (or kNoCFIEntry). parent[i] is the smallest
+	// entry enclosing entry i, so the entries covering an address are found
+	// by following the parents from the smallest one. FDEs nest (usually they
+	// don't overlap at all), entries overlapping partially are only found
+	// if they are on this chain. jump[i] is a skew-binary jump pointer to an
+	// ancestor at depth[], so the walk takes O(log n) steps for deep nesting.
+	std::vector<unsigned int> segStart;
+	std::vector<unsigned int> segSmallest;
+	std::vector<unsigned int> parent;
+	std::vector<unsigned int> jump;
+	std::vector<unsigned int> depth;
 };
 
-// Call Frame Information entry (CIE or FDE)
-class CFIEntry
+// read a pointer value with DW_EH_PE_* encoding ENC, ignoring the application
+static bool readEncodedValue(byte* &p, byte enc, int address_size, unsigned long long& val)
 {
-public:
-	enum Type
+	switch(enc & 0x0f)
 	{
-		CIE,
-		FDE
-	};
-
-	byte* ptr;
-	byte* end;
-	byte type;
-	unsigned long CIE_pointer; //
-
-	// CIE
-	byte version;
-	const char* augmentation;
-	byte address_size;
-	byte segment_size;
-	unsigned long code_alignment_factor;
-	unsigned long data_alignment_factor;
-	unsigned long return_address_register;
-	byte* initial_instructions;
-	unsigned long initial_instructions_length;
-
-	// FDE
-	unsigned long segment;
-	unsigned long initial_location;
-	unsigned long address_range;
-	byte* instructions;
-	unsigned long instructions_length;
-};
+		case DW_EH_PE_absptr:  val = RDsize(p, address_size); break;
+		case DW_EH_PE_uleb128: val = LEB128(p); break;
+		case DW_EH_PE_udata2:  val = RD2(p); break;
+		case DW_EH_PE_udata4:  val = RD4(p); break;
+		case DW_EH_PE_udata8:  val = RD8(p); break;
+		case DW_EH_PE_sleb128: val = (long long) SLEB128(p); break;
+		case DW_EH_PE_sdata2:  val = (long long) (short) RD2(p); break;
+		case DW_EH_PE_sdata4:  val = (long long) (int) RD4(p); break;
+		case DW_EH_PE_sdata8:  val = RD8(p); break;
+		default:
+			return false;
+	}
+	return true;
+}
 
-// Call Frame Information Cursor
+// Call Frame Information Cursor, iterating over the .debug_frame or the .eh_frame section
 class CFICursor
 {
 public:
-	CFICursor(const PEImage& img)
-	: beg((byte*)img.debug_frame)
-	, end((byte*)img.debug_frame + img.debug_frame_length)
+	CFICursor(const PEImage& img, bool ehframe = false)
+	: beg((byte*)(ehframe ? img.eh_frame : img.debug_frame))
+	, end(beg + (ehframe ? img.eh_frame_length : img.debug_frame_length))
 	, ptr(beg)
+	, eh(ehframe)
+	, cieCache(0)
 	{
 		default_address_size = img.isX64() ? 8 : 4;
+		vaddr = 0;
+		if (ehframe && img.ehFrameSegment >= 0)
+			vaddr = img.getImageBase() + img.getSection(img.ehFrameSegment).VirtualAddress;
 	}
 
 	byte* beg;
 	byte* end;
 	byte* ptr;
 	byte default_address_size;
+	bool eh;                 // .eh_frame format
+	unsigned long long vaddr; // virtual address of the section for pc-relative pointers
+
+	// if set, CIEs are only decoded once
+	std::unordered_map<byte*, CFIEntry>* cieCache;
+
+	// read a pointer encoded with ENC at P
+	bool readEncoded(byte* &p, byte enc, unsigned long long& val)
+	{
+		byte* field = p;
+		if (!readEncodedValue(p, enc, default_address_size, val))
+			return false;
+		switch(enc & 0x70)
+		{
+			case DW_EH_PE_absptr:
+				break;
+			case DW_EH_PE_pcrel:
+				val += vaddr + (field - beg);
+				break;
+			default:
+				return false; // text/data relative not used for code addresses
+		}
+		return true;
+	}
 
 	bool readCIE(CFIEntry& entry, byte* &p)
 	{
 		entry.version = *p++;
-		entry.augmentation = (char*) p++;
-		if(entry.augmentation[0])
+		entry.augmentation = (char*) p;
+		p += strlen(entry.augmentation) + 1;
+		entry.fde_encoding = DW_EH_PE_absptr;
+		entry.has_augmentation_data = false;
+		entry.initial_cfa = { Location::RegRel, DW_REG_CFA, 0 };
+
+		const char* aug = entry.augmentation;
+		if (aug[0] == 'e' && aug[1] == 'h')
 		{
-			// not supporting any augmentation
-			entry.address_size = 4;
-			entry.segment_size = 0;
-			entry.code_alignment_factor = 0;
-			entry.data_alignment_factor = 0;
-			entry.return_address_register = 0;
+			p += default_address_size; // GNU eh_data pointer
+			aug += 2;
+		}
+		if (entry.version >= 4)
+		{
+			entry.address_size = *p++;
+			entry.segment_size = *p++;
 		}
 		else
 		{
-			if (entry.version >= 4)
-			{
-				entry.address_size = *p++;
-				entry.segment_size = *p++;
-			}
-			else
+			entry.address_size = default_address_size;
+			entry.segment_size = 0;
+		}
+		entry.code_alignment_factor = LEB128(p);
+		entry.data_alignment_factor = SLEB128(p);
+		entry.return_address_register = entry.version == 1 ? *p++ : LEB128(p);
+
+		if (aug[0] == 'z')
+		{
+			unsigned int len = LEB128(p);
+			if (p > entry.end || len > (unsigned int)(entry.end - p))
+				return false;
+			byte* augend = p + len;
+			entry.has_augmentation_data = true;
+			for (aug++; *aug && p < augend; aug++)
 			{
-				entry.address_size = default_address_size;
-				entry.segment_size = 0;
+				unsigned long long val;
+				switch (*aug)
+				{
+					case 'R': // FDE pointer encoding
+						entry.fde_encoding = *p++;
+						break;
+					case 'P': // personality routine
+					{
+						byte enc = *p++;
+						if (!readEncodedValue(p, enc, default_address_size, val))
+							return false;
+						break;
+					}
+					case 'L': // LSDA pointer encoding, only affects augmentation data of FDEs
+						p++;
+						break;
+					case 'S': // signal frame
+						break;
+					default:
+						p = augend; // unknown, but we know the size
+						break;
+				}
 			}
-			entry.code_alignment_factor = LEB128(p);
-			entry.data_alignment_factor = SLEB128(p);
-			entry.return_address_register = LEB128(p);
+			p = augend;
 		}
+		else if (aug[0])
+			return false; // unknown augmentation, cannot interpret the rest
+
+		if (p > entry.end)
+			return false;
 		entry.initial_instructions = p;
-		entry.initial_instructions_length = 0; // to be calculated outside
+		entry.initial_instructions_length = entry.end - p;
 		return true;
 	}
 
-	bool readHeader(byte* &p, byte* &pend, unsigned long& CIE_pointer)
+	// Read the entry length and the CIE pointer. CIE is set to NULL for a CIE,
+	// otherwise it points to the CIE of the FDE.
+	bool readHeader(byte* &p, byte* &pend, byte* &cie)
 	{
-		if (p >= end)
+		if (p + 4 > end)
 			return false;
 		long long len = RDsize(p, 4);
 		bool dwarf64 = (len == 0xffffffff);
 		int ptrsize = dwarf64 ? 8 : 4;
 		if(dwarf64)
 			len = RDsize(p, 8);
-		if(p + len > end)
+		if (len == 0 && eh)
+			return false; // terminator
+		if(len < ptrsize || len > end - p)
 			return false;
 
 		pend = p + (unsigned long) len;
-		CIE_pointer = (unsigned long) RDsize(p, ptrsize);
+		byte* idptr = p;
+		unsigned long long id = RDsize(p, ptrsize);
+		if (eh) // CIE pointer relative to the field, 0 for CIE
+			cie = id == 0 ? 0 : idptr - id;
+		else // CIE pointer relative to the section start, -1 for CIE
+			cie = id == (dwarf64 ? ~0ull : 0xffffffffull) ? 0 : beg + id;
+		if (cie && (cie < beg || cie >= end))
+			return false;
 		return true;
 	}
 
+	// Read the CIE at CIEPTR into the CIE fields of ENTRY
+	bool readCIEAt(byte* cieptr, CFIEntry& entry)
+	{
+		if (cieCache)
+		{
+			std::unordered_map<byte*, CFIEntry>::iterator it = cieCache->find(cieptr);
+			if (it != cieCache->end())
+			{
+				entry.setCIE(it->second);
+				return it->second.type == CFIEntry::CIE;
+			}
+		}
+
+		CFIEntry cieEntry;
+		byte* q = cieptr, *qcie;
+		if (!readHeader(q, cieEntry.end, qcie) || qcie)
+			return false;
+		cieEntry.ptr = cieptr;
+		cieEntry.cie = 0;
+		cieEntry.type = readCIE(cieEntry, q) ? CFIEntry::CIE : CFIEntry::Unsupported;
+		if (cieCache)
+			cieCache->insert(std::make_pair(cieptr, cieEntry));
+		entry.setCIE(cieEntry);
+		return cieEntry.type == CFIEntry::CIE;
+	}
+
 	bool readNext(CFIEntry& entry)
 	{
 		byte* p = ptr;
-		if(!readHeader(p, entry.end, entry.CIE_pointer))
+		if(!readHeader(p, entry.end, entry.cie))
 			return false;
 
 		entry.ptr = ptr;
+		ptr = entry.end;
 
-		if (entry.CIE_pointer == 0xffffffff)
+		if (!entry.cie)
 		{
-			entry.type = CFIEntry::CIE;
-			readCIE(entry, p);
-			entry.initial_instructions_length = entry.end - p;
+			entry.type = readCIEAt(entry.ptr, entry) ? CFIEntry::CIE : CFIEntry::Unsupported;
 		}
 		else
 		{
-			entry.type = CFIEntry::FDE;
-
-			byte* q = beg + entry.CIE_pointer, *qend;
-			unsigned long cie_off;
-			if (!readHeader(q, qend, cie_off))
-				return false;
-			if (cie_off != 0xffffffff)
-				return false;
-			readCIE(entry, q);
-			entry.initial_instructions_length = qend - entry.initial_instructions;
+			entry.type = CFIEntry::Unsupported;
+			if (!readCIEAt(entry.cie, entry))
+				return true;
 
+			unsigned long long loc, range;
 			entry.segment = (unsigned long)(entry.segment_size > 0 ? RDsize(p, entry.segment_size) : 0);
-			entry.initial_location = (unsigned long)RDsize(p, entry.address_size);
-			entry.address_range = (unsigned long)RDsize(p, entry.address_size);
+			if (!readEncoded(p, entry.fde_encoding, loc))
+				return true;
+			if (!readEncodedValue(p, entry.fde_encoding, default_address_size, range))
+				return true;
+			if (entry.has_augmentation_data)
+			{
+				unsigned int len = LEB128(p);
+				if (p > entry.end || len > (unsigned int)(entry.end - p))
+					return true;
+				p += len;
+			}
+			if (p > entry.end)
+				return true;
+			entry.type = CFIEntry::FDE;
+			entry.initial_location = (unsigned long)loc;
+			entry.address_range = (unsigned long)range;
 			entry.instructions = p;
 			entry.instructions_length = entry.end - p;
 		}
-		ptr = entry.end;
 		return true;
 	}
 };
@@ -419,6 +637,8 @@ public:
 				attr.type = ExprLoc;
 				attr.expr.len = LEB128(ptr);
 				attr.expr.ptr = ptr;
+				if (ptr > end || attr.expr.len > (unsigned)(end - ptr))
+					return false;
 				cfa = decodeLocation(img, attr);
 				ptr += attr.expr.len;
 				break;
@@ -458,8 +678,10 @@ public:
 				attr.type = Block;
 				attr.block.len = LEB128(ptr);
 				attr.block.ptr = ptr;
+				if (ptr > end || attr.block.len > (unsigned)(end - ptr))
+					return false;
 				cfa = decodeLocation(img, attr); // TODO: push cfa on stack
-				ptr += attr.expr.len;
+				ptr += attr.block.len;
 				break;
 			}
 			case DW_CFA_restore_extended:
@@ -472,7 +694,7 @@ public:
 				break;
 			}
 		}
-		return true;
+		return ptr <= end;
 	}
 
 	const PEImage& img;
@@ -485,30 +707,39 @@ public:
 	Location cfa;
 };
 
-Location findBestCFA(const PEImage& img, const CFIIndex* index, unsigned int pclo, unsigned int pchi)
+// Compute the CFA rule of the procedure at PCLO described by the FDE at FDE_PTR
+static bool computeFDECFA(const PEImage& img, const CFIIndex* index, byte* fde_ptr, unsigned int pclo, Location& loc)
+{
+	CFIEntry entry;
+	if (!index->readFDE(fde_ptr, entry))
+		return false;
+
+	// the CIE initial instructions have already been replayed by the index
+	CFACursor cfa(img, entry, pclo);
+	cfa.cfa = entry.initial_cfa;
+	cfa.setInstructions(entry.instructions, entry.instructions_length);
+	while (!cfa.beforeRestore() && cfa.processNext()) {}
+	loc = cfa.cfa;
+	return true;
+}
+
+static Location defaultCFA(const PEImage& img)
 {
 	bool x64 = img.isX64();
 	Location ebp = { Location::RegRel, x64 ? 6 : 5, x64 ? 16 : 8 };
-	if (!img.debug_frame)
-		return ebp;
-
-	byte *fde_ptr = index->lookup(pclo, pchi);
-	if (fde_ptr == NULL)
-		return ebp;
+	return ebp;
+}
 
-	CFIEntry entry;
-	CFICursor cursor(img);
-	cursor.ptr = fde_ptr;
+Location findBestCFA(const PEImage& img, const CFIIndex* index, unsigned int pclo, unsigned int pchi)
+{
+	Location cfa = defaultCFA(img);
+	if (!index)
+		return cfa;
 
-	if (cursor.readNext(entry))
-	{
-		CFACursor cfa(img, entry, pclo);
-		while (cfa.processNext()) {}
-		cfa.setInstructions(entry.instructions, entry.instructions_length);
-		while (!cfa.beforeRestore() && cfa.processNext()) {}
-		return cfa.cfa;
-	}
-	return ebp;
+	byte *fde_ptr = index->lookup(pclo, pchi);
+	if (fde_ptr)
+		computeFDECFA(img, index, fde_ptr, pclo, cfa);
+	return cfa;
 }
 
 // Location list entry
@@ -518,66 +749,451 @@ public:
 	byte* ptr;
 	unsigned long beg_offset;
 	unsigned long end_offset;
+	bool end_of_list;
 	Location loc;
 
-	bool eol() const { return beg_offset == 0 && end_offset == 0; }
+	bool eol() const { return end_of_list; }
 };
 
-// Location list cursor
+// Location list cursor, for lists in .debug_loc (DWARF2-4) or .debug_loclists (DWARF5)
 class LOCCursor
 {
 public:
-	LOCCursor(const PEImage& image, unsigned long off)
+	LOCCursor(const PEImage& image, unsigned long off, bool loclists = false)
 	: img (image)
-	, end((byte*)img.debug_loc + img.debug_loc_length)
-	, ptr((byte*)img.debug_loc + off)
+	, lle (loclists)
 	{
+		byte* sec = (byte*)(lle ? img.debug_loclists : img.debug_loc);
+		unsigned long length = lle ? img.debug_loclists_length : img.debug_loc_length;
+		end = sec + length;
+		ptr = off < length ? sec + off : end;
 		default_address_size = img.isX64() ? 8 : 4;
+		base = 0;
 	}
 
 	const PEImage& img;
+	bool lle;
 	byte* end;
 	byte* ptr;
 	byte default_address_size;
+	unsigned long base;
 
-	bool readNext(LOCEntry& entry)
+	bool readExpression(LOCEntry& entry, unsigned int len)
 	{
-		if(ptr >= end)
+		if (ptr + len > end)
 			return false;
-		entry.beg_offset = (unsigned long) RDsize(ptr, default_address_size);
-		entry.end_offset = (unsigned long) RDsize(ptr, default_address_size);
-		if (entry.eol())
-			return true;
-
 		DWARF_Attribute attr;
 		attr.type = Block;
-		attr.block.len = RD2(ptr);
+		attr.block.len = len;
 		attr.block.ptr = ptr;
 		entry.loc = decodeLocation(img, attr);
-		ptr += attr.expr.len;
+		ptr += len;
 		return true;
 	}
+
+	bool readNext(LOCEntry& entry)
+	{
+		entry.ptr = ptr;
+		entry.end_of_list = false;
+		return lle ? readNextLLE(entry) : readNextLoc(entry);
+	}
+
+	bool readNextLoc(LOCEntry& entry)
+	{
+		unsigned long maxaddr = default_address_size == 8 ? ~0ul : 0xfffffffful;
+		for (;;)
+		{
+			if (ptr + 2 * default_address_size > end)
+				return false;
+			entry.beg_offset = (unsigned long) RDsize(ptr, default_address_size);
+			entry.end_offset = (unsigned long) RDsize(ptr, default_address_size);
+			if (entry.beg_offset == 0 && entry.end_offset == 0)
+			{
+				entry.end_of_list = true;
+				return true;
+			}
+			if (entry.beg_offset != maxaddr)
+				break;
+			base = entry.end_offset; // base address selection entry
+		}
+		if (ptr + 2 > end)
+			return false;
+		return readExpression(entry, RD2(ptr));
+	}
+
+	bool readNextLLE(LOCEntry& entry)
+	{
+		for (;;)
+		{
+			if (ptr >= end)
+				return false;
+			entry.beg_offset = entry.end_offset = 0;
+			switch (*ptr++)
+			{
+				case DW_LLE_end_of_list:
+					entry.end_of_list = true;
+					return true;
+				case DW_LLE_base_addressx:
+					LEB128(ptr); // index into .debug_addr, only needed for absolute addresses
+					continue;
+				case DW_LLE_base_address:
+					base = (unsigned long) RDsize(ptr, default_address_size);
+					continue;
+				case DW_LLE_GNU_view_pair:
+					LEB128(ptr);
+					LEB128(ptr);
+					continue;
+				case DW_LLE_startx_endx:
+					LEB128(ptr); // range unknown without .debug_addr
+					LEB128(ptr);
+					break;
+				case DW_LLE_startx_length:
+					LEB128(ptr);
+					entry.end_offset = LEB128(ptr);
+					break;
+				case DW_LLE_offset_pair:
+					entry.beg_offset = LEB128(ptr);
+					entry.end_offset = LEB128(ptr);
+					break;
+				case DW_LLE_default_location:
+					break;
+				case DW_LLE_start_end:
+					entry.beg_offset = (unsigned long) RDsize(ptr, default_address_size);
+					entry.end_offset = (unsigned long) RDsize(ptr, default_address_size);
+					break;
+				case DW_LLE_start_length:
+					entry.beg_offset = (unsigned long) RDsize(ptr, default_address_size);
+					entry.end_offset = entry.beg_offset + LEB128(ptr);
+					break;
+				default:
+					return false;
+			}
+			return readExpression(entry, LEB128(ptr));
+		}
+	}
 };
 
-Location findBestFBLoc(const PEImage& img, unsigned long fblocoff)
+// Summarize the location list at offset OFF of .debug_loc or .debug_loclists
+static LOCSummary summarizeLocList(const PEImage& img, unsigned long off, bool loclists)
 {
 	int regebp = img.isX64() ? 6 : 5;
-	LOCCursor cursor(img, fblocoff);
+	LOCCursor cursor(img, off, loclists);
 	LOCEntry entry;
-	Location longest = { Location::RegRel, DW_REG_CFA, 0 };
+	LOCSummary summary;
+	summary.ebp.type = Location::Invalid;
+	summary.longest = { Location::RegRel, DW_REG_CFA, 0 };
 	unsigned long longest_range = 0;
 	while(cursor.readNext(entry) && !entry.eol())
 	{
-		if(entry.loc.is_regrel() && entry.loc.reg == regebp)
-			return entry.loc;
+		if(entry.loc.is_regrel() && entry.loc.reg == regebp && summary.ebp.is_invalid())
+			summary.ebp = entry.loc;
 		unsigned long range = entry.end_offset - entry.beg_offset;
 		if(range > longest_range)
 		{
 			longest_range = range;
-			longest = entry.loc;
+			summary.longest = entry.loc;
+		}
+	}
+	return summary;
+}
+
+const LOCSummary& CV2PDB::getLocListSummary(unsigned long off, bool loclists)
+{
+	// both sections are cached in the same table, the top bit selects .debug_loclists
+	unsigned long long key = off | (loclists ? 1ull << 63 : 0);
+	std::unordered_map<unsigned long long, LOCSummary>::iterator it = locListSummaries.find(key);
+	if (it == locListSummaries.end())
+		it = locListSummaries.insert(std::make_pair(key, summarizeLocList(img, off, loclists))).first;
+	return it->second;
+}
+
+// Read the range list at R into RANGES, BASE is the base address of the unit
+static void readRangeList(const PEImage& img, DWARF_CompilationUnit* cu, byte* r, byte* rend, uint64_t base,
+                          std::vector<CV2PDB::DWARFRange>& ranges)
+{
+	int address_size = cu ? cu->getAddressSize() : img.isX64() ? 8 : 4;
+	uint64_t maxaddr = address_size == 8 ? ~0ull : 0xffffffffull;
+	CV2PDB::DWARFRange rng;
+
+	if (!cu || cu->version < 5)
+	{
+		// .debug_ranges: pairs of addresses relative to the base address
+		while (r + 2 * address_size <= rend)
+		{
+			uint64_t pclo = RDsize(r, address_size);
+			uint64_t pchi = RDsize(r, address_size);
+			if (pclo == 0 && pchi == 0)
+				break;
+			if (pclo == maxaddr)
+			{
+				base = pchi; // base address selection entry
+				continue;
+			}
+			if (pclo >= pchi)
+				continue;
+			rng.pclo = pclo + base;
+			rng.pchi = pchi + base;
+			ranges.push_back(rng);
+		}
+		return;
+	}
+
+	// .debug_rnglists
+	const DWARF_UnitBases* bases = DIECursor::getUnitBases(cu);
+	while (r < rend)
+	{
+		switch (*r++)
+		{
+			case DW_RLE_end_of_list:
+				return;
+			case DW_RLE_base_addressx:
+				if (!readTableEntry(img.debug_addr, bases->addr_base, bases->addr_count, LEB128(r), address_size, base))
+					return;
+				continue;
+			case DW_RLE_base_address:
+				base = RDsize(r, address_size);
+				continue;
+			case DW_RLE_startx_endx:
+				if (!readTableEntry(img.debug_addr, bases->addr_base, bases->addr_count, LEB128(r), address_size, rng.pclo) ||
+				    !readTableEntry(img.debug_addr, bases->addr_base, bases->addr_count, LEB128(r), address_size, rng.pchi))
+					return;
+				break;
+			case DW_RLE_startx_length:
+				if (!readTableEntry(img.debug_addr, bases->addr_base, bases->addr_count, LEB128(r), address_size, rng.pclo))
+					return;
+				rng.pchi = rng.pclo + LEB128(r);
+				break;
+			case DW_RLE_offset_pair:
+				rng.pclo = base + LEB128(r);
+				rng.pchi = base + LEB128(r);
+				break;
+			case DW_RLE_start_end:
+				rng.pclo = RDsize(r, address_size);
+				rng.pchi = RDsize(r, address_size);
+				break;
+			case DW_RLE_start_length:
+				rng.pclo = RDsize(r, address_size);
+				rng.pchi = rng.pclo + LEB128(r);
+				break;
+			default:
+				return; // unknown entry, cannot continue
+		}
+		if (rng.pclo < rng.pchi)
+			ranges.push_back(rng);
+	}
+}
+
+const std::vector<CV2PDB::DWARFRange>& CV2PDB::getDWARFRanges(DWARF_CompilationUnit* cu, unsigned long off, uint64_t base)
+{
+	bool rnglists = cu && cu->version >= 5;
+	// both sections are cached in the same table, the top bit selects .debug_rnglists.
+	// Lists shared by units are rebased to each unit's addresses.
+	RangeListKey key = { off | (rnglists ? 1ull << 63 : 0), base, rnglists ? DIECursor::getUnitBases(cu)->addr_base : 0 };
+	std::unordered_map<RangeListKey, std::vector<DWARFRange>, RangeListKey::Hasher>::iterator it = rangeLists.find(key);
+	if (it != rangeLists.end())
+		return it->second;
+
+	std::vector<DWARFRange> ranges;
+	byte* sec = (byte*)(rnglists ? img.debug_rnglists : img.debug_ranges);
+	unsigned long length = rnglists ? img.debug_rnglists_length : img.debug_ranges_length;
+	if (sec && off < length)
+		readRangeList(img, cu, sec + off, sec + length, base, ranges);
+
+	// merge overlapping and adjacent ranges
+	std::sort(ranges.begin(), ranges.end());
+	size_t n = 0;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		if (n > 0 && ranges[i].pclo <= ranges[n - 1].pchi)
+			ranges[n - 1].pchi = max(ranges[n - 1].pchi, ranges[i].pchi);
+		else
+			ranges[n++] = ranges[i];
+	}
+	ranges.resize(n);
+
+	return rangeLists.insert(std::make_pair(key, ranges)).first->second;
+}
+
+void CV2PDB::buildDWARFAddressIndex()
+{
+	dwarfUnitRanges.clear();
+	dwarfUnitRangeEnds.clear();
+	std::vector<DWARF_CompilationUnit*> covered;
+
+	byte* p = (byte*)img.debug_aranges;
+	byte* end = p + img.debug_aranges_length;
+	while (p && p + 4 <= end)
+	{
+		byte* set = p;
+		unsigned long long length = RD4(p);
+		int offsize = 4;
+		if (length == 0xffffffff)
+		{
+			length = RD8(p);
+			offsize = 8;
+		}
+		if (length > (unsigned long long)(end - p) || length < 4 + offsize)
+			break;
+		byte* next = p + length;
+		p += 2; // version
+		unsigned long long info_off = RDsize(p, offsize);
+		int address_size = *p++;
+		int segment_size = *p++;
+		int tuple_size = 2 * address_size + segment_size;
+		if (address_size == 0 || address_size > 8 || info_off >= img.debug_info_length)
+		{
+			p = next;
+			continue;
+		}
+		// tuples are aligned to the tuple size relative to the start of the set
+		p = set + ((p - set + tuple_size - 1) / tuple_size) * tuple_size;
+
+		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + info_off);
+		covered.push_back(cu);
+		while (p + tuple_size <= next)
+		{
+			p += segment_size;
+			uint64_t start = RDsize(p, address_size);
+			uint64_t len = RDsize(p, address_size);
+			if (start == 0 && len == 0)
+				break;
+			if (len > 0)
+			{
+				DWARFUnitRange range = { start, start + len, cu };
+				dwarfUnitRanges.push_back(range);
+			}
+		}
+		p = next;
+	}
+	std::sort(covered.begin(), covered.end());
+
+	// units not listed in .debug_aranges: use the address ranges of the unit DIE
+	const std::vector<DWARF_CompilationUnit*>& units = DIECursor::getUnits();
+	for (size_t u = 0; u < units.size(); u++)
+	{
+		DWARF_CompilationUnit* cu = units[u];
+		byte ut = cu->getUnitType();
+		if (ut == DW_UT_type || ut == DW_UT_split_type)
+			continue;
+		if (std::binary_search(covered.begin(), covered.end(), cu))
+			continue;
+
+		DIECursor cursor(cu, cu->getFirstDIE());
+		DWARF_InfoData id;
+		if (!cursor.readNext(id))
+			continue;
+		if (id.ranges != ~0)
+		{
+			const std::vector<DWARFRange>& ranges = getDWARFRanges(cu, id.ranges, id.pclo);
+			for (size_t r = 0; r < ranges.size(); r++)
+			{
+				DWARFUnitRange range = { ranges[r].pclo, ranges[r].pchi, cu };
+				dwarfUnitRanges.push_back(range);
+			}
+		}
+		else if (id.pclo < id.pchi)
+		{
+			DWARFUnitRange range = { id.pclo, id.pchi, cu };
+			dwarfUnitRanges.push_back(range);
 		}
 	}
-	return longest;
+	std::sort(dwarfUnitRanges.begin(), dwarfUnitRanges.end());
+
+	uint64_t pchi = 0;
+	for (size_t r = 0; r < dwarfUnitRanges.size(); r++)
+	{
+		pchi = std::max(pchi, dwarfUnitRanges[r].pchi);
+		dwarfUnitRangeEnds.push_back(pchi);
+	}
+}
+
+// compare the file name of a unit with a file name given on the command line,
+// case insensitive and ignoring leading directories not given
+static bool matchSourceFile(const char* name, const char* dir, const std::string& file)
+{
+	std::string path = name;
+	bool absolute = name[0] == '/' || name[0] == '\\' || (name[0] && name[1] == ':');
+	if (!absolute && dir)
+		path = std::string(dir) + "/" + path;
+
+	std::string pattern = file;
+	for (size_t i = 0; i < path.size(); i++)
+		path[i] = path[i] == '\\' ? '/' : (char)tolower((unsigned char)path[i]);
+	for (size_t i = 0; i < pattern.size(); i++)
+		pattern[i] = pattern[i] == '\\' ? '/' : (char)tolower((unsigned char)pattern[i]);
+
+	if (pattern.empty() || pattern.size() > path.size())
+		return false;
+	size_t pos = path.size() - pattern.size();
+	if (path.compare(pos, pattern.size(), pattern) != 0)
+		return false;
+	return pos == 0 || path[pos - 1] == '/' || pattern[0] == '/';
+}
+
+bool CV2PDB::selectDWARFUnits()
+{
+	const std::vector<DWARF_CompilationUnit*>& units = DIECursor::getUnits();
+	dwarfLineOffsets.clear();
+	dwarfUnitsSelected = !selectAddresses.empty() || !selectSourceFiles.empty();
+	if (!dwarfUnitsSelected)
+	{
+		dwarfUnits = units;
+		return true;
+	}
+
+	std::vector<DWARF_CompilationUnit*> selected;
+	if (!selectAddresses.empty())
+	{
+		buildDWARFAddressIndex();
+		for (size_t a = 0; a < selectAddresses.size(); a++)
+		{
+			// start at the first range that can reach the selection, no earlier range ends after it
+			const DWARFRange& sel = selectAddresses[a];
+			size_t r = std::upper_bound(dwarfUnitRangeEnds.begin(), dwarfUnitRangeEnds.end(), sel.pclo) - dwarfUnitRangeEnds.begin();
+			for (; r < dwarfUnitRanges.size() && dwarfUnitRanges[r].pclo < sel.pchi; r++)
+				if (dwarfUnitRanges[r].pchi > sel.pclo)
+					selected.push_back(dwarfUnitRanges[r].cu);
+		}
+		std::sort(selected.begin(), selected.end());
+		selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+	}
+
+	dwarfUnits.clear();
+	for (size_t u = 0; u < units.size(); u++)
+	{
+		DWARF_CompilationUnit* cu = units[u];
+		byte ut = cu->getUnitType();
+		if (ut == DW_UT_type || ut == DW_UT_split_type)
+		{
+			dwarfUnits.push_back(cu); // types can be referenced from any unit
+			continue;
+		}
+
+		DIECursor cursor(cu, cu->getFirstDIE());
+		DWARF_InfoData id;
+		if (!cursor.readNext(id))
+			continue;
+		bool sel = std::binary_search(selected.begin(), selected.end(), cu);
+		for (size_t f = 0; !sel && f < selectSourceFiles.size(); f++)
+			sel = id.name && matchSourceFile(id.name, id.dir, selectSourceFiles[f]);
+		if (!sel)
+			continue;
+
+		dwarfUnits.push_back(cu);
+		if (id.stmt_list != ~0)
+			dwarfLineOffsets.push_back(id.stmt_list);
+	}
+	std::sort(dwarfLineOffsets.begin(), dwarfLineOffsets.end());
+
+	if (dwarfUnits.empty() || std::find_if(dwarfUnits.begin(), dwarfUnits.end(), [](DWARF_CompilationUnit* cu) {
+		    byte ut = cu->getUnitType(); return ut != DW_UT_type && ut != DW_UT_split_type; }) == dwarfUnits.end())
+		return setError("no compilation unit found for the selected addresses or source files");
+	return true;
+}
+
+bool CV2PDB::isDWARFUnitSelected(DWARF_CompilationUnit* cu) const
+{
+	return !dwarfUnitsSelected || std::binary_search(dwarfUnits.begin(), dwarfUnits.end(), cu);
 }
 
 void CV2PDB::appendStackVar(const char* name, int type, Location& loc, Location& cfa)
@@ -743,11 +1359,19 @@ bool CV2PDB::addDWARFProc(DWARF_InfoData& procid, DWARF_CompilationUnit* cu, DIE
 	addStackVar("local_var", 0x1001, 8);
 #endif
 
-	Location frameBase = decodeLocation(img, procid.frame_base, 0, DW_AT_frame_base);
-	if (frameBase.is_abs()) // pointer into location list in .debug_loc? assume CFA
-		frameBase = findBestFBLoc(img, frameBase.off);
+	// location lists are in .debug_loclists since DWARF5
+	bool loclists = cu && cu->version >= 5;
+	Location frameBase;
+	if (procid.frame_base.type == SecOffset)
+		frameBase = getLocListSummary(procid.frame_base.sec_offset, loclists).best();
+	else
+	{
+		frameBase = decodeLocation(img, procid.frame_base, 0, DW_AT_frame_base);
+		if (frameBase.is_abs()) // pointer into location list in .debug_loc? assume CFA
+			frameBase = getLocListSummary(frameBase.off, loclists).best();
+	}
 
-    Location cfa = findBestCFA(img, cfi_index, procid.pclo, procid.pchi);
+	Location cfa = getProcCFA(procid.pclo, procid.pchi);
 
 	if (cu)
 	{
@@ -762,7 +1386,7 @@ bool CV2PDB::addDWARFProc(DWARF_InfoData& procid, DWARF_CompilationUnit* cu, DIE
 			{
 				if (id.location.type == ExprLoc || id.location.type == Block || id.location.type == SecOffset)
 				{
-					Location loc = id.location.type == SecOffset ? findBestFBLoc(img, id.location.sec_offset)
+					Location loc = id.location.type == SecOffset ? getLocListSummary(id.location.sec_offset, loclists).best()
 					                                             : decodeLocation(img, id.location, &frameBase);
 					if (loc.is_regrel())
 						appendStackVar(id.name, getTypeByDWARFPtr(cu, id.type), loc, cfa);
@@ -792,29 +1416,11 @@ bool CV2PDB::addDWARFProc(DWARF_InfoData& procid, DWARF_CompilationUnit* cu, DIE
 						id.pclo = ~0;
 						id.pchi = 0;
 
-						// TODO: handle base address selection
-						byte *r = (byte *)img.debug_ranges + id.ranges;
-						byte *rend = (byte *)img.debug_ranges + img.debug_ranges_length;
-						while (r < rend)
+						const std::vector<DWARFRange>& ranges = getDWARFRanges(cu, id.ranges, currentBaseAddress);
+						if (!ranges.empty())
 						{
-							uint64_t pclo, pchi;
-
-							if (img.isX64())
-							{
-								pclo = RD8(r);
-								pchi = RD8(r);
-							}
-							else
-							{
-								pclo = RD4(r);
-								pchi = RD4(r);
-							}
-							if (pclo == 0 && pchi == 0)
-								break;
-							if (pclo >= pchi)
-								continue;
-							id.pclo = min(id.pclo, pclo + currentBaseAddress);
-							id.pchi = max(id.pchi, pchi + currentBaseAddress);
+							id.pclo = (unsigned long)ranges.front().pclo;
+							id.pchi = (unsigned long)ranges.back().pchi;
 						}
 					}
 
@@ -833,7 +1439,7 @@ bool CV2PDB::addDWARFProc(DWARF_InfoData& procid, DWARF_CompilationUnit* cu, DIE
 				{
 					if (id.name && (id.location.type == ExprLoc || id.location.type == Block))
 					{
-						Location loc = id.location.type == SecOffset ? findBestFBLoc(img, id.location.sec_offset)
+						Location loc = id.location.type == SecOffset ? getLocListSummary(id.location.sec_offset, loclists).best()
 						                                             : decodeLocation(img, id.location, &frameBase);
 						if (loc.is_regrel())
 							appendStackVar(id.name, getTypeByDWARFPtr(cu, id.type), loc, cfa);
@@ -1122,7 +1728,7 @@ bool CV2PDB::addDWARFTypes()
 	checkUdtSymbolAlloc(100);
 
 	int prefix = 4;
-	DWORD* ddata = new DWORD [img.debug_info_length/4]; // large enough
+	DWORD ddata[64]; // SSEARCH and COMPILAND
 	unsigned char *data = (unsigned char*) (ddata + prefix);
 	unsigned int off = 0;
 	unsigned int len;
@@ -1163,7 +1769,17 @@ bool CV2PDB::addDWARFTypes()
 	//////////////////////////
 	mspdb::Mod* mod = globalMod();
 	//return writeSymbols (mod, ddata, off, prefix, true);
-	return addSymbols (mod, data, off, true);
+	if (!addSymbols (mod, data, off, true))
+		return false;
+
+	if (spillThreshold)
+	{
+		// copied to the PDB
+		freeRecords(udtSymbols);
+		udtSymbols = 0;
+		cbUdtSymbols = allocUdtSymbols = 0;
+	}
+	return true;
 }
 
 bool CV2PDB::addDWARFSectionContrib(mspdb::Mod* mod, unsigned long pclo, unsigned long pchi)
@@ -1309,14 +1925,60 @@ int CV2PDB::addDWARFEnum(DWARF_InfoData& enumid, DWARF_CompilationUnit* cu, DIEC
 
 int CV2PDB::getTypeByDWARFPtr(DWARF_CompilationUnit* cu, byte* ptr)
 {
-	std::unordered_map<byte*, int>::iterator it = mapOffsetToType.find(ptr);
-	if(it == mapOffsetToType.end())
+	int type = findDWARFType(ptr);
+	if (type < 0)
 		return 0x03; // void
+	return type;
+}
+
+static bool lessOffset(const std::pair<byte*, int>& a, const std::pair<byte*, int>& b)
+{
+	return a.first < b.first;
+}
+
+int CV2PDB::findDWARFType(byte* ptr)
+{
+	if (spillThreshold)
+	{
+		std::vector<std::pair<byte*, int>>::iterator it = std::lower_bound(sortedOffsetToType.begin(),
+			sortedOffsetToType.end(), std::make_pair(ptr, 0), lessOffset);
+		if (it == sortedOffsetToType.end() || it->first != ptr)
+			return -1;
+		return it->second;
+	}
+	std::unordered_map<byte*, int>::iterator it = mapOffsetToType.find(ptr);
+	if (it == mapOffsetToType.end())
+		return -1;
 	return it->second;
 }
 
+void CV2PDB::mapDWARFType(byte* ptr, int type)
+{
+	if (spillThreshold)
+		sortedOffsetToType.push_back(std::make_pair(ptr, type)); // sorted by sortDWARFTypeMap
+	else
+		mapOffsetToType.insert(std::make_pair(ptr, type));
+}
+
+void CV2PDB::sortDWARFTypeMap()
+{
+	// about a quarter of the memory of the hash map, at the cost of a binary search per lookup.
+	// The first type of a DIE is kept, like the hash map does.
+	std::stable_sort(sortedOffsetToType.begin(), sortedOffsetToType.end(), lessOffset);
+	std::vector<std::pair<byte*, int>>::iterator it = std::unique(sortedOffsetToType.begin(), sortedOffsetToType.end(),
+		[](const std::pair<byte*, int>& a, const std::pair<byte*, int>& b) { return a.first == b.first; });
+	sortedOffsetToType.erase(it, sortedOffsetToType.end());
+	sortedOffsetToType.shrink_to_fit();
+}
+
 int CV2PDB::getDWARFTypeSize(DWARF_CompilationUnit* cu, byte* typePtr)
 {
+	// sizes are memoized, so typedef/const/volatile chains are followed only once
+	std::pair<std::unordered_map<byte*, int>::iterator, bool> ins = typeSizes.insert(std::make_pair(typePtr, 0));
+	if (!ins.second)
+		return ins.first->second; // also ends cyclic type references with size 0
+
+	int size = 0;
 	DWARF_InfoData id;
 	DIECursor cursor(cu, typePtr);
 
@@ -1324,37 +1986,50 @@ int CV2PDB::getDWARFTypeSize(DWARF_CompilationUnit* cu, byte* typePtr)
 		return 0;
 
 	if(id.byte_size > 0)
-		return id.byte_size;
-
-	switch(id.tag)
+		size = id.byte_size;
+	else switch(id.tag)
 	{
 		case DW_TAG_ptr_to_member_type:
 		case DW_TAG_reference_type:
 		case DW_TAG_pointer_type:
-			return cu->address_size;
+			size = cu->getAddressSize();
+			break;
 		case DW_TAG_array_type:
 		{
 			int basetype, upperBound, lowerBound;
 			getDWARFArrayBounds(id, cu, cursor, basetype, lowerBound, upperBound);
-			return (upperBound - lowerBound + 1) * getDWARFTypeSize(cu, id.type);
+			size = (upperBound - lowerBound + 1) * getDWARFTypeSize(cu, id.type);
+			break;
 		}
 		default:
 			if(id.type)
-				return getDWARFTypeSize(cu, id.type);
+				size = getDWARFTypeSize(cu, id.type);
 			break;
 	}
-	return 0;
+	typeSizes[typePtr] = size; // the iterator may be invalidated by the recursion
+	return size;
+}
+
+// section offset of CU for trace events
+static unsigned long getUnitOffset(const PEImage& img, DWARF_CompilationUnit* cu)
+{
+	char* p = (char*)cu;
+	if (img.debug_types && p >= img.debug_types && p < img.debug_types + img.debug_types_length)
+		return p - img.debug_types;
+	return p - img.debug_info;
 }
 
 bool CV2PDB::mapTypes()
 {
 	int typeID = nextUserType;
-	unsigned long off = 0;
-	while (off < img.debug_info_length)
+	std::vector<std::pair<byte*, byte*>> signatureDecls;
+	const std::vector<DWARF_CompilationUnit*>& units = dwarfUnits;
+	for (size_t u = 0; u < units.size(); u++)
 	{
-		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + off);
+		DWARF_CompilationUnit* cu = units[u];
+		TraceSpan span("unit", "mapTypes");
 
-		DIECursor cursor(cu, (byte*)cu + sizeof(DWARF_CompilationUnit));
+		DIECursor cursor(cu, cu->getFirstDIE());
 		DWARF_InfoData id;
 		while (cursor.readNext(id))
 		{
@@ -1362,6 +2037,11 @@ bool CV2PDB::mapTypes()
 			//    (unsigned char*)cu + id.entryOff - (unsigned char*)img.debug_info, cursor.level, id.code, id.tag);
 			switch (id.tag)
 			{
+				case DW_TAG_type_unit:
+				case DW_TAG_compile_unit:
+					span.setUnit(id.name, getUnitOffset(img, cu));
+					break;
+
 				case DW_TAG_base_type:
 				case DW_TAG_typedef:
 				case DW_TAG_pointer_type:
@@ -1388,18 +2068,100 @@ bool CV2PDB::mapTypes()
 				case DW_TAG_mutable_type: // withdrawn
 				case DW_TAG_shared_type:
 				case DW_TAG_rvalue_reference_type:
-					mapOffsetToType.insert(std::make_pair(id.entryPtr, typeID));
+					if (id.signature)
+					{
+						// declaration of a type defined in a type unit, use the same type
+						signatureDecls.push_back(std::make_pair(id.entryPtr, id.signature));
+						break;
+					}
+					mapDWARFType(id.entryPtr, typeID);
 					typeID++;
+					break;
+
+				case DW_TAG_subprogram:
+					if (id.pclo && id.pchi)
+					{
+						ProcCFA proc = { (unsigned int)id.pclo, (unsigned int)id.pchi };
+						procCFA.push_back(proc);
+					}
+					break;
 			}
 		}
+	}
 
-		off += sizeof(cu->unit_length) + cu->unit_length;
+	// look up all declarations before adding them, the sorted map is only sorted again afterwards
+	sortDWARFTypeMap();
+	std::vector<std::pair<byte*, int>> signatureTypes;
+	for (size_t i = 0; i < signatureDecls.size(); i++)
+	{
+		int type = findDWARFType(signatureDecls[i].second);
+		if (type >= 0)
+			signatureTypes.push_back(std::make_pair(signatureDecls[i].first, type));
 	}
+	for (size_t i = 0; i < signatureTypes.size(); i++)
+		mapDWARFType(signatureTypes[i].first, signatureTypes[i].second);
+	if (!signatureTypes.empty())
+		sortDWARFTypeMap();
+	convStats.typesDeduplicated += signatureTypes.size();
 
+	convStats.typesEmitted += typeID - nextUserType;
 	nextDwarfType = typeID;
 	return true;
 }
 
+unsigned long CV2PDB::getDWARFEntryPoint(DWARF_InfoData& id, DWARF_CompilationUnit* cu, uint64_t base)
+{
+	if (id.pcentry)
+		return id.pcentry;
+	if (id.pclo)
+		return id.pclo;
+	if (id.ranges != ~0)
+	{
+		const std::vector<DWARFRange>& ranges = getDWARFRanges(cu, id.ranges, base);
+		if (!ranges.empty())
+			return (unsigned long)ranges.front().pclo;
+	}
+	return 0;
+}
+
+int CV2PDB::findDWARFGlobalVar(DWARF_InfoData& id, unsigned long& segOff, bool& dllimport)
+{
+	int seg = -1;
+	if (id.location.type == Invalid && id.external && id.linkage_name)
+	{
+		seg = img.findSymbol(id.linkage_name, segOff, dllimport);
+	}
+	else if (id.location.type == Invalid && id.external)
+	{
+		seg = img.findSymbol(id.name, segOff, dllimport);
+	}
+	else
+	{
+		Location loc = decodeLocation(img, id.location);
+		if (loc.is_abs())
+		{
+			segOff = loc.off;
+			seg = img.findSection(segOff);
+			if (seg >= 0)
+				segOff -= img.getImageBase() + img.getSection(seg).VirtualAddress;
+		}
+	}
+	return seg;
+}
+
+int CV2PDB::getDWARFGlobalVarType(DWARF_InfoData& id, DWARF_CompilationUnit* cu, bool dllimport)
+{
+	int type = getTypeByDWARFPtr(cu, id.type);
+	if (dllimport)
+	{
+		int pointerAttr = img.isX64() ? 0x1000C : 0x800A;
+		checkDWARFTypeAlloc(100);
+		cbDwarfTypes += addPointerType(dwarfTypes + cbDwarfTypes, type, pointerAttr | 0x20); // needs to be deduplicted?
+		type = nextDwarfType++;
+	}
+	return type;
+}
+
 bool CV2PDB::createTypes()
 {
 	img.createSymbolCache();
@@ -1407,18 +2169,25 @@ bool CV2PDB::createTypes()
 	int typeID = nextUserType;
 	int pointerAttr = img.isX64() ? 0x1000C : 0x800A;
 
-	unsigned long off = 0;
-	while (off < img.debug_info_length)
+	const std::vector<DWARF_CompilationUnit*>& units = dwarfUnits;
+	for (size_t u = 0; u < units.size(); u++)
 	{
-		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(img.debug_info + off);
+		DWARF_CompilationUnit* cu = units[u];
+		TraceSpan span("unit", "createTypes");
+		convStats.units++;
 
-		DIECursor cursor(cu, (byte*)cu + sizeof(DWARF_CompilationUnit));
+		// members, enumerators and array bounds are read again for each type
+		DIECursor::cacheUnit(cu);
+		DIECursor cursor(cu, cu->getFirstDIE());
 		DWARF_InfoData id;
 		while (cursor.readNext(id))
 		{
 			//printf("0x%08x, level = %d, id.code = %d, id.tag = %d\n",
 			//    (unsigned char*)cu + id.entryOff - (unsigned char*)img.debug_info, cursor.level, id.code, id.tag);
 
+			if (id.signature)
+				continue; // mapped to the type in the type unit
+
 			if (id.abstract_origin)
 				mergeAbstractOrigin(id, cu);
 			if (id.specification)
@@ -1485,46 +2254,9 @@ bool CV2PDB::createTypes()
 				{
 					if (!id.is_artificial)
 					{
-						unsigned long entry_point = 0;
-						if (id.pcentry)
-						{
-							entry_point = id.pcentry;
-						}
-						else if (id.pclo)
-						{
-							entry_point = id.pclo;
-						}
-						else if (id.ranges != ~0)
-						{
-							entry_point = ~0;
-							byte* r = (byte*)img.debug_ranges + id.ranges;
-							byte* rend = (byte*)img.debug_ranges + img.debug_ranges_length;
-							while (r < rend)
-							{
-								uint64_t pclo, pchi;
-
-								if (img.isX64())
-								{
-									pclo = RD8(r);
-									pchi = RD8(r);
-								}
-								else
-								{
-									pclo = RD4(r);
-									pchi = RD4(r);
-								}
-								if (pclo == 0 && pchi == 0)
-									break;
-								if (pclo >= pchi)
-									continue;
-								entry_point = min(entry_point, pclo + currentBaseAddress);
-							}
-							if (entry_point == ~0)
-								entry_point = 0;
-						}
-
-						if (entry_point)
-							mod->AddPublic2(id.name, img.codeSegment + 1, entry_point - codeSegOff, 0);
+						unsigned long entry_point = getDWARFEntryPoint(id, cu, currentBaseAddress);
+						if (entry_point && mod->AddPublic2(id.name, img.codeSegment + 1, entry_point - codeSegOff, 0) > 0)
+							convStats.publics++;
 					}
 
 					if (id.pclo && id.pchi)
@@ -1532,7 +2264,9 @@ bool CV2PDB::createTypes()
 				}
 				break;
 
+			case DW_TAG_type_unit:
 			case DW_TAG_compile_unit:
+				span.setUnit(id.name, getUnitOffset(img, cu));
 				currentBaseAddress = id.pclo;
 				switch (id.language)
 				{
@@ -1555,18 +2289,15 @@ bool CV2PDB::createTypes()
 #if !FULL_CONTRIB
 				if (id.dir && id.name)
 				{
-					if (id.ranges > 0 && id.ranges < img.debug_ranges_length)
+					const std::vector<DWARFRange>* ranges = 0;
+					if (id.ranges != ~0)
+						ranges = &getDWARFRanges(cu, id.ranges, currentBaseAddress);
+					if (ranges && !ranges->empty())
 					{
-						unsigned char* r = (unsigned char*)img.debug_ranges + id.ranges;
-						unsigned char* rend = (unsigned char*)img.debug_ranges + img.debug_ranges_length;
-						while (r < rend)
+						for (size_t r = 0; r < ranges->size(); r++)
 						{
-							unsigned long pclo = RD4(r);
-							unsigned long pchi = RD4(r);
-							if (pclo == 0 && pchi == 0)
-								break;
 							//printf("%s %s %x - %x\n", dir, name, pclo, pchi);
-							if (!addDWARFSectionContrib(mod, pclo, pchi))
+							if (!addDWARFSectionContrib(mod, (unsigned long)(*ranges)[r].pclo, (unsigned long)(*ranges)[r].pchi))
 								return false;
 						}
 					}
@@ -1583,39 +2314,15 @@ bool CV2PDB::createTypes()
 			case DW_TAG_variable:
 				if (id.name)
 				{
-					int seg = -1;
 					unsigned long segOff;
 					bool dllimport = false;
-					if (id.location.type == Invalid && id.external && id.linkage_name)
-					{
-						seg = img.findSymbol(id.linkage_name, segOff, dllimport);
-					}
-					else if (id.location.type == Invalid && id.external)
-					{
-						seg = img.findSymbol(id.name, segOff, dllimport);
-					}
-					else
-					{
-						Location loc = decodeLocation(img, id.location);
-						if (loc.is_abs())
-						{
-							segOff = loc.off;
-							seg = img.findSection(segOff);
-							if (seg >= 0)
-								segOff -= img.getImageBase() + img.getSection(seg).VirtualAddress;
-						}
-					}
+					int seg = findDWARFGlobalVar(id, segOff, dllimport);
 					if (seg >= 0)
 					{
-						int type = getTypeByDWARFPtr(cu, id.type);
-						if (dllimport)
-						{
-							checkDWARFTypeAlloc(100);
-							cbDwarfTypes += addPointerType(dwarfTypes + cbDwarfTypes, type, pointerAttr | 0x20); // needs to be deduplicted?
-							type = nextDwarfType++;
-						}
+						int type = getDWARFGlobalVarType(id, cu, dllimport);
 						appendGlobalVar(id.name, type, seg + 1, segOff);
-						int rc = mod->AddPublic2(id.name, seg + 1, segOff, type);
+						if (mod->AddPublic2(id.name, seg + 1, segOff, type) > 0)
+							convStats.publics++;
 					}
 				}
 				break;
@@ -1632,12 +2339,16 @@ bool CV2PDB::createTypes()
 			if (cvtype >= 0)
 			{
 				assert(cvtype == typeID); typeID++;
-				assert(mapOffsetToType[id.entryPtr] == cvtype);
+				assert(findDWARFType(id.entryPtr) == cvtype);
 			}
 		}
 
-		off += sizeof(cu->unit_length) + cu->unit_length;
+		// the records of the unit are complete, let them be written to the temporary files
+		releaseRecords(userTypes, cbUserTypes);
+		releaseRecords(dwarfTypes, cbDwarfTypes);
+		releaseRecords(udtSymbols, cbUdtSymbols);
 	}
+	DIECursor::cacheUnit(0);
 
 	return true;
 }
@@ -1682,11 +2393,28 @@ bool CV2PDB::createDWARFModules()
 		appendComplex(0x52, 0x42, 12, "creal");
 	}
 
-	DIECursor::setContext(&img);
+	DIECursor::setContext(&img, conversionCache ? &conversionCache->abbrevs : 0);
+
+	if (!selectDWARFUnits())
+		return false;
+	// the line programs only depend on the sections and the selected units. With a
+	// memory limit, they are interpreted by addDWARFLines instead of being buffered.
+	if (img.debug_line && !spillThreshold)
+		startDWARFLines();
 
 	countEntries = 0;
 	if (!mapTypes())
 		return false;
+	build_cfa_table();
+	// the publics of the converted units are added by the DIE walk of createTypes,
+	// the name tables provide those of the units not selected
+	std::vector<byte*> tableUnits;
+	if (dwarfUnitsSelected && readDWARFPubNames(img, dwarfPublics, tableUnits))
+	{
+		std::vector<byte*>::iterator it = std::remove_if(dwarfPublics.begin(), dwarfPublics.end(),
+			[this](byte* die) { return isDWARFUnitSelected(DIECursor::findUnit(die)); });
+		dwarfPublics.erase(it, dwarfPublics.end());
+	}
 	if (!createTypes())
 		return false;
 
@@ -1720,6 +2448,16 @@ bool CV2PDB::createDWARFModules()
 		if (rc <= 0)
 			return setError("cannot add type info to module");
 	}
+
+	if (spillThreshold)
+	{
+		// copied to the PDB, no types are added later
+		freeRecords(userTypes);
+		freeRecords(dwarfTypes);
+		userTypes = dwarfTypes = 0;
+		cbUserTypes = allocUserTypes = 0;
+		cbDwarfTypes = allocDwarfTypes = 0;
+	}
 	return true;
 }
 
@@ -1728,10 +2466,38 @@ bool CV2PDB::addDWARFLines()
 	if(!img.debug_line)
 		return setError("no .debug_line section found");
 
-    if (!interpretDWARFLines(img, globalMod()))
+	if (!lineQueue)
+	{
+		if (!interpretDWARFLines(img, globalMod(), dwarfUnitsSelected ? &dwarfLineOffsets : 0, 0, conversionCache))
+			return setError("cannot add line number info to module");
+		return true;
+	}
+
+	// add the lines of each line program as soon as it has been interpreted
+	bool ok = true;
+	std::vector<DWARF_LineBlock> blocks;
+	while (lineQueue->pop(blocks))
+		if (ok)
+			ok = addDWARFLineBlocks(globalMod(), blocks);
+	lineTask.join();
+	ok = ok && lineQueue->succeeded();
+	delete lineQueue;
+	lineQueue = 0;
+	if (!ok)
 		return setError("cannot add line number info to module");
+	return true;
+}
 
-    return true;
+void CV2PDB::startDWARFLines()
+{
+	const PEImage* image = &img;
+	const std::vector<unsigned long>* offsets = dwarfUnitsSelected ? &dwarfLineOffsets : 0;
+	DWARF_LineQueue* queue = lineQueue = new DWARF_LineQueue;
+	ConversionCache* cache = conversionCache; // per thread
+	lineTask.start([image, offsets, queue, cache]()
+	{
+		queue->close(interpretDWARFLines(*image, 0, offsets, queue, cache));
+	});
 }
 
 bool CV2PDB::addDWARFPublics()
@@ -1742,6 +2508,51 @@ bool CV2PDB::addDWARFPublics()
 	int rc = mod->AddPublic2("public_all", img.codeSegment + 1, 0, 0x1000);
 	if (rc <= 0)
 		return setError("cannot add public");
+	convStats.publics++;
+
+	// publics of the units not converted, only decode the DIEs referenced by the name tables
+	DWARF_CompilationUnit* lastcu = 0;
+	uint64_t base = 0;
+	for (size_t i = 0; i < dwarfPublics.size(); i++)
+	{
+		DWARF_CompilationUnit* cu = DIECursor::findUnit(dwarfPublics[i]);
+		if (!cu)
+			continue;
+		DWARF_InfoData id;
+		if (cu != lastcu)
+		{
+			// base address for range lists
+			DIECursor cucursor(cu, cu->getFirstDIE());
+			base = cucursor.readNext(id) ? id.pclo : 0;
+			lastcu = cu;
+		}
+
+		DIECursor cursor(cu, dwarfPublics[i]);
+		if (!cursor.readNext(id, true))
+			continue;
+		if (id.abstract_origin)
+			mergeAbstractOrigin(id, cu);
+		if (id.specification)
+			mergeSpecification(id, cu);
+		if (!id.name)
+			continue;
+
+		if (id.tag == DW_TAG_subprogram && !id.is_artificial)
+		{
+			unsigned long entry_point = getDWARFEntryPoint(id, cu, base);
+			if (entry_point && mod->AddPublic2(id.name, img.codeSegment + 1, entry_point - codeSegOff, 0) > 0)
+				convStats.publics++;
+		}
+		else if (id.tag == DW_TAG_variable)
+		{
+			unsigned long segOff;
+			bool dllimport = false;
+			int seg = findDWARFGlobalVar(id, segOff, dllimport);
+			// the types of units not converted are unknown
+			if (seg >= 0 && mod->AddPublic2(id.name, seg + 1, segOff, 0) > 0)
+				convStats.publics++;
+		}
+	}
 	return true;
 }
 
@@ -1759,17 +2570,108 @@ bool CV2PDB::writeDWARFImage(const TCHAR* opath)
 
 void CV2PDB::build_cfi_index()
 {
-	if (img.debug_frame == NULL)
+	if (img.debug_frame == NULL && img.eh_frame == NULL)
 		return;
-	cfi_index = new CFIIndex(img);
+	// built while the PDB is opened and the types are mapped
+	cfiTask.start([this]()
+	{
+		TraceSpan span("cfi", "build_cfi_index");
+		cfi_index = new CFIIndex(img);
+	});
 }
 
-CFIIndex::CFIIndex(const PEImage& img)
+void CV2PDB::free_cfi_index()
 {
-	CFIEntry entry;
-	CFICursor cursor(img);
+	cfiTask.join();
+	delete cfi_index;
+	cfi_index = 0;
+}
+
+void CV2PDB::build_cfa_table()
+{
+	std::sort(procCFA.begin(), procCFA.end());
+	procCFA.erase(std::unique(procCFA.begin(), procCFA.end(), ProcCFA::samePC), procCFA.end());
+
+	Location ebp = defaultCFA(img);
+	for (size_t i = 0; i < procCFA.size(); i++)
+		procCFA[i].cfa = ebp;
+	cfiTask.join();
+	if (!cfi_index)
+		return;
+
+	std::vector<std::pair<unsigned int, unsigned int>> ranges(procCFA.size());
+	for (size_t i = 0; i < procCFA.size(); i++)
+		ranges[i] = std::make_pair(procCFA[i].pclo, procCFA[i].pchi);
+	std::vector<byte*> fdes;
+	cfi_index->lookupSorted(ranges, fdes);
+
+	// replay every FDE once, procedures covered by the same FDE share the result
+	std::unordered_map<byte*, Location> fdeCFA;
+	for (size_t i = 0; i < procCFA.size(); i++)
+	{
+		if (!fdes[i])
+			continue;
+		std::unordered_map<byte*, Location>::iterator it = fdeCFA.find(fdes[i]);
+		if (it == fdeCFA.end())
+		{
+			Location cfa = ebp;
+			computeFDECFA(img, cfi_index, fdes[i], procCFA[i].pclo, cfa);
+			it = fdeCFA.insert(std::make_pair(fdes[i], cfa)).first;
+		}
+		procCFA[i].cfa = it->second;
+	}
+}
+
+Location CV2PDB::getProcCFA(unsigned int pclo, unsigned int pchi) const
+{
+	ProcCFA key = { pclo, pchi };
+	std::vector<ProcCFA>::const_iterator it = std::lower_bound(procCFA.begin(), procCFA.end(), key);
+	if (it != procCFA.end() && ProcCFA::samePC(*it, key))
+		return it->cfa;
+	cfiTask.join(); // done by build_cfa_table during a conversion
+	return findBestCFA(img, cfi_index, pclo, pchi);
+}
+
+CFIIndex::CFIIndex(const PEImage& image)
+: img(image)
+, hdrTable(0)
+, hdrCount(0)
+{
+	// with only .eh_frame, its binary search table can be used directly
+	if (!img.debug_frame && img.eh_frame && initEHFrameHdr())
+		return;
 
 	// First register all FDE as index entries
+	if (img.debug_frame)
+		addSection(false);
+	if (img.eh_frame)
+		addSection(true);
+
+	// Then make them sorted so we can perform binary searches later on
+	std::sort(index.begin(), index.end());
+
+	buildSegments();
+
+	// Replay the initial instructions of each CIE once, so lookups only
+	// have to process the instructions of the FDE
+	for (std::unordered_map<byte*, CFIEntry>::iterator it = cies.begin(); it != cies.end(); ++it)
+		if (it->second.type == CFIEntry::CIE)
+			replayCIE(it->second);
+}
+
+void CFIIndex::replayCIE(CFIEntry& cie) const
+{
+	CFACursor cfa(img, cie, 0);
+	while (cfa.processNext()) {}
+	cie.initial_cfa = cfa.cfa;
+}
+
+void CFIIndex::addSection(bool ehframe)
+{
+	CFIEntry entry;
+	CFICursor cursor(img, ehframe);
+	cursor.cieCache = &cies;
+
 	while (cursor.readNext(entry))
 	{
 		if (entry.type != CFIEntry::FDE)
@@ -1782,24 +2684,192 @@ CFIIndex::CFIIndex(const PEImage& img)
 		};
 		index.push_back(e);
 	}
+}
 
-	// Then make them sorted so we can perform binary searches later on
-	std::sort(index.begin(), index.end());
+bool CFIIndex::initEHFrameHdr()
+{
+	if (!img.eh_frame_hdr || img.eh_frame_hdr_length < 4 || img.ehFrameHdrSegment < 0 || img.ehFrameSegment < 0)
+		return false;
+
+	byte* p = (byte*)img.eh_frame_hdr;
+	byte* end = p + img.eh_frame_hdr_length;
+	byte version = *p++;
+	byte eh_frame_ptr_enc = *p++;
+	byte fde_count_enc = *p++;
+	byte table_enc = *p++;
+	if (version != 1 || table_enc != (DW_EH_PE_datarel | DW_EH_PE_sdata4))
+		return false;
+
+	int address_size = img.isX64() ? 8 : 4;
+	unsigned long long eh_frame_ptr, fde_count;
+	if (!readEncodedValue(p, eh_frame_ptr_enc, address_size, eh_frame_ptr) ||
+	    !readEncodedValue(p, fde_count_enc, address_size, fde_count))
+		return false;
+	if (p > end || fde_count > (unsigned long long)(end - p) / 8)
+		return false;
+
+	hdrTable = p;
+	hdrCount = (size_t)fde_count;
+	hdrVaddr = img.getImageBase() + img.getSection(img.ehFrameHdrSegment).VirtualAddress;
+	frameVaddr = img.getImageBase() + img.getSection(img.ehFrameSegment).VirtualAddress;
+
+	// the search relies on the order, fall back to scanning .eh_frame otherwise
+	for (size_t i = 1; i < hdrCount; i++)
+		if (tableLocation(i) < tableLocation(i - 1))
+		{
+			hdrTable = 0;
+			hdrCount = 0;
+			return false;
+		}
+	return true;
 }
 
-byte *CFIIndex::lookup(unsigned int pclo, unsigned int pchi) const
+unsigned int CFIIndex::tableLocation(size_t i) const
+{
+	byte* p = hdrTable + 8 * i;
+	return (unsigned int)(hdrVaddr + (int) RD4(p));
+}
+
+byte *CFIIndex::tableFDE(size_t i) const
 {
-	// TODO: here, we are just looking for the first entry whose range contains PCLO,
-	// assuming the found entry will have the same PCLO and PCHI as arguments. Maybe
-	// this is not always true.
-	index_entry e = { pclo, pclo, NULL };
-	std::vector<index_entry>::const_iterator it
-		= std::lower_bound(index.begin(), index.end(), e);
-	if (it == index.end())
+	byte* p = hdrTable + 8 * i + 4;
+	unsigned long long off = hdrVaddr + (int) RD4(p) - frameVaddr;
+	return off < img.eh_frame_length ? (byte*)img.eh_frame + off : NULL;
+}
+
+byte *CFIIndex::lookupTable(size_t next, unsigned int pclo, unsigned int pchi) const
+{
+	CFIEntry entry;
+	byte* fde = next > 0 ? tableFDE(next - 1) : NULL;
+	if (!fde || !readFDE(fde, entry))
 		return NULL;
-	e = *it;
-	if (e.pclo <= pclo && pchi <= e.pchi)
-		return e.ptr;
-	else
+	unsigned int lo = entry.initial_location, hi = lo + entry.address_range;
+	return lo <= pclo && pclo < hi && pchi <= hi ? fde : NULL;
+}
+
+bool CFIIndex::readFDE(byte* fde_ptr, CFIEntry& entry) const
+{
+	bool ehframe = fde_ptr >= (byte*)img.eh_frame && fde_ptr < (byte*)img.eh_frame + img.eh_frame_length;
+	CFICursor cursor(img, ehframe);
+	cursor.cieCache = &cies;
+	cursor.ptr = fde_ptr;
+	size_t known = cies.size();
+	if (!cursor.readNext(entry) || entry.type != CFIEntry::FDE)
+		return false;
+	if (cies.size() != known) // CIE read for the first time by a lookup in the table
+	{
+		CFIEntry& cie = cies[entry.cie];
+		replayCIE(cie);
+		entry.initial_cfa = cie.initial_cfa;
+	}
+	return true;
+}
+
+void CFIIndex::buildSegments()
+{
+	// sweep over the start and end addresses, keeping the FDEs covering the
+	// current address ordered by their range (and the later entry first for
+	// equal ranges). Entries starting at the same address are added largest
+	// first, so the enclosing entries are active when an entry is added.
+	parent.assign(index.size(), kNoCFIEntry);
+	jump.assign(index.size(), kNoCFIEntry);
+	depth.assign(index.size(), 0);
+	std::vector<std::pair<unsigned int, unsigned int>> ends;
+	for (size_t i = 0; i < index.size(); i++)
+		if (index[i].pclo < index[i].pchi)
+			ends.push_back(std::make_pair(index[i].pchi, (unsigned int)i));
+	std::sort(ends.begin(), ends.end());
+
+	std::set<std::pair<unsigned int, int>> active;
+	size_t nextStart = 0, nextEnd = 0;
+	while (nextStart < index.size() || nextEnd < ends.size())
+	{
+		unsigned int addr = nextEnd < ends.size() ? ends[nextEnd].first : ~0u;
+		if (nextStart < index.size())
+			addr = min(addr, index[nextStart].pclo);
+
+		for (; nextEnd < ends.size() && ends[nextEnd].first == addr; nextEnd++)
+		{
+			const index_entry& e = index[ends[nextEnd].second];
+			active.erase(std::make_pair(e.pchi - e.pclo, -(int)ends[nextEnd].second));
+		}
+		size_t first = nextStart;
+		while (nextStart < index.size() && index[nextStart].pclo == addr)
+			nextStart++;
+		for (size_t i = nextStart; i-- > first; )
+		{
+			const index_entry& e = index[i];
+			if (e.pclo >= e.pchi)
+				continue;
+			std::set<std::pair<unsigned int, int>>::iterator it =
+				active.insert(std::make_pair(e.pchi - e.pclo, -(int)i)).first;
+			if (++it == active.end())
+				continue;
+			unsigned int p = -it->second, j = jump[p];
+			parent[i] = p;
+			depth[i] = depth[p] + 1;
+			if (j != kNoCFIEntry && jump[j] != kNoCFIEntry && depth[p] - depth[j] == depth[j] - depth[jump[j]])
+				jump[i] = jump[j];
+			else
+				jump[i] = p;
+		}
+
+		segStart.push_back(addr);
+		segSmallest.push_back(active.empty() ? kNoCFIEntry : -active.begin()->second);
+	}
+}
+
+byte *CFIIndex::findCovering(size_t seg, unsigned int pclo, unsigned int pchi) const
+{
+	// the ends of the enclosing entries increase towards the root, skip
+	// ahead as long as the jump target doesn't cover the range either
+	unsigned int c = segSmallest[seg];
+	while (c != kNoCFIEntry && !covers(c, pclo, pchi))
+		c = jump[c] != kNoCFIEntry && !covers(jump[c], pclo, pchi) ? jump[c] : parent[c];
+	return c != kNoCFIEntry ? index[c].ptr : NULL;
+}
+
+byte *CFIIndex::lookup(unsigned int pclo, unsigned int pchi) const
+{
+	if (hdrTable)
+	{
+		size_t lo = 0, hi = hdrCount;
+		while (lo < hi)
+		{
+			size_t mid = (lo + hi) / 2;
+			if (tableLocation(mid) <= pclo)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lookupTable(lo, pclo, pchi);
+	}
+
+	std::vector<unsigned int>::const_iterator it
+		= std::upper_bound(segStart.begin(), segStart.end(), pclo);
+	if (it == segStart.begin())
 		return NULL;
+	return findCovering(it - segStart.begin() - 1, pclo, pchi);
+}
+
+void CFIIndex::lookupSorted(const std::vector<std::pair<unsigned int, unsigned int>>& ranges,
+                            std::vector<byte*>& fdes) const
+{
+	fdes.resize(ranges.size());
+
+	size_t next = 0; // first segment (or table entry) starting above the current PCLO
+	for (size_t r = 0; r < ranges.size(); r++)
+	{
+		assert(r == 0 || ranges[r - 1].first <= ranges[r].first);
+		if (hdrTable)
+		{
+			while (next < hdrCount && tableLocation(next) <= ranges[r].first)
+				next++;
+			fdes[r] = lookupTable(next, ranges[r].first, ranges[r].second);
+			continue;
+		}
+		while (next < segStart.size() && segStart[next] <= ranges[r].first)
+			next++;
+		fdes[r] = next > 0 ? findCovering(next - 1, ranges[r].first, ranges[r].second) : NULL;
+	}
 }
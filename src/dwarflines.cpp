@@ -9,6 +9,10 @@
 #include "mspdb.h"
 #include "dwarf.h"
 #include "readDwarf.h"
+#include "cache.h"
+#include "stats.h"
+
+#include <algorithm>
 
 bool isRelativePath(const std::string& s)
 {
@@ -64,7 +68,13 @@ bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& stat
 //        return true;
 
 	const DWARF_FileName* dfn;
-	if(state.lineInfo_file == 0)
+	if(state.lineInfo_file == 0 && !state.file_ptr)
+	{
+		// no file defined by DW_LNE_define_file
+		state.lineInfo.resize(0);
+		return true;
+	}
+	else if(state.lineInfo_file == 0)
 		dfn = state.file_ptr;
 	else if(state.lineInfo_file > 0 && state.lineInfo_file <= state.files.size())
 		dfn = &state.files[state.lineInfo_file - 1];
@@ -84,7 +94,7 @@ bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& stat
 		if(fname[i] == '/')
 			fname[i] = '\\';
 
-    if (!mod)
+    if (!mod && !state.blocks)
     {
         printLines(fname.c_str(), segIndex, img.findSectionSymbolName(segIndex),
                    state.lineInfo.data(), state.lineInfo.size());
@@ -123,6 +133,19 @@ bool _flushDWARFLines(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& stat
 	if (dump)
 		printf("AddLines(%08x+%04x, Line=%4d+%3d, %s)\n", low_offset, address_range_length, low_line,
 		       state.lineInfo.size(), fname.c_str());
+	if (state.blocks)
+	{
+		// added to the module by addDWARFLineBlocks
+		DWARF_LineBlock block;
+		block.file = fname;
+		block.segment = segIndex + 1;
+		block.offset = low_offset;
+		block.length = address_range_length;
+		block.line = low_line;
+		block.lines.swap(state.lineInfo);
+		state.blocks->push_back(std::move(block));
+		return true;
+	}
 	rc = mod->AddLines(fname.c_str(), segIndex + 1, low_offset, address_range_length, low_offset, low_line,
 	                   (unsigned char*)&state.lineInfo[0],
 	                   state.lineInfo.size() * sizeof(state.lineInfo[0]));
@@ -144,6 +167,7 @@ bool addLineInfo(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& state)
 	// address is that of the first byte after the end of a sequence of target
 	// machine instructions". So if this is a end_sequence row, don't append any
 	// lines to the list, just flush it.
+	convStats.lineRows++;
 	if (state.end_sequence)
 		return _flushDWARFLines(img, mod, state);
 
@@ -177,20 +201,115 @@ bool addLineInfo(const PEImage& img, mspdb::Mod* mod, DWARF_LineState& state)
 	return true;
 }
 
-bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
+bool addDWARFLineBlocks(mspdb::Mod* mod, const std::vector<DWARF_LineBlock>& blocks)
+{
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		const DWARF_LineBlock& block = blocks[b];
+		int rc = mod->AddLines(block.file.c_str(), block.segment, block.offset, block.length, block.offset, block.line,
+		                       (unsigned char*)block.lines.data(), block.lines.size() * sizeof(block.lines[0]));
+		if (rc <= 0)
+			return false;
+	}
+	return true;
+}
+
+void DWARF_LineQueue::push(std::vector<DWARF_LineBlock>& blocks)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	pending.push_back(std::vector<DWARF_LineBlock>());
+	pending.back().swap(blocks);
+	ready.notify_one();
+}
+
+void DWARF_LineQueue::close(bool success)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	closed = true;
+	ok = success;
+	ready.notify_one();
+}
+
+bool DWARF_LineQueue::pop(std::vector<DWARF_LineBlock>& blocks)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (pending.empty() && !closed)
+		ready.wait(guard);
+	if (pending.empty())
+		return false;
+	blocks.swap(pending.front());
+	pending.pop_front();
+	return true;
+}
+
+// the lines of a line program also depend on the sections of the image and the
+// file names in .debug_line_str
+static ContentHash hashLineLayout(const PEImage& img, int ptrsize)
+{
+	unsigned long long base = img.getImageBase();
+	int layout[2] = { ptrsize, img.codeSegment };
+	ContentHash h = hashContent(&base, sizeof(base));
+	h = hashContent(layout, sizeof(layout), h);
+	for (int s = 0; s < img.countSections(); s++)
+	{
+		DWORD range[2] = { img.getSection(s).VirtualAddress, img.getSection(s).Misc.VirtualSize };
+		h = hashContent(range, sizeof(range), h);
+	}
+	if (img.debug_line_str)
+		h = hashContent(img.debug_line_str, img.debug_line_str_length, h);
+	return h;
+}
+
+bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod, const std::vector<unsigned long>* offsets,
+                         DWARF_LineQueue* queue, ConversionCache* cache)
 {
 	DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)img.debug_info;
-	int ptrsize = cu ? cu->address_size : 4;
+	int ptrsize = cu ? cu->getAddressSize() : 4;
+
+	if (!mod && !queue)
+		cache = 0; // printed
+	ContentHash layout;
+	if (cache)
+		layout = hashLineLayout(img, ptrsize);
 
 	DWARF_LineNumberProgramHeader hdr5;
-	for(unsigned long off = 0; off < img.debug_line_length; )
+	for(unsigned long off = 0; off + sizeof(DWARF2_LineNumberProgramHeader) <= img.debug_line_length; )
 	{
 		DWARF_LineNumberProgramHeader* hdrver = (DWARF_LineNumberProgramHeader*) (img.debug_line + off);
 		int length = hdrver->unit_length;
-		if(length < 0)
+		if(length < 0 || (unsigned long)length > img.debug_line_length - off - sizeof(length))
 			break;
 		length += sizeof(length);
 
+		if (offsets && !std::binary_search(offsets->begin(), offsets->end(), off))
+		{
+			off += length;
+			continue;
+		}
+		TraceSpan span("lines", "line program");
+		span.setUnit(0, off);
+
+		ContentHash key;
+		if (cache)
+		{
+			key = hashContent(hdrver, length, layout);
+			if (const std::vector<DWARF_LineBlock>* cached = cache->findLines(key))
+			{
+				convStats.cachedLinePrograms++;
+				for (size_t b = 0; b < cached->size(); b++)
+					convStats.lineRows += (*cached)[b].lines.size();
+				if (queue)
+				{
+					std::vector<DWARF_LineBlock> blocks(*cached);
+					queue->push(blocks);
+				}
+				else if (!addDWARFLineBlocks(mod, *cached))
+					return false;
+				off += length;
+				continue;
+			}
+		}
+
 		DWARF_LineNumberProgramHeader* hdr;
 		if (hdrver->version <= 3)
 		{
@@ -223,6 +342,11 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 		else
 			hdr = hdrver;
 		int hdrlength = hdr->version <= 3 ? sizeof(DWARF2_LineNumberProgramHeader) : hdr->version == 4 ? sizeof(DWARF4_LineNumberProgramHeader) : sizeof(DWARF_LineNumberProgramHeader);
+		if (hdrlength > length || hdr->line_range == 0)
+		{
+			off += length; // truncated or corrupt header
+			continue;
+		}
 		unsigned char* p = (unsigned char*) hdrver + hdrlength;
 		unsigned char* end = (unsigned char*) hdrver + length;
 
@@ -237,6 +361,9 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 
 		DWARF_LineState state;
 		state.seg_offset = img.getImageBase() + img.getSection(img.codeSegment).VirtualAddress;
+		std::vector<DWARF_LineBlock> blocks;
+		if (queue || cache)
+			state.blocks = &blocks;
 
 		DWARF_FileName fname;
 		if (hdr->version <= 4)
@@ -265,15 +392,16 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 
 			byte directory_entry_format_count = *(p++);
 			std::vector<DWARF_TypeForm> directory_entry_format;
-			for (int i = 0; i < directory_entry_format_count; i++)
+			for (int i = 0; i < directory_entry_format_count && p < end; i++)
 			{
 				type_and_form.type = LEB128(p);
 				type_and_form.form = LEB128(p);
 				directory_entry_format.push_back(type_and_form);
 			}
+			directory_entry_format_count = (byte)directory_entry_format.size();
 
 			unsigned int directories_count = LEB128(p);
-			for (int o = 0; o < directories_count; o++)
+			for (unsigned int o = 0; o < directories_count && p < end; o++)
 			{
 				for (int i = 0; i < directory_entry_format_count; i++)
 				{
@@ -284,7 +412,9 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 							{
 							case DW_FORM_line_strp:
 							{
-								size_t offset = cu->isDWARF64() ? RD8(p) : RD4(p);
+								size_t offset = cu && cu->isDWARF64() ? RD8(p) : RD4(p);
+								if (offset >= img.debug_line_str_length)
+									return false;
 								state.include_dirs.push_back(img.debug_line_str + offset);
 								break;
 							}
@@ -307,26 +437,29 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 
 			byte file_name_entry_format_count = *(p++);
 			std::vector<DWARF_TypeForm> file_name_entry_format;
-			for (int i = 0; i < file_name_entry_format_count; i++)
+			for (int i = 0; i < file_name_entry_format_count && p < end; i++)
 			{
 				type_and_form.type = LEB128(p);
 				type_and_form.form = LEB128(p);
 				file_name_entry_format.push_back(type_and_form);
 			}
+			file_name_entry_format_count = (byte)file_name_entry_format.size();
 
 			unsigned int file_names_count = LEB128(p);
-			for (int o = 0; o < file_names_count; o++)
+			for (unsigned int o = 0; o < file_names_count && p < end; o++)
 			{
 				for (int i = 0; i < file_name_entry_format_count; i++)
 				{
 					switch (file_name_entry_format[i].type)
 					{
 						case DW_LNCT_path:
-							switch (directory_entry_format[i].form)
+							switch (file_name_entry_format[i].form)
 							{
 							case DW_FORM_line_strp:
 							{
-								size_t offset = cu->isDWARF64() ? RD8(p) : RD4(p);
+								size_t offset = cu && cu->isDWARF64() ? RD8(p) : RD4(p);
+								if (offset >= img.debug_line_str_length)
+									return false;
 								fname.file_name = img.debug_line_str + offset;
 								break;
 							}
@@ -381,7 +514,12 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 				{
 				case 0: // extended
 				{
-					int exlength = LEB128(p);
+					unsigned int exlength = LEB128(p);
+					if (exlength > (unsigned int)(end - p))
+					{
+						p = end; // truncated instruction
+						break;
+					}
 					unsigned char* q = p + exlength;
 					int excode = *p++;
 					switch(excode)
@@ -397,7 +535,7 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 						break;
 					case DW_LNE_set_address:
 					{
-						if (!mod && state.section == -1)
+						if (!mod && !queue && state.section == -1)
 							state.section = img.getRelocationInLineSegment((char*)p - img.debug_line);
 						unsigned long adr = ptrsize == 8 ? RD8(p) : RD4(p);
 						state.address = adr;
@@ -460,7 +598,7 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 					break;
 				default:
 					// unknown standard opcode
-					for(unsigned int arg = 0; arg < opcode_lengths[opcode]; arg++)
+					for(unsigned int arg = 0; arg < opcode_lengths[opcode] && p < end; arg++)
 						LEB128(p);
 					break;
 				}
@@ -468,6 +606,12 @@ bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod)
 		}
 		if(!_flushDWARFLines(img, mod, state))
 			return false;
+		if (cache)
+			cache->addLines(key, blocks);
+		if (queue)
+			queue->push(blocks);
+		else if (cache && !addDWARFLineBlocks(mod, blocks))
+			return false;
 
 		off += length;
 	}
@@ -0,0 +1,363 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+// Minimal inflate for compressed debug sections, following the structure
+// of zlib's puff.c, but with a lookup table for short Huffman codes
+
+#include "inflate.h"
+
+#include <string.h>
+
+namespace
+{
+
+const int kMaxBits = 15;  // maximum bits in a code
+const int kFastBits = 10; // codes up to this length are decoded by table lookup
+
+struct Huffman
+{
+	short count[kMaxBits + 1]; // number of codes of each length
+	short symbol[288];         // symbols ordered by code
+	unsigned short fast[1 << kFastBits]; // symbol << 4 | length, 0 for longer codes
+};
+
+struct State
+{
+	const unsigned char* in;
+	const unsigned char* inend;
+	unsigned long long bitbuf;
+	int bitcnt;
+	int padbits; // bits of zero padding beyond the end of the input
+
+	unsigned char* out;
+	size_t outpos;
+	size_t outlen;
+
+	// tables for blocks with fixed codes, built on first use (per stream to
+	// allow decompressing multiple sections concurrently)
+	Huffman fixedLen, fixedDist;
+	bool fixedInit;
+
+	void refill()
+	{
+		while (bitcnt <= 56)
+		{
+			if (in < inend)
+				bitbuf |= (unsigned long long)*in++ << bitcnt;
+			else
+				padbits += 8;
+			bitcnt += 8;
+		}
+	}
+	unsigned int bits(int n)
+	{
+		if (bitcnt < n)
+			refill();
+		unsigned int val = (unsigned int)(bitbuf & ((1ull << n) - 1));
+		bitbuf >>= n;
+		bitcnt -= n;
+		return val;
+	}
+	bool overrun() const { return bitcnt < padbits; }
+};
+
+// build the decoding tables from the code lengths, returns false if over-subscribed
+bool build(Huffman& h, const short* length, int n)
+{
+	memset(h.count, 0, sizeof(h.count));
+	memset(h.fast, 0, sizeof(h.fast));
+	for (int sym = 0; sym < n; sym++)
+		h.count[length[sym]]++;
+
+	int left = 1;
+	for (int len = 1; len <= kMaxBits; len++)
+	{
+		left <<= 1;
+		left -= h.count[len];
+		if (left < 0)
+			return false;
+	}
+
+	short offs[kMaxBits + 1];
+	unsigned int next[kMaxBits + 1];
+	offs[1] = 0;
+	next[1] = 0;
+	for (int len = 1; len < kMaxBits; len++)
+	{
+		offs[len + 1] = offs[len] + h.count[len];
+		next[len + 1] = (next[len] + h.count[len]) << 1;
+	}
+
+	for (int sym = 0; sym < n; sym++)
+	{
+		int len = length[sym];
+		if (len == 0)
+			continue;
+		h.symbol[offs[len]++] = (short)sym;
+
+		unsigned int code = next[len]++;
+		if (len <= kFastBits)
+		{
+			// codes are stored starting with the most significant bit
+			unsigned int rev = 0;
+			for (int b = 0; b < len; b++)
+				rev |= ((code >> b) & 1) << (len - 1 - b);
+			for (unsigned int i = rev; i < (1u << kFastBits); i += 1u << len)
+				h.fast[i] = (unsigned short)(sym << 4 | len);
+		}
+	}
+	return true;
+}
+
+int decode(State& s, const Huffman& h)
+{
+	if (s.bitcnt < kMaxBits)
+		s.refill();
+
+	unsigned int e = h.fast[s.bitbuf & ((1 << kFastBits) - 1)];
+	if (e)
+	{
+		s.bitbuf >>= e & 15;
+		s.bitcnt -= e & 15;
+		return e >> 4;
+	}
+
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len <= kMaxBits; len++)
+	{
+		code |= (int)(s.bitbuf & 1);
+		s.bitbuf >>= 1;
+		s.bitcnt--;
+		int count = h.count[len];
+		if (code - count < first)
+			return h.symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1; // ran out of codes
+}
+
+const short lbase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const short lext[29]  = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const short dbase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                          257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                          8193, 12289, 16385, 24577 };
+const short dext[30]  = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                          7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+bool codes(State& s, const Huffman& lencode, const Huffman& distcode)
+{
+	for (;;)
+	{
+		int sym = decode(s, lencode);
+		if (sym < 0)
+			return false;
+		if (sym < 256)
+		{
+			if (s.outpos >= s.outlen)
+				return false;
+			s.out[s.outpos++] = (unsigned char)sym;
+		}
+		else if (sym == 256)
+			return !s.overrun();
+		else
+		{
+			sym -= 257;
+			if (sym >= 29)
+				return false;
+			size_t len = lbase[sym] + s.bits(lext[sym]);
+
+			int dsym = decode(s, distcode);
+			if (dsym < 0 || dsym >= 30)
+				return false;
+			size_t dist = dbase[dsym] + s.bits(dext[dsym]);
+			if (dist > s.outpos || len > s.outlen - s.outpos)
+				return false;
+
+			unsigned char* p = s.out + s.outpos;
+			const unsigned char* q = p - dist;
+			s.outpos += len;
+			while (len--)
+				*p++ = *q++;
+		}
+	}
+}
+
+bool stored(State& s)
+{
+	s.bits(s.bitcnt & 7); // skip to byte boundary
+	unsigned int len = s.bits(16);
+	unsigned int nlen = s.bits(16);
+	if (len != (~nlen & 0xffff) || s.overrun())
+		return false;
+	if (len > s.outlen - s.outpos)
+		return false;
+
+	// bytes still in the bit buffer first
+	while (len > 0 && s.bitcnt > s.padbits)
+	{
+		s.out[s.outpos++] = (unsigned char)s.bits(8);
+		len--;
+	}
+	if (len > (size_t)(s.inend - s.in))
+		return false;
+	memcpy(s.out + s.outpos, s.in, len);
+	s.outpos += len;
+	s.in += len;
+	return true;
+}
+
+bool fixed(State& s)
+{
+	if (!s.fixedInit)
+	{
+		short lengths[288];
+		int sym = 0;
+		for (; sym < 144; sym++) lengths[sym] = 8;
+		for (; sym < 256; sym++) lengths[sym] = 9;
+		for (; sym < 280; sym++) lengths[sym] = 7;
+		for (; sym < 288; sym++) lengths[sym] = 8;
+		build(s.fixedLen, lengths, 288);
+		for (sym = 0; sym < 30; sym++) lengths[sym] = 5;
+		build(s.fixedDist, lengths, 30);
+		s.fixedInit = true;
+	}
+	return codes(s, s.fixedLen, s.fixedDist);
+}
+
+bool dynamic(State& s)
+{
+	static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	int nlen = s.bits(5) + 257;
+	int ndist = s.bits(5) + 1;
+	int ncode = s.bits(4) + 4;
+	if (nlen > 286 || ndist > 30)
+		return false;
+
+	short lengths[320];
+	int index;
+	for (index = 0; index < ncode; index++)
+		lengths[order[index]] = (short)s.bits(3);
+	for (; index < 19; index++)
+		lengths[order[index]] = 0;
+
+	Huffman lencode, distcode;
+	if (!build(lencode, lengths, 19))
+		return false;
+
+	index = 0;
+	while (index < nlen + ndist)
+	{
+		int sym = decode(s, lencode);
+		if (sym < 0)
+			return false;
+		if (sym < 16)
+		{
+			lengths[index++] = (short)sym;
+			continue;
+		}
+		short len = 0;
+		int repeat;
+		if (sym == 16)
+		{
+			if (index == 0)
+				return false;
+			len = lengths[index - 1];
+			repeat = 3 + s.bits(2);
+		}
+		else if (sym == 17)
+			repeat = 3 + s.bits(3);
+		else
+			repeat = 11 + s.bits(7);
+		if (index + repeat > nlen + ndist)
+			return false;
+		while (repeat--)
+			lengths[index++] = len;
+	}
+	if (lengths[256] == 0)
+		return false; // no end-of-block code
+
+	if (!build(lencode, lengths, nlen))
+		return false;
+	if (!build(distcode, lengths + nlen, ndist))
+		return false;
+	return codes(s, lencode, distcode);
+}
+
+// checksum of the zlib stream (RFC 1950)
+unsigned long adler32(const unsigned char* p, size_t len)
+{
+	const unsigned long kBase = 65521;
+	const size_t kMaxRun = 5552; // bytes before the sums can overflow 32 bits
+	unsigned long a = 1, b = 0;
+	while (len > 0)
+	{
+		size_t n = len < kMaxRun ? len : kMaxRun;
+		len -= n;
+		for (; n > 0; n--)
+		{
+			a += *p++;
+			b += a;
+		}
+		a %= kBase;
+		b %= kBase;
+	}
+	return (b << 16) | a;
+}
+
+} // namespace
+
+bool inflateZlib(const unsigned char* src, size_t srclen, unsigned char* dst, size_t dstlen)
+{
+	if (srclen < 2)
+		return false;
+	// zlib header: deflate method, no preset dictionary
+	if ((src[0] & 0x0f) != 8 || ((src[0] << 8) | src[1]) % 31 != 0 || (src[1] & 0x20))
+		return false;
+
+	State s;
+	s.in = src + 2;
+	s.inend = src + srclen;
+	s.bitbuf = 0;
+	s.bitcnt = 0;
+	s.padbits = 0;
+	s.out = dst;
+	s.outpos = 0;
+	s.outlen = dstlen;
+	s.fixedInit = false;
+
+	int last;
+	do
+	{
+		last = s.bits(1);
+		bool ok;
+		switch (s.bits(2))
+		{
+			case 0:  ok = stored(s); break;
+			case 1:  ok = fixed(s); break;
+			case 2:  ok = dynamic(s); break;
+			default: ok = false; break;
+		}
+		if (!ok || s.overrun())
+			return false;
+	} while (!last);
+	if (s.outpos != dstlen)
+		return false;
+
+	// big endian adler32 checksum of the uncompressed data
+	s.bits(s.bitcnt & 7); // skip to byte boundary
+	unsigned long check = 0;
+	for (int i = 0; i < 4; i++)
+		check = (check << 8) | s.bits(8);
+	if (s.overrun())
+		return false;
+	return check == adler32(dst, dstlen);
+}
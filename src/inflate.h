@@ -0,0 +1,17 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __INFLATE_H__
+#define __INFLATE_H__
+
+#include <stddef.h>
+
+// Decompress the zlib stream (RFC 1950/1951) SRC into DST, which must have
+// exactly the uncompressed size DSTLEN. Returns false for corrupt data or a
+// mismatch of the adler32 checksum.
+bool inflateZlib(const unsigned char* src, size_t srclen, unsigned char* dst, size_t dstlen);
+
+#endif //__INFLATE_H__
@@ -4,44 +4,14 @@
 // License for redistribution is given by the Artistic License 2.0
 // see file LICENSE for further details
 
-#include "PEImage.h"
-#include "cv2pdb.h"
-#include "symutil.h"
-
-#include <direct.h>
+#include "converter.h"
+#include "server.h"
+#include "watch.h"
 
 double
 #include "../VERSION"
 ;
 
-#ifdef UNICODE
-#define T_toupper	towupper
-#define T_getdcwd	_wgetdcwd
-#define T_strlen	wcslen
-#define T_strcpy	wcscpy
-#define T_strcat	wcscat
-#define T_strstr	wcsstr
-#define T_strtod	wcstod
-#define T_strrchr	wcsrchr
-#define T_unlink	_wremove
-#define T_main		wmain
-#define SARG		"%S"
-#define T_stat		_wstat
-#else
-#define T_toupper	toupper
-#define T_getdcwd	_getdcwd
-#define T_strlen	strlen
-#define T_strcpy	strcpy
-#define T_strcat	strcat
-#define T_strstr	strstr
-#define T_strtod	strtod
-#define T_strrchr	strrchr
-#define T_unlink	unlink
-#define T_main		main
-#define SARG		"%s"
-#define T_stat		stat
-#endif
-
 void fatal(const char *message, ...)
 {
 	va_list argptr;
@@ -52,100 +22,88 @@ void fatal(const char *message, ...)
 	exit(1);
 }
 
-void makefullpath(TCHAR* pdbname)
+int T_main(int argc, TCHAR* argv[])
 {
-	TCHAR* pdbstart = pdbname;
-	TCHAR fullname[260];
-	TCHAR* pfullname = fullname;
+	Converter converter;
+	ConverterOptions& opts = converter.options;
+	const TCHAR* batchFile = 0;
+	int jobs = 0;
+	const TCHAR* serverName = 0;
+	const TCHAR* clientArg = 0;
+	bool watch = false;
+	int argc0 = argc;
+	TCHAR** argv0 = argv;
 
-	int drive = 0;
-	if (pdbname[0] && pdbname[1] == ':')
-	{
-		if (pdbname[2] == '\\' || pdbname[2] == '/')
-			return;
-		drive = T_toupper (pdbname[0]) - 'A' + 1;
-		pdbname += 2;
-	}
-	else
+	CoInitialize(nullptr);
+
+	while (argc > 1 && argv[1][0] == '-')
 	{
-		drive = _getdrive();
+		argv++;
+		argc--;
+		if (argv[0][1] == '-' && !argv[0][2])
+			break;
+		if (T_strncmp(argv[0], TEXT("--batch="), 8) == 0 && argv[0][8])
+			batchFile = argv[0] + 8;
+		else if (T_strncmp(argv[0], TEXT("--jobs="), 7) == 0 && argv[0][7])
+		{
+			jobs = (int)T_strtod(argv[0] + 7, 0);
+			if (jobs <= 0)
+				fatal("invalid number of jobs: " SARG, argv[0]);
+		}
+		else if (T_strncmp(argv[0], TEXT("--server"), 8) == 0 && (!argv[0][8] || argv[0][8] == '='))
+			serverName = argv[0][8] ? argv[0] + 9 : TEXT("");
+		else if (T_strncmp(argv[0], TEXT("--client"), 8) == 0 && (!argv[0][8] || argv[0][8] == '='))
+			clientArg = argv[0];
+		else if (T_strcmp(argv[0], TEXT("--watch")) == 0)
+			watch = true;
+		else if (const char* err = opts.parse(argv[0]))
+			fatal("%s" SARG, err, argv[0]);
 	}
 
-	if (*pdbname != '\\' && *pdbname != '/')
+	if (serverName)
 	{
-		T_getdcwd(drive, pfullname, sizeof(fullname)/sizeof(fullname[0]) - 2);
-		pfullname += T_strlen(pfullname);
-		if (pfullname[-1] != '\\')
-			*pfullname++ = '\\';
+		if (argc > 1 || argc0 > 2)
+			fatal("no other arguments expected with --server");
+		ConversionServer server;
+		if (!server.run(serverName))
+			fatal("%s", server.getLastError());
+		return 0;
 	}
-	else
+	if (clientArg && batchFile)
+		fatal("--batch cannot be combined with --client");
+	if (watch && (batchFile || clientArg))
+		fatal("--watch cannot be combined with --batch or --client");
+	if (clientArg && argc > 1)
 	{
-		*pfullname++ = 'a' - 1 + drive;
-		*pfullname++ = ':';
+		// the same command line without --client, converted by the server
+		std::vector<tstring> args;
+		for (int i = 1; i < argc0; i++)
+			if (argv0[i] != clientArg)
+				args.push_back(argv0[i]);
+		std::string message;
+		int rc = runClient(clientArg[8] ? clientArg + 9 : 0, args, message);
+		if (rc >= 0)
+		{
+			if (!message.empty())
+				printf("%s\n", message.c_str());
+			return rc;
+		}
+		printf("warning: no cv2pdb server running, converting in this process\n");
 	}
-	T_strcpy(pfullname, pdbname);
-	T_strcpy(pdbstart, fullname);
-
-	for(TCHAR*p = pdbstart; *p; p++)
-		if (*p == '/')
-			*p = '\\';
 
-	// remove relative parts "./" and "../"
-	while (TCHAR* p = T_strstr (pdbstart, TEXT("\\.\\")))
-		T_strcpy(p, p + 2);
-
-	while (TCHAR* p = T_strstr (pdbstart, TEXT("\\..\\")))
+	if (batchFile)
 	{
-		for (TCHAR* q = p - 1; q >= pdbstart; q--)
-			if (*q == '\\')
-			{
-				T_strcpy(q, p + 3);
-				break;
-			}
-	}
-}
-
-TCHAR* changeExtension(TCHAR* dbgname, const TCHAR* exename, const TCHAR* ext)
-{
-	T_strcpy(dbgname, exename);
-	TCHAR *pDot = T_strrchr(dbgname, '.');
-	if (!pDot || pDot <= T_strrchr(dbgname, '/') || pDot <= T_strrchr(dbgname, '\\'))
-		T_strcat(dbgname, ext);
-	else
-		T_strcpy(pDot, ext);
-	return dbgname;
-}
-
-int T_main(int argc, TCHAR* argv[])
-{
-	double Dversion = 2.072;
-	const TCHAR* pdbref = 0;
-	bool debug = false;
-
-	CoInitialize(nullptr);
-
-	while (argc > 1 && argv[1][0] == '-')
-	{
-		argv++;
-		argc--;
-		if (argv[0][1] == '-')
-			break;
-		if (argv[0][1] == 'D')
-			Dversion = T_strtod(argv[0] + 2, 0);
-		else if (argv[0][1] == 'C')
-			Dversion = 0;
-		else if (argv[0][1] == 'n')
-			demangleSymbols = false;
-		else if (argv[0][1] == 'e')
-			useTypedefEnum = true;
-		else if (argv[0][1] == 'd' && argv[0][2] == 'e' && argv[0][3] == 'b') // deb[ug]
-			debug = true;
-		else if (argv[0][1] == 's' && argv[0][2])
-			dotReplacementChar = (char)argv[0][2];
-		else if (argv[0][1] == 'p' && argv[0][2])
-			pdbref = argv[0] + 2;
-		else
-			fatal("unknown option: " SARG, argv[0]);
+		if (argc > 1)
+			fatal("no image arguments expected with --batch");
+		if (opts.statsFile || opts.traceFile)
+			fatal("--stats and --trace cannot be combined with --batch");
+		BatchConverter batch;
+		batch.options = opts;
+		batch.jobs = jobs;
+		int failures = batch.run(batchFile);
+		if (failures < 0)
+			fatal("%s", batch.getLastError());
+		return failures ? 1 : 0;
 	}
 
 	if (argc < 2)
@@ -156,110 +114,37 @@ int T_main(int argc, TCHAR* argv[])
 		printf("License for redistribution is given by the Artistic License 2.0\n");
 		printf("see file LICENSE for further details\n");
 		printf("\n");
-		printf("usage: " SARG " [-D<version>|-C|-n|-e|-s<C>|-p<embedded-pdb>] <exe-file> [new-exe-file] [pdb-file]\n", argv[0]);
+		printf("usage: " SARG " [-D<version>|-C|-n|-e|-s<C>|-p<embedded-pdb>|-a<addr>[-<end>]|-f<source-file>|--stats=<file>|--trace=<file>|--max-memory=<size>] <exe-file> [new-exe-file] [pdb-file]\n", argv[0]);
+		printf("       " SARG " [options] --batch=<list-file> [--jobs=<n>]\n", argv[0]);
+		printf("       " SARG " --server[=<name>]\n", argv[0]);
+		printf("       " SARG " --client[=<name>] [options] <exe-file> [new-exe-file] [pdb-file]\n", argv[0]);
+		printf("       " SARG " --watch [options] <exe-file> [new-exe-file] [pdb-file]\n", argv[0]);
+		printf("\n");
+		printf("  -a and -f restrict the conversion of DWARF debug information to the compilation\n");
+		printf("  units covering the given (hexadecimal) address range or source file\n");
+		printf("  --stats writes phase timings and counters of the conversion as JSON to <file>\n");
+		printf("  --trace writes the phases and the work per compilation unit as Chrome trace events\n");
+		printf("  --max-memory limits the memory of a conversion to about <size> (MB, or with suffix K or G)\n");
+		printf("  by moving type and symbol records to temporary files, also the memory budget of --batch\n");
+		printf("  --batch converts the images listed in <list-file>, one line of arguments per image,\n");
+		printf("  using <n> threads (default: number of processors)\n");
+		printf("  --server keeps converting images sent by --client, reusing the results of previous\n");
+		printf("  conversions; the client converts in-process if no server is running\n");
+		printf("  --watch converts <exe-file> again whenever the linker has rewritten it\n");
 		return -1;
 	}
 
-	PEImage exe, dbg, *img = NULL;
-	TCHAR dbgname[MAX_PATH];
-
-	if (!exe.loadExe(argv[1]))
-		fatal(SARG ": %s", argv[1], exe.getLastError());
-	if (exe.countCVEntries() || exe.hasDWARF())
-		img = &exe;
-	else
-	{
-		// try DBG file alongside executable
-		changeExtension(dbgname, argv[1], TEXT(".dbg"));
-		struct _stat buffer;
-		if (T_stat(dbgname, &buffer) != 0)
-			fatal(SARG ": no codeview debug entries found", argv[1]);
-		if (!dbg.loadExe(dbgname))
-			fatal(SARG ": %s", dbgname, dbg.getLastError());
-		if (dbg.countCVEntries() == 0)
-			fatal(SARG ": no codeview debug entries found", dbgname);
-
-		img = &dbg;
-	}
-
-	CV2PDB cv2pdb(*img);
-	cv2pdb.Dversion = Dversion;
-	cv2pdb.debug = debug;
-	cv2pdb.initLibraries();
-
-	TCHAR* outname = argv[1];
-	if (argc > 2 && argv[2][0])
-		outname = argv[2];
-
-	TCHAR pdbname[260];
-	if (argc > 3)
-		T_strcpy (pdbname, argv[3]);
-	else
+	const TCHAR* outname = argc > 2 && argv[2][0] ? argv[2] : 0;
+	const TCHAR* pdbname = argc > 3 ? argv[3] : 0;
+	if (watch)
 	{
-		T_strcpy (pdbname, outname);
-		TCHAR *pDot = T_strrchr (pdbname, '.');
-		if (!pDot || pDot <= T_strrchr (pdbname, '/') || pDot <= T_strrchr (pdbname, '\\'))
-			T_strcat (pdbname, TEXT(".pdb"));
-		else
-			T_strcpy (pDot, TEXT(".pdb"));
+		ImageWatcher watcher;
+		watcher.options = opts;
+		if (!watcher.run(argv[1], outname, pdbname))
+			fatal("%s", watcher.getLastError());
+		return 0;
 	}
-	makefullpath(pdbname);
-
-	T_unlink(pdbname);
-
-	if(!cv2pdb.openPDB(pdbname, pdbref))
-		fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-	if(exe.hasDWARF())
-	{
-		if(!exe.relocateDebugLineInfo(0x400000))
-			fatal(SARG ": %s", argv[1], cv2pdb.getLastError());
-
-		if(!cv2pdb.createDWARFModules())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if(!cv2pdb.addDWARFTypes())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if(!cv2pdb.addDWARFLines())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.addDWARFPublics())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.writeDWARFImage(outname))
-			fatal(SARG ": %s", outname, cv2pdb.getLastError());
-	}
-	else
-	{
-		if (!cv2pdb.initSegMap())
-			fatal(SARG ": %s", argv[1], cv2pdb.getLastError());
-
-		if (!cv2pdb.initGlobalSymbols())
-			fatal(SARG ": %s", argv[1], cv2pdb.getLastError());
-
-		if (!cv2pdb.initGlobalTypes())
-			fatal(SARG ": %s", argv[1], cv2pdb.getLastError());
-
-		if (!cv2pdb.createModules())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.addTypes())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.addSymbols())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.addSrcLines())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!cv2pdb.addPublics())
-			fatal(SARG ": %s", pdbname, cv2pdb.getLastError());
-
-		if (!exe.isDBG())
- 			if (!cv2pdb.writeImage(outname, exe))
-				fatal(SARG ": %s", outname, cv2pdb.getLastError());
-	}
-
+	if (!converter.convert(argv[1], outname, pdbname))
+		fatal("%s", converter.getLastError());
 	return 0;
 }
@@ -10,6 +10,7 @@
 #include <windows.h>
 #include "packages/Microsoft.VisualStudio.Setup.Configuration.Native.1.16.30/lib/native/include/Setup.Configuration.h"
 #include <fstream>
+#include <mutex>
 #include <string>
 
 _COM_SMARTPTR_TYPEDEF(ISetupConfiguration, __uuidof(ISetupConfiguration));
@@ -28,6 +29,7 @@ char* mspdb120_dll = "mspdb120.dll";
 char* mspdb140_dll = "mspdb140.dll";
 // char* mspdb110shell_dll = "mspdbst.dll"; // the VS 2012 Shell uses this file instead of mspdb110.dll, but is missing mspdbsrv.exe
 
+// version of the DLL loaded, the same for all conversions of the process
 int mspdb::vsVersion = 8;
 
 // verify mspdbsrv.exe is found in the same path
@@ -368,8 +370,12 @@ bool exitMsPdb()
 
 mspdb::PDB* CreatePDB(const wchar_t* pdbname)
 {
-	if (!initMsPdb ())
-		return 0;
+	static std::mutex initLock; // conversions on other threads
+	{
+		std::lock_guard<std::mutex> lock(initLock);
+		if (!initMsPdb ())
+			return 0;
+	}
 
 	mspdb::PDB* pdb = 0;
 	long data[194] = { 193, 0 };
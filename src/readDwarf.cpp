@@ -1,5 +1,7 @@
 #include "readDwarf.h"
+#include "cache.h"
 #include <assert.h>
+#include <algorithm>
 #include <unordered_map>
 #include <array>
 #include <windows.h>
@@ -7,6 +9,7 @@
 #include "PEImage.h"
 #include "dwarf.h"
 #include "mspdb.h"
+#include "stats.h"
 extern "C" {
 	#include "mscvpdb.h"
 }
@@ -38,9 +41,31 @@ static Location mkRegRel(int reg, int off)
 	return l;
 }
 
+// number of stack entries used by operation OP of a location expression
+static int requiredOperands(int op)
+{
+	switch (op)
+	{
+		case DW_OP_plus_uconst: case DW_OP_abs: case DW_OP_neg: case DW_OP_not:
+		case DW_OP_dup: case DW_OP_drop: case DW_OP_bra:
+			return 1;
+		case DW_OP_plus: case DW_OP_minus: case DW_OP_mul: case DW_OP_and:
+		case DW_OP_div: case DW_OP_mod: case DW_OP_shl: case DW_OP_shr: case DW_OP_shra:
+		case DW_OP_or: case DW_OP_xor: case DW_OP_eq: case DW_OP_ge: case DW_OP_gt:
+		case DW_OP_le: case DW_OP_lt: case DW_OP_ne: case DW_OP_over: case DW_OP_swap:
+			return 2;
+		case DW_OP_rot:
+			return 3;
+		default:
+			return 0;
+	}
+}
+
 Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const Location* frameBase, int at)
 {
 	static Location invalid = { Location::Invalid };
+	const int kMaxStack = 256;
+	const int kMaxSteps = 1024; // branches can create loops
 
 	if (attr.type == Const)
 		return mkAbs(attr.cons);
@@ -51,12 +76,12 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 	byte*p = attr.expr.ptr;
 	byte*end = attr.expr.ptr + attr.expr.len;
 
-	Location stack[256];
+	Location stack[kMaxStack];
 	int stackDepth = 0;
     if (at == DW_AT_data_member_location)
         stack[stackDepth++] = mkAbs(0);
 
-	for (;;)
+	for (int steps = 0; ; steps++)
 	{
 		if (p >= end)
 			break;
@@ -65,6 +90,10 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 		if (op == 0)
 			break;
 
+		// every operation pushes at most one entry
+		if (stackDepth < requiredOperands(op) || stackDepth >= kMaxStack || steps >= kMaxSteps)
+			return invalid;
+
 		switch (op)
 		{
 			case DW_OP_reg0:  case DW_OP_reg1:  case DW_OP_reg2:  case DW_OP_reg3:
@@ -202,6 +231,8 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 				Location& op2 = stack[stackDepth - 2];
 				if (!op1.is_abs() || !op2.is_abs()) // can't combine unless both are constants
 					return invalid;
+				if ((op == DW_OP_div || op == DW_OP_mod) && (op1.off == 0 || op1.off == -1))
+					return invalid; // avoid division by zero and overflow
 				switch (op)
 				{
 					case DW_OP_div:   op2.off = op2.off / op1.off; break;
@@ -239,7 +270,14 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 			case DW_OP_dup:   stack[stackDepth] = stack[stackDepth - 1]; stackDepth++; break;
 			case DW_OP_drop:  stackDepth--; break;
 			case DW_OP_over:  stack[stackDepth] = stack[stackDepth - 2]; stackDepth++; break;
-			case DW_OP_pick:  stack[stackDepth++] = stack[*p]; break;
+			case DW_OP_pick:
+			{
+				int idx = *p++;
+				if (idx >= stackDepth)
+					return invalid;
+				stack[stackDepth] = stack[stackDepth - 1 - idx];
+				stackDepth++;
+			}   break;
 			case DW_OP_swap:  { Location tmp = stack[stackDepth - 1]; stack[stackDepth - 1] = stack[stackDepth - 2]; stack[stackDepth - 2] = tmp; } break;
 			case DW_OP_rot:   { Location tmp = stack[stackDepth - 1]; stack[stackDepth - 1] = stack[stackDepth - 2]; stack[stackDepth - 2] = stack[stackDepth - 3]; stack[stackDepth - 3] = tmp; } break;
 
@@ -249,7 +287,9 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 
 			case DW_OP_skip:
 			{
-				unsigned off = RD2(p);
+				short off = (short)RD2(p);
+				if (off < attr.expr.ptr - p || off > end - p)
+					return invalid;
 				p = p + off;
 			}   break;
 
@@ -258,9 +298,11 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 				Location& op1 = stack[stackDepth - 1];
 				if (!op1.is_abs())
 					return invalid;
+				short off = (short)RD2(p);
 				if (op1.off != 0)
 				{
-					unsigned off = RD2(p);
+					if (off < attr.expr.ptr - p || off > end - p)
+						return invalid;
 					p = p + off;
 				}
 				--stackDepth;
@@ -286,38 +328,41 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 			default:
 				return invalid;
 		}
+		if (p > end)
+			return invalid; // operand beyond the end of the expression
 	}
 
-	assert(stackDepth > 0);
+	if (stackDepth <= 0)
+		return invalid;
 	return stack[0];
 }
 
-void mergeAbstractOrigin(DWARF_InfoData& id, DWARF_CompilationUnit* cu)
+// merge the attributes of the DIE at REF into ID, DEPTH limits cyclic references
+static void mergeReferenced(DWARF_InfoData& id, DWARF_CompilationUnit* cu, byte* ref, int depth)
 {
-	DIECursor specCursor(cu, id.abstract_origin);
+	if (depth > 16)
+		return;
+	DIECursor specCursor(cu, ref);
 	DWARF_InfoData idspec;
-	specCursor.readNext(idspec);
+	if (!specCursor.readNext(idspec))
+		return;
 	// assert seems invalid, combination DW_TAG_member and DW_TAG_variable found in the wild
 	// assert(id.tag == idspec.tag);
 	if (idspec.abstract_origin)
-		mergeAbstractOrigin(idspec, cu);
+		mergeReferenced(idspec, cu, idspec.abstract_origin, depth + 1);
 	if (idspec.specification)
-		mergeSpecification(idspec, cu);
+		mergeReferenced(idspec, cu, idspec.specification, depth + 1);
 	id.merge(idspec);
 }
 
+void mergeAbstractOrigin(DWARF_InfoData& id, DWARF_CompilationUnit* cu)
+{
+	mergeReferenced(id, cu, id.abstract_origin, 0);
+}
+
 void mergeSpecification(DWARF_InfoData& id, DWARF_CompilationUnit* cu)
 {
-	DIECursor specCursor(cu, id.specification);
-	DWARF_InfoData idspec;
-	specCursor.readNext(idspec);
-	//assert seems invalid, combination DW_TAG_member and DW_TAG_variable found in the wild
-	//assert(id.tag == idspec.tag);
-	if (idspec.abstract_origin)
-		mergeAbstractOrigin(idspec, cu);
-	if (idspec.specification)
-		mergeSpecification(idspec, cu);
-	id.merge(idspec);
+	mergeReferenced(id, cu, id.specification, 0);
 }
 
 // declare hasher for pair<T1,T2>
@@ -335,33 +380,388 @@ namespace std
 
 typedef std::unordered_map<std::pair<unsigned, unsigned>, byte*> abbrevMap_t;
 
-static PEImage* img;
-static abbrevMap_t abbrevMap;
+// context of the cursors set by setContext, per thread so images can be converted concurrently
+static thread_local PEImage* img;
+static thread_local abbrevMap_t abbrevMap;
+static thread_local std::unordered_map<DWARF_CompilationUnit*, DWARF_UnitBases> unitBasesMap;
+static thread_local DWARF_CompilationUnit* lastBasesCU;
+static thread_local const DWARF_UnitBases* lastBases;
+static thread_local std::vector<DWARF_CompilationUnit*> units;
+static thread_local std::unordered_map<unsigned long long, byte*> typeSignatures;
+static thread_local DIETable* dieTable;
+static thread_local DWARF_AbbrevCache* abbrevCache;
+static thread_local ContentHash abbrevHash;
+
+static void addUnits(char* sec, unsigned long length)
+{
+	unsigned long off = 0;
+	while (off + sizeof(DWARF_CompilationUnit) <= length)
+	{
+		DWARF_CompilationUnit* cu = (DWARF_CompilationUnit*)(sec + off);
+		if (cu->unit_length > length - off - sizeof(cu->unit_length))
+			break; // truncated unit (or DWARF-64, which is not supported)
+		if (cu->version < 2 || cu->version > 5 || cu->getHeaderSize() > (int)(sizeof(cu->unit_length) + cu->unit_length))
+		{
+			warning("skipping DWARF unit with unsupported version %d at offset 0x%lx", cu->version, off);
+			off += sizeof(cu->unit_length) + cu->unit_length;
+			continue;
+		}
+		units.push_back(cu);
 
-void DIECursor::setContext(PEImage* img_)
+		byte ut = cu->getUnitType();
+		if (ut == DW_UT_type || ut == DW_UT_split_type)
+		{
+			// type signature and offset of the type DIE follow the common header
+			byte* p = (byte*)cu + (cu->version >= 5 ? 12 : sizeof(DWARF_CompilationUnit));
+			unsigned long long sig = RD8(p);
+			unsigned int type_offset = cu->isDWARF64() ? (unsigned int)RD8(p) : RD4(p);
+			typeSignatures.insert(std::make_pair(sig, (byte*)cu + type_offset));
+		}
+		off += sizeof(cu->unit_length) + cu->unit_length;
+	}
+}
+
+void DIECursor::setContext(PEImage* img_, DWARF_AbbrevCache* cache)
 {
+	if (abbrevCache && img && img->debug_abbrev)
+	{
+		abbrevCache->section = abbrevHash;
+		abbrevCache->abbrevs.clear();
+		for (abbrevMap_t::iterator it = abbrevMap.begin(); it != abbrevMap.end(); ++it)
+			abbrevCache->abbrevs.push_back(std::make_pair(it->first, (unsigned)(it->second - (byte*)img->debug_abbrev)));
+	}
+
 	img = img_;
 	abbrevMap.clear();
+	abbrevCache = cache;
+	if (abbrevCache && img && img->debug_abbrev)
+	{
+		abbrevHash = hashContent(img->debug_abbrev, img->debug_abbrev_length);
+		if (abbrevHash == abbrevCache->section)
+			for (size_t i = 0; i < abbrevCache->abbrevs.size(); i++)
+				abbrevMap.insert(std::make_pair(abbrevCache->abbrevs[i].first,
+				                                (byte*)img->debug_abbrev + abbrevCache->abbrevs[i].second));
+	}
+	unitBasesMap.clear();
+	lastBasesCU = 0;
+	lastBases = 0;
+
+	units.clear();
+	typeSignatures.clear();
+	cacheUnit(0);
+	if (img)
+	{
+		addUnits(img->debug_info, img->debug_info_length);
+		addUnits(img->debug_types, img->debug_types_length);
+		std::sort(units.begin(), units.end());
+	}
+}
+
+const std::vector<DWARF_CompilationUnit*>& DIECursor::getUnits()
+{
+	return units;
+}
+
+DWARF_CompilationUnit* DIECursor::findUnit(byte* ptr)
+{
+	std::vector<DWARF_CompilationUnit*>::iterator it =
+		std::upper_bound(units.begin(), units.end(), (DWARF_CompilationUnit*)ptr);
+	if (it == units.begin())
+		return 0;
+	DWARF_CompilationUnit* cu = *--it;
+	return ptr < cu->getEnd() ? cu : 0;
+}
+
+byte* DIECursor::findTypeSignature(unsigned long long signature)
+{
+	std::unordered_map<unsigned long long, byte*>::iterator it = typeSignatures.find(signature);
+	return it != typeSignatures.end() ? it->second : 0;
+}
+
+byte DWARF_CompilationUnit::getUnitType() const
+{
+	if (version >= 5)
+		return ((byte*)this)[6];
+	if ((char*)this >= img->debug_types && (char*)this < img->debug_types + img->debug_types_length)
+		return DW_UT_type; // DWARF4 .debug_types
+	return DW_UT_compile;
 }
 
+int DWARF_CompilationUnit::getHeaderSize() const
+{
+	if (version < 5)
+		return sizeof(DWARF_CompilationUnit) + (getUnitType() == DW_UT_type ? 8 + 4 : 0);
+	switch (getUnitType())
+	{
+		case DW_UT_skeleton:
+		case DW_UT_split_compile:
+			return 12 + 8; // dwo_id
+		case DW_UT_type:
+		case DW_UT_split_type:
+			return 12 + 8 + 4; // type_signature, type_offset
+		default:
+			return 12;
+	}
+}
+
+// Skip the value of an attribute with form FORM, return false for unknown forms
+static bool skipForm(DWARF_CompilationUnit* cu, int form, byte* &ptr, byte* &abbrev)
+{
+	for (;;)
+	{
+		switch (form)
+		{
+			case DW_FORM_flag_present:  return true;
+			case DW_FORM_implicit_const: SLEB128(abbrev); return true;
+			case DW_FORM_addr:          ptr += cu->getAddressSize(); return true;
+			case DW_FORM_flag:
+			case DW_FORM_data1:
+			case DW_FORM_ref1:
+			case DW_FORM_strx1:
+			case DW_FORM_addrx1:        ptr += 1; return true;
+			case DW_FORM_data2:
+			case DW_FORM_ref2:
+			case DW_FORM_strx2:
+			case DW_FORM_addrx2:        ptr += 2; return true;
+			case DW_FORM_strx3:
+			case DW_FORM_addrx3:        ptr += 3; return true;
+			case DW_FORM_data4:
+			case DW_FORM_ref4:
+			case DW_FORM_ref_sup4:
+			case DW_FORM_strx4:
+			case DW_FORM_addrx4:        ptr += 4; return true;
+			case DW_FORM_data8:
+			case DW_FORM_ref8:
+			case DW_FORM_ref_sig8:
+			case DW_FORM_ref_sup8:      ptr += 8; return true;
+			case DW_FORM_data16:        ptr += 16; return true;
+			case DW_FORM_strp:
+			case DW_FORM_line_strp:
+			case DW_FORM_strp_sup:
+			case DW_FORM_sec_offset:
+			case DW_FORM_ref_addr:      ptr += cu->refSize(); return true;
+			case DW_FORM_sdata:
+			case DW_FORM_udata:
+			case DW_FORM_ref_udata:
+			case DW_FORM_strx:
+			case DW_FORM_addrx:
+			case DW_FORM_loclistx:
+			case DW_FORM_rnglistx:      LEB128(ptr); return true;
+			case DW_FORM_string:        ptr += strlen((const char*)ptr) + 1; return true;
+			case DW_FORM_block1:        ptr += 1 + *ptr; return true;
+			case DW_FORM_block2:        { unsigned len = RD2(ptr); ptr += len; return true; }
+			case DW_FORM_block4:        { unsigned len = RD4(ptr); ptr += len; return true; }
+			case DW_FORM_block:
+			case DW_FORM_exprloc:       { unsigned len = LEB128(ptr); ptr += len; return true; }
+			case DW_FORM_indirect:      form = LEB128(ptr); continue;
+			default:                    return false;
+		}
+	}
+}
+
+const DWARF_UnitBases* DIECursor::getUnitBases(DWARF_CompilationUnit* cu)
+{
+	if (cu == lastBasesCU)
+		return lastBases;
+
+	std::unordered_map<DWARF_CompilationUnit*, DWARF_UnitBases>::iterator it = unitBasesMap.find(cu);
+	if (it == unitBasesMap.end())
+	{
+		// without the base attributes, the tables start after the 8 byte section header
+		// (12 byte for the offset tables in .debug_rnglists/.debug_loclists)
+		unsigned long str_offsets_base = 8, addr_base = 8;
+		unsigned long rnglists_base = 12, loclists_base = 12;
+
+		byte* ptr = cu->getFirstDIE();
+		if (cu->version >= 5 && ptr < cu->getEnd())
+		{
+			int code = LEB128(ptr);
+			byte* abbrev = code ? DIECursor(cu, ptr, 0).getDWARFAbbrev(cu->getAbbrevOffset(), code) : 0;
+			if (abbrev)
+			{
+				LEB128(abbrev); // tag
+				abbrev++; // hasChild
+				for (;;)
+				{
+					unsigned int attr, form;
+					LEB128x2(abbrev, attr, form);
+					if ((attr == 0 && form == 0) || ptr > cu->getEnd())
+						break;
+					if (form == DW_FORM_sec_offset)
+					{
+						unsigned long off = (unsigned long) RDsize(ptr, cu->refSize());
+						switch (attr)
+						{
+							case DW_AT_str_offsets_base: str_offsets_base = off; break;
+							case DW_AT_addr_base:        addr_base = off; break;
+							case DW_AT_rnglists_base:    rnglists_base = off; break;
+							case DW_AT_loclists_base:    loclists_base = off; break;
+						}
+					}
+					else if (!skipForm(cu, form, ptr, abbrev))
+						break;
+				}
+			}
+		}
+
+		DWARF_UnitBases bases;
+		bases.str_offsets_base = str_offsets_base;
+		bases.addr_base = addr_base;
+		bases.rnglists_base = rnglists_base;
+		bases.loclists_base = loclists_base;
+		bases.str_offsets_count = tableEntries(img->debug_str_offsets, img->debug_str_offsets_length, str_offsets_base, cu->refSize());
+		bases.addr_count = tableEntries(img->debug_addr, img->debug_addr_length, addr_base, cu->getAddressSize());
+		bases.rnglists_count = tableEntries(img->debug_rnglists, img->debug_rnglists_length, rnglists_base, cu->refSize());
+		bases.loclists_count = tableEntries(img->debug_loclists, img->debug_loclists_length, loclists_base, cu->refSize());
+		it = unitBasesMap.insert(std::make_pair(cu, bases)).first;
+	}
+	lastBasesCU = cu;
+	lastBases = &it->second;
+	return lastBases;
+}
 
 DIECursor::DIECursor(DWARF_CompilationUnit* cu_, byte* ptr_)
 {
+	level = 0;
+	if (ptr_ < (byte*)cu_ || ptr_ >= cu_->getEnd())
+	{
+		// reference into another unit, e.g. a type unit
+		if (DWARF_CompilationUnit* unit = findUnit(ptr_))
+			cu_ = unit;
+		else
+			level = -1; // not inside any unit, nothing to read
+	}
 	cu = cu_;
+	bases = getUnitBases(cu_);
+	ptr = ptr_;
+	hasChild = false;
+	sibling = 0;
+	table = 0;
+	index = -1;
+	if (dieTable && dieTable->cu == cu && (index = dieTable->find(ptr)) >= 0)
+		table = dieTable;
+}
+
+DIECursor::DIECursor(DWARF_CompilationUnit* cu_, byte* ptr_, const DWARF_UnitBases* bases_)
+{
+	cu = cu_;
+	bases = bases_;
 	ptr = ptr_;
 	level = 0;
 	hasChild = false;
 	sibling = 0;
+	table = 0;
+	index = -1;
+}
+
+int DIETable::find(byte* p) const
+{
+	std::vector<byte*>::const_iterator it = std::lower_bound(entryPtr.begin(), entryPtr.end(), p);
+	if (it != entryPtr.end() && *it == p)
+		return (int)(it - entryPtr.begin());
+	return p == end ? (int)entryPtr.size() : -1;
+}
+
+void DIECursor::cacheUnit(DWARF_CompilationUnit* cu)
+{
+	delete dieTable;
+	dieTable = 0;
+	if (!cu)
+		return;
+
+	DIETable* t = new DIETable;
+	t->cu = cu;
+	size_t estimate = cu->unit_length / 8; // typical average size of an entry
+	t->entryPtr.reserve(estimate);
+	t->nextSibling.reserve(estimate);
+	t->abbrev.reserve(estimate);
+	std::vector<int> parents; // entries with children not yet terminated
+	DIECursor cursor(cu, cu->getFirstDIE());
+	DWARF_InfoData id;
+	while (cursor.ptr < cu->getEnd())
+	{
+		int idx = (int)t->entryPtr.size();
+		byte* p = cursor.ptr;
+		if (LEB128(p) == 0)
+		{
+			// null entry, terminates the children of the innermost parent
+			id.entryPtr = cursor.ptr;
+			id.abbrev = 0;
+			cursor.ptr = p;
+			if (!parents.empty())
+			{
+				t->nextSibling[parents.back()] = idx + 1;
+				parents.pop_back();
+			}
+		}
+		else
+		{
+			cursor.level = 0;
+			cursor.hasChild = false;
+			if (!cursor.readNext(id, true))
+				break; // corrupt entry, cursors stop here as well
+			if (id.hasChild)
+				parents.push_back(idx);
+		}
+		t->entryPtr.push_back(id.entryPtr);
+		t->abbrev.push_back(id.abbrev);
+		t->nextSibling.push_back(idx + 1);
+	}
+	t->end = cursor.ptr;
+	// entries without terminating null entry extend to the end of the table
+	for (size_t i = 0; i < parents.size(); i++)
+		t->nextSibling[parents[i]] = (int)t->entryPtr.size();
+	dieTable = t;
 }
 
 
+// string at offset OFF of .debug_str, NULL if outside of the section
+static inline const char* readStr(unsigned long long off)
+{
+	return off < img->debug_str_length ? img->debug_str + off : 0;
+}
+
+inline const char* DIECursor::readStrx(unsigned idx)
+{
+	uint64_t off;
+	if (!readTableEntry(img->debug_str_offsets, bases->str_offsets_base, bases->str_offsets_count, idx, cu->refSize(), off))
+		return 0;
+	return readStr(off);
+}
+
+inline unsigned long DIECursor::readAddrx(unsigned idx)
+{
+	uint64_t addr;
+	if (!readTableEntry(img->debug_addr, bases->addr_base, bases->addr_count, idx, cu->getAddressSize(), addr))
+		return 0;
+	return (unsigned long)addr;
+}
+
+inline unsigned long DIECursor::readListx(const char* sec, unsigned long base, unsigned long count, unsigned idx)
+{
+	// offsets in the table are relative to the table itself
+	uint64_t off;
+	if (!readTableEntry(sec, base, count, idx, cu->refSize(), off))
+		return ~0ul;
+	return base + (unsigned long)off;
+}
+
 void DIECursor::gotoSibling()
 {
-	if (sibling)
+	if (table && hasChild)
+	{
+		// the last read entry is the one before INDEX
+		index = table->nextSibling[index - 1];
+		ptr = index < (int)table->entryPtr.size() ? table->entryPtr[index] : table->end;
+		hasChild = false;
+	}
+	else if (sibling)
 	{
 		// use sibling pointer, if available
 		ptr = sibling;
 		hasChild = false;
+		if (table && (index = table->find(ptr)) < 0)
+			table = 0;
 	}
 	else if (hasChild)
 	{
@@ -372,7 +772,8 @@ void DIECursor::gotoSibling()
 		DWARF_InfoData dummy;
 		// read untill we pop back to the level we were at
 		while (level > currLevel)
-			readNext(dummy, true);
+			if (!readNext(dummy, true) && (level < 0 || ptr >= cu->getEnd()))
+				break; // truncated or corrupt unit
 	}
 }
 
@@ -411,12 +812,17 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 		if (level == -1)
 			return false; // we were already at the end of the subtree
 
-		if (ptr >= ((byte*)cu + sizeof(cu->unit_length) + cu->unit_length))
+		if (ptr >= cu->getEnd())
 			return false; // root of the tree does not have a null terminator, but we know the length
 
+		if (table && index >= (int)table->entryPtr.size())
+			table = 0; // beyond the entries that could be read, report errors as usual
+
 		id.entryPtr = ptr;
 		id.entryOff = ptr - (byte*)cu;
 		id.code = LEB128(ptr);
+		if (table)
+			index++;
 		if (id.code == 0)
 		{
 			--level; // pop up one level
@@ -431,43 +837,70 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 		break;
 	}
 
-	byte* abbrev = getDWARFAbbrev(cu->debug_abbrev_offset, id.code);
-	assert(abbrev);
+	byte* abbrev = table ? table->abbrev[index - 1] : getDWARFAbbrev(cu->getAbbrevOffset(), id.code);
 	if (!abbrev)
+	{
+		level = -1; // corrupt abbreviation code
 		return false;
+	}
+	byte* end = cu->getEnd();
+	byte* abbrevEnd = (byte*)img->debug_abbrev + img->debug_abbrev_length;
 
 	id.abbrev = abbrev;
 	id.tag = LEB128(abbrev);
 	id.hasChild = *abbrev++;
 
-	int attr, form;
+	unsigned int attr, form;
 	for (;;)
 	{
-		attr = LEB128(abbrev);
-		form = LEB128(abbrev);
+		LEB128x2(abbrev, attr, form);
 
 		if (attr == 0 && form == 0)
 			break;
+		if (abbrev > abbrevEnd)
+		{
+			level = -1; // unterminated abbreviation
+			return false;
+		}
 
-		while (form == DW_FORM_indirect)
+		while (form == DW_FORM_indirect && ptr < end)
 			form = LEB128(ptr);
 
 		DWARF_Attribute a;
 		switch (form)
 		{
-			case DW_FORM_addr:           a.type = Addr; a.addr = (unsigned long)RDsize(ptr, cu->address_size); break;
-			case DW_FORM_block:          a.type = Block; a.block.len = LEB128(ptr); a.block.ptr = ptr; ptr += a.block.len; break;
-			case DW_FORM_block1:         a.type = Block; a.block.len = *ptr++;      a.block.ptr = ptr; ptr += a.block.len; break;
-			case DW_FORM_block2:         a.type = Block; a.block.len = RD2(ptr);   a.block.ptr = ptr; ptr += a.block.len; break;
-			case DW_FORM_block4:         a.type = Block; a.block.len = RD4(ptr);   a.block.ptr = ptr; ptr += a.block.len; break;
+			case DW_FORM_addr:           a.type = Addr; a.addr = (unsigned long)RDsize(ptr, cu->getAddressSize()); break;
+			case DW_FORM_addrx:          a.type = Addr; a.addr = readAddrx(LEB128(ptr)); break;
+			case DW_FORM_addrx1:         a.type = Addr; a.addr = readAddrx(*ptr++); break;
+			case DW_FORM_addrx2:         a.type = Addr; a.addr = readAddrx(RD2(ptr)); break;
+			case DW_FORM_addrx3:         a.type = Addr; a.addr = readAddrx((unsigned)RDsize(ptr, 3)); break;
+			case DW_FORM_addrx4:         a.type = Addr; a.addr = readAddrx(RD4(ptr)); break;
+			case DW_FORM_block:          a.type = Block; a.block.len = LEB128(ptr); break;
+			case DW_FORM_block1:         a.type = Block; a.block.len = *ptr++;      break;
+			case DW_FORM_block2:         a.type = Block; a.block.len = RD2(ptr);   break;
+			case DW_FORM_block4:         a.type = Block; a.block.len = RD4(ptr);   break;
 			case DW_FORM_data1:          a.type = Const; a.cons = *ptr++; break;
 			case DW_FORM_data2:          a.type = Const; a.cons = RD2(ptr); break;
 			case DW_FORM_data4:          a.type = Const; a.cons = RD4(ptr); break;
 			case DW_FORM_data8:          a.type = Const; a.cons = RD8(ptr); break;
 			case DW_FORM_sdata:          a.type = Const; a.cons = SLEB128(ptr); break;
 			case DW_FORM_udata:          a.type = Const; a.cons = LEB128(ptr); break;
+			case DW_FORM_data16:         a.type = Block; a.block.len = 16; break;
+			case DW_FORM_implicit_const: a.type = Const; a.cons = SLEB128(abbrev); break;
 			case DW_FORM_string:         a.type = String; a.string = (const char*)ptr; ptr += strlen(a.string) + 1; break;
-            case DW_FORM_strp:           a.type = String; a.string = (const char*)(img->debug_str + RDsize(ptr, cu->isDWARF64() ? 8 : 4)); break;
+            case DW_FORM_strp:           a.type = String; a.string = readStr(RDsize(ptr, cu->refSize())); break;
+			case DW_FORM_line_strp:
+			{
+				unsigned long long off = RDsize(ptr, cu->refSize());
+				a.type = String;
+				a.string = off < img->debug_line_str_length ? img->debug_line_str + off : 0;
+			}   break;
+			case DW_FORM_strx:           a.type = String; a.string = readStrx(LEB128(ptr)); break;
+			case DW_FORM_strx1:          a.type = String; a.string = readStrx(*ptr++); break;
+			case DW_FORM_strx2:          a.type = String; a.string = readStrx(RD2(ptr)); break;
+			case DW_FORM_strx3:          a.type = String; a.string = readStrx((unsigned)RDsize(ptr, 3)); break;
+			case DW_FORM_strx4:          a.type = String; a.string = readStrx(RD4(ptr)); break;
+			case DW_FORM_strp_sup:       a.type = Invalid; ptr += cu->refSize(); break; // supplementary object files not supported
 			case DW_FORM_flag:           a.type = Flag; a.flag = (*ptr++ != 0); break;
 			case DW_FORM_flag_present:   a.type = Flag; a.flag = true; break;
 			case DW_FORM_ref1:           a.type = Ref; a.ref = (byte*)cu + *ptr++; break;
@@ -476,60 +909,85 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 			case DW_FORM_ref8:           a.type = Ref; a.ref = (byte*)cu + RD8(ptr); break;
 			case DW_FORM_ref_udata:      a.type = Ref; a.ref = (byte*)cu + LEB128(ptr); break;
 			case DW_FORM_ref_addr:       a.type = Ref; a.ref = (byte*)img->debug_info + (cu->isDWARF64() ? RD8(ptr) : RD4(ptr)); break;
-			case DW_FORM_ref_sig8:       a.type = Invalid; ptr += 8;  break;
-			case DW_FORM_exprloc:        a.type = ExprLoc; a.expr.len = LEB128(ptr); a.expr.ptr = ptr; ptr += a.expr.len; break;
+			case DW_FORM_ref_sig8:       a.type = Ref; a.ref = findTypeSignature(RD8(ptr)); break;
+			case DW_FORM_ref_sup4:       a.type = Invalid; ptr += 4;  break;
+			case DW_FORM_ref_sup8:       a.type = Invalid; ptr += 8;  break;
+			case DW_FORM_exprloc:        a.type = ExprLoc; a.expr.len = LEB128(ptr); break;
 			case DW_FORM_sec_offset:     a.type = SecOffset;  a.sec_offset = cu->isDWARF64() ? RD8(ptr) : RD4(ptr); break;
+			case DW_FORM_rnglistx:       a.type = SecOffset;  a.sec_offset = readListx(img->debug_rnglists, bases->rnglists_base, bases->rnglists_count, LEB128(ptr)); break;
+			case DW_FORM_loclistx:       a.type = SecOffset;  a.sec_offset = readListx(img->debug_loclists, bases->loclists_base, bases->loclists_count, LEB128(ptr)); break;
 			case DW_FORM_indirect:
-			default: assert(false && "Unsupported DWARF attribute form"); return false;
+			default:
+				warning("unsupported DWARF attribute form 0x%x at offset 0x%x", form, id.entryOff);
+				level = -1; // cannot skip the value, stop reading this unit
+				return false;
+		}
+
+		if (a.type == Block || a.type == ExprLoc) // same memory layout
+		{
+			if (ptr > end || a.block.len > (unsigned)(end - ptr))
+				a.block.len = 0, ptr = end + 1;
+			a.block.ptr = ptr;
+			ptr += a.block.len;
+		}
+		if (ptr > end)
+		{
+			level = -1; // attribute beyond the end of the unit
+			return false;
+		}
+		if (a.type == Ref && a.ref)
+		{
+			// references must point to a DIE in .debug_info or .debug_types
+			if (form == DW_FORM_ref_addr
+				? a.ref >= (byte*)img->debug_info + img->debug_info_length
+				: form != DW_FORM_ref_sig8 && (a.ref < cu->getFirstDIE() || a.ref >= end))
+				a.type = Invalid;
 		}
 
 		switch (attr)
 		{
 			case DW_AT_byte_size:
-				assert(a.type == Const || a.type == Ref || a.type == ExprLoc);
 				if (a.type == Const) // TODO: other types not supported yet
 					id.byte_size = a.cons;
 				break;
-			case DW_AT_sibling:   assert(a.type == Ref); id.sibling = a.ref; break;
-			case DW_AT_encoding:  assert(a.type == Const); id.encoding = a.cons; break;
-			case DW_AT_name:      assert(a.type == String); id.name = a.string; break;
-			case DW_AT_MIPS_linkage_name: assert(a.type == String); id.linkage_name = a.string; break;
-			case DW_AT_comp_dir:  assert(a.type == String); id.dir = a.string; break;
-			case DW_AT_low_pc:    assert(a.type == Addr); id.pclo = a.addr; break;
+			case DW_AT_sibling:   if (a.type == Ref && a.ref > id.entryPtr) id.sibling = a.ref; break;
+			case DW_AT_encoding:  if (a.type == Const) id.encoding = a.cons; break;
+			case DW_AT_name:      if (a.type == String) id.name = a.string; break;
+			case DW_AT_MIPS_linkage_name: if (a.type == String) id.linkage_name = a.string; break;
+			case DW_AT_comp_dir:  if (a.type == String) id.dir = a.string; break;
+			case DW_AT_low_pc:    if (a.type == Addr) id.pclo = a.addr; break;
 			case DW_AT_high_pc:
 				if (a.type == Addr)
 					id.pchi = a.addr;
 				else if (a.type == Const)
 					id.pchi = id.pclo + a.cons;
-				else
-					assert(false);
 			    break;
 		    case DW_AT_entry_pc:
 			    if (a.type == Addr)
 				    id.pcentry = a.addr;
 			    else if (a.type == Const)
 				    id.pcentry = id.pclo + a.cons;
-			    else
-				    assert(false);
 			    break;
 			case DW_AT_ranges:
 				if (a.type == SecOffset)
 					id.ranges = a.sec_offset;
 				else if (a.type == Const)
 					id.ranges = a.cons;
-				else
-					assert(false);
 			    break;
-			case DW_AT_type:      assert(a.type == Ref); id.type = a.ref; break;
-			case DW_AT_inline:    assert(a.type == Const); id.inlined = a.cons; break;
-			case DW_AT_external:  assert(a.type == Flag); id.external = a.flag; break;
+			case DW_AT_stmt_list:
+				if (a.type == SecOffset)
+					id.stmt_list = a.sec_offset;
+				else if (a.type == Const)
+					id.stmt_list = a.cons;
+				break;
+			case DW_AT_type:      if (a.type == Ref) id.type = a.ref; break;
+			case DW_AT_inline:    if (a.type == Const) id.inlined = a.cons; break;
+			case DW_AT_external:  if (a.type == Flag) id.external = a.flag; break;
 			case DW_AT_upper_bound:
-				assert(a.type == Const || a.type == Ref || a.type == ExprLoc || a.type == Block);
 				if (a.type == Const) // TODO: other types not supported yet
 					id.upper_bound = a.cons;
 				break;
 			case DW_AT_lower_bound:
-				assert(a.type == Const || a.type == Ref || a.type == ExprLoc);
 				if (a.type == Const)
 				{
 					// TODO: other types not supported yet
@@ -537,13 +995,14 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 					id.has_lower_bound = true;
 				}
 				break;
-			case DW_AT_containing_type: assert(a.type == Ref); id.containing_type = a.ref; break;
-			case DW_AT_specification: assert(a.type == Ref); id.specification = a.ref; break;
-			case DW_AT_abstract_origin: assert(a.type == Ref); id.abstract_origin = a.ref; break;
+			case DW_AT_containing_type: if (a.type == Ref) id.containing_type = a.ref; break;
+			case DW_AT_specification: if (a.type == Ref) id.specification = a.ref; break;
+			case DW_AT_abstract_origin: if (a.type == Ref) id.abstract_origin = a.ref; break;
+			case DW_AT_signature: if (a.type == Ref) id.signature = a.ref; break;
 			case DW_AT_data_member_location: id.member_location = a; break;
 			case DW_AT_location: id.location = a; break;
 			case DW_AT_frame_base: id.frame_base = a; break;
-			case DW_AT_language: assert(a.type == Const); id.language = a.cons; break;
+			case DW_AT_language: if (a.type == Const) id.language = a.cons; break;
 			case DW_AT_const_value:
 				switch (a.type)
 				{
@@ -555,15 +1014,11 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 				// TODO: handle these
 				case String:
 				case Block:
-					break;
-
 				default:
-					assert(false);
 					break;
 				}
 				break;
 		    case DW_AT_artificial:
-				assert(a.type == Flag);
 				id.has_artificial = true;
 				id.is_artificial = true;
 				break;
@@ -572,6 +1027,7 @@ bool DIECursor::readNext(DWARF_InfoData& id, bool stopAtNull)
 
 	hasChild = id.hasChild != 0;
 	sibling = id.sibling;
+	convStats.dies++;
 
 	return true;
 }
@@ -585,9 +1041,14 @@ byte* DIECursor::getDWARFAbbrev(unsigned off, unsigned findcode)
 	abbrevMap_t::iterator it = abbrevMap.find(key);
 	if (it != abbrevMap.end())
 	{
+		convStats.abbrevHits++;
 		return it->second;
 	}
 
+	convStats.abbrevMisses++;
+	if (off >= img->debug_abbrev_length)
+		return 0;
+
 	byte* p = (byte*)img->debug_abbrev + off;
 	byte* end = (byte*)img->debug_abbrev + img->debug_abbrev_length;
 	while (p < end)
@@ -605,12 +1066,224 @@ byte* DIECursor::getDWARFAbbrev(unsigned off, unsigned findcode)
 		int hasChild = *p++;
 
 		// skip attributes
-		int attr, form;
+		unsigned int attr, form;
 		do
 		{
-			attr = LEB128(p);
-			form = LEB128(p);
-		} while (attr || form);
+			LEB128x2(p, attr, form);
+			if (form == DW_FORM_implicit_const)
+				SLEB128(p);
+		} while ((attr || form) && p < end);
 	}
 	return 0;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// accelerated name tables
+
+// read the header of a name table unit, returns the end of the unit or NULL
+static byte* readNameTableHeader(byte* &p, byte* end, int& offsize)
+{
+	if (p + 4 > end)
+		return 0;
+	unsigned long long unit_length = RD4(p);
+	offsize = 4;
+	if (unit_length == 0xffffffff)
+	{
+		if (p + 8 > end)
+			return 0;
+		unit_length = RD8(p);
+		offsize = 8;
+	}
+	if (unit_length > (unsigned long long)(end - p))
+		return 0;
+	return p + unit_length;
+}
+
+// .debug_gnu_pubnames: a list of (DIE offset, flags, name) per unit
+static void readGnuPubNames(const PEImage& img, std::vector<byte*>& dies, std::vector<byte*>& units)
+{
+	byte* p = (byte*)img.debug_gnu_pubnames;
+	byte* end = p + img.debug_gnu_pubnames_length;
+	int offsize;
+	while (byte* next = readNameTableHeader(p, end, offsize))
+	{
+		if (next - p < 2 + 2 * offsize)
+			break;
+		p += 2; // version
+		unsigned long long cu_offset = RDsize(p, offsize);
+		p += offsize; // debug_info_length
+		if (cu_offset < img.debug_info_length)
+			units.push_back((byte*)img.debug_info + cu_offset);
+
+		while (p + offsize <= next)
+		{
+			unsigned long long off = RDsize(p, offsize);
+			if (off == 0)
+				break;
+			if (p >= next)
+				break;
+			int kind = (*p++ >> 4) & 7;
+			byte* name = (byte*)memchr(p, 0, next - p);
+			if (!name)
+				break;
+			p = name + 1;
+
+			if (kind != GDB_INDEX_SYMBOL_KIND_TYPE && cu_offset + off < img.debug_info_length)
+				dies.push_back((byte*)img.debug_info + cu_offset + off);
+		}
+		p = next;
+	}
+}
+
+static bool readNameIndexValue(byte* &p, int form, int offsize, unsigned long long& val)
+{
+	switch (form)
+	{
+		case DW_FORM_flag_present: val = 1; break;
+		case DW_FORM_flag:
+		case DW_FORM_ref1:
+		case DW_FORM_data1:        val = *p++; break;
+		case DW_FORM_ref2:
+		case DW_FORM_data2:        val = RD2(p); break;
+		case DW_FORM_ref4:
+		case DW_FORM_data4:        val = RD4(p); break;
+		case DW_FORM_ref8:
+		case DW_FORM_ref_sig8:
+		case DW_FORM_data8:        val = RD8(p); break;
+		case DW_FORM_ref_udata:
+		case DW_FORM_udata:        val = LEB128(p); break;
+		case DW_FORM_sdata:        val = SLEB128(p); break;
+		case DW_FORM_strp:
+		case DW_FORM_sec_offset:   val = RDsize(p, offsize); break;
+		default:                   return false;
+	}
+	return true;
+}
+
+// DWARF5 .debug_names: hashed name index with a pool of entries described by abbreviations
+static void readDebugNames(const PEImage& img, std::vector<byte*>& dies, std::vector<byte*>& units)
+{
+	byte* p = (byte*)img.debug_names;
+	byte* end = p + img.debug_names_length;
+	int offsize;
+	for (byte* next; (next = readNameTableHeader(p, end, offsize)) != 0; p = next)
+	{
+		if (next - p < 36)
+			break;
+		unsigned version = RD2(p);
+		p += 2; // padding
+		if (version != 5)
+			continue;
+		unsigned cu_count = RD4(p);
+		unsigned local_tu_count = RD4(p);
+		unsigned foreign_tu_count = RD4(p);
+		unsigned bucket_count = RD4(p);
+		unsigned name_count = RD4(p);
+		unsigned abbrev_table_size = RD4(p);
+		unsigned augmentation_string_size = RD4(p);
+
+		unsigned long long size = augmentation_string_size
+			+ (unsigned long long)(cu_count + local_tu_count) * offsize + foreign_tu_count * 8ull
+			+ bucket_count * 4ull + (bucket_count ? name_count * 4ull : 0)
+			+ name_count * 2ull * offsize + abbrev_table_size;
+		if (size > (unsigned long long)(next - p))
+			continue;
+
+		byte* cus = p + augmentation_string_size;
+		byte* entry_offsets = cus + (cu_count + local_tu_count) * offsize + foreign_tu_count * 8
+			+ bucket_count * 4 + (bucket_count ? name_count * 4 : 0) + name_count * offsize;
+		byte* abbrevs = entry_offsets + name_count * offsize;
+		byte* pool = abbrevs + abbrev_table_size;
+
+		for (unsigned c = 0; c < cu_count; c++)
+		{
+			byte* cp = cus + c * offsize;
+			unsigned long long cu_offset = RDsize(cp, offsize);
+			if (cu_offset < img.debug_info_length)
+				units.push_back((byte*)img.debug_info + cu_offset);
+		}
+
+		std::unordered_map<unsigned, byte*> abbrevCodes;
+		for (byte* a = abbrevs; a < pool; )
+		{
+			unsigned code = LEB128(a);
+			if (code == 0)
+				break;
+			abbrevCodes[code] = a;
+			LEB128(a); // tag
+			for (unsigned idx = 1, form = 1; a < pool && (idx || form); )
+			{
+				idx = LEB128(a);
+				form = LEB128(a);
+			}
+		}
+
+		// entries of all names are stored consecutively, each list terminated by a 0 code
+		for (unsigned n = 0; n < name_count; n++)
+		{
+			byte* eo = entry_offsets + n * offsize;
+			unsigned long long off = RDsize(eo, offsize);
+			if (off >= (unsigned long long)(next - pool))
+				continue;
+			for (byte* e = pool + off; e < next; )
+			{
+				unsigned code = LEB128(e);
+				auto it = abbrevCodes.find(code);
+				if (it == abbrevCodes.end())
+					break;
+
+				byte* a = it->second;
+				int tag = LEB128(a);
+				unsigned long long cu_index = 0, die_offset = ~0ull;
+				bool in_type_unit = false, ok = true;
+				for (;;)
+				{
+					unsigned idx = LEB128(a);
+					unsigned form = LEB128(a);
+					if (idx == 0 && form == 0)
+						break;
+					unsigned long long val;
+					if (!(ok = readNameIndexValue(e, form, offsize, val)))
+						break;
+					if (idx == DW_IDX_compile_unit)
+						cu_index = val;
+					else if (idx == DW_IDX_type_unit)
+						in_type_unit = true;
+					else if (idx == DW_IDX_die_offset)
+						die_offset = val;
+				}
+				if (!ok)
+					break;
+
+				if ((tag == DW_TAG_subprogram || tag == DW_TAG_variable) && !in_type_unit
+				    && cu_index < cu_count && die_offset != ~0ull)
+				{
+					byte* cp = cus + cu_index * offsize;
+					unsigned long long cu_offset = RDsize(cp, offsize);
+					if (cu_offset + die_offset < img.debug_info_length)
+						dies.push_back((byte*)img.debug_info + cu_offset + die_offset);
+				}
+			}
+		}
+	}
+}
+
+bool readDWARFPubNames(const PEImage& img, std::vector<byte*>& dies, std::vector<byte*>& units)
+{
+	dies.clear();
+	units.clear();
+	if (!img.debug_info || (!img.debug_names && !img.debug_gnu_pubnames))
+		return false;
+	// objects with different compilers or options can be linked together
+	if (img.debug_names)
+		readDebugNames(img, dies, units);
+	if (img.debug_gnu_pubnames)
+		readGnuPubNames(img, dies, units);
+
+	// names of the same DIE can appear multiple times, e.g. as linkage name
+	std::sort(dies.begin(), dies.end());
+	dies.erase(std::unique(dies.begin(), dies.end()), dies.end());
+	std::sort(units.begin(), units.end());
+	units.erase(std::unique(units.begin(), units.end()), units.end());
+	return true;
+}
@@ -1,14 +1,24 @@
 #ifndef __READDWARF_H__
 #define __READDWARF_H__
 
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
 #include <string>
 #include <vector>
+#if defined(__BMI2__) && (defined(_M_X64) || defined(__x86_64__))
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#endif
 #include "mspdb.h"
 
 typedef unsigned char byte;
 
-inline unsigned int LEB128(byte* &p)
+// byte-at-a-time LEB128 decoding, used for values longer than 5 bytes
+inline unsigned int LEB128_scalar(byte* &p)
 {
 	unsigned int x = 0;
 	int shift = 0;
@@ -23,7 +33,7 @@ inline unsigned int LEB128(byte* &p)
 	return x;
 }
 
-inline int SLEB128(byte* &p)
+inline int SLEB128_scalar(byte* &p)
 {
 	unsigned int x = 0;
 	int shift = 0;
@@ -40,6 +50,86 @@ inline int SLEB128(byte* &p)
 	return x;
 }
 
+// Decode a LEB128 value of 2 to 5 bytes from an unaligned 8 byte load: the position of the
+// first byte without continuation bit gives the length, then the 7 bit groups are gathered.
+// PEXT is only used if the build targets BMI2 explicitly, it is microcoded and slower than
+// the shifts on AMD processors before Zen 3.
+// The data must be followed by at least 8 readable bytes, see PEImage::kSectionPadding.
+// Returns the length, or 0 if the value is longer than 5 bytes.
+inline int LEB128_word(const byte* p, unsigned int& x)
+{
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+	uint64_t stop = ~w & 0x8080808080ull;
+	if (!stop)
+		return 0;
+	int len = 5;
+	if (uint32_t lo = (uint32_t)stop)
+	{
+#ifdef _MSC_VER
+		unsigned long bit;
+		_BitScanForward(&bit, lo);
+#else
+		unsigned int bit = __builtin_ctz(lo);
+#endif
+		len = (bit >> 3) + 1;
+	}
+	w &= ~0ull >> (64 - 8 * len);
+#if defined(__BMI2__) && (defined(_M_X64) || defined(__x86_64__))
+	x = (unsigned int)_pext_u64(w, 0x7f7f7f7f7full);
+#else
+	x = (unsigned int)((w & 0x7f) | ((w >> 1) & 0x3f80) | ((w >> 2) & 0x1fc000)
+	                   | ((w >> 3) & 0xfe00000) | ((w >> 4) & 0x7f0000000ull));
+#endif
+	return len;
+}
+
+inline unsigned int LEB128(byte* &p)
+{
+	if (!(*p & 0x80))
+		return *p++;
+	unsigned int x;
+	if (int len = LEB128_word(p, x))
+	{
+		p += len;
+		return x;
+	}
+	return LEB128_scalar(p);
+}
+
+inline int SLEB128(byte* &p)
+{
+	if (!(*p & 0x80))
+	{
+		int x = *p++;
+		return x & 0x40 ? x - 0x80 : x; // sign extend
+	}
+	unsigned int x;
+	if (int len = LEB128_word(p, x))
+	{
+		if (len < 5 && (p[len - 1] & 0x40))
+			x |= ~0u << (7 * len); // sign extend
+		p += len;
+		return x;
+	}
+	return SLEB128_scalar(p);
+}
+
+// Decode a pair of LEB128 values, e.g. attribute and form of an abbreviation. Both are
+// usually single bytes which can be tested together.
+inline void LEB128x2(byte* &p, unsigned int& a, unsigned int& b)
+{
+	if (!((p[0] | p[1]) & 0x80))
+	{
+		a = p[0];
+		b = p[1];
+		p += 2;
+		return;
+	}
+	a = LEB128(p);
+	b = LEB128(p);
+}
+
 inline unsigned int RD2(byte* &p)
 {
 	unsigned int x = *p++;
@@ -74,6 +164,24 @@ inline unsigned long long RDsize(byte* &p, int size)
 	return x;
 }
 
+// number of entries of SIZE bytes from offset BASE to the end of section SEC
+inline unsigned long tableEntries(const char* sec, unsigned long length, unsigned long base, int size)
+{
+	return sec && base <= length && size > 0 ? (length - base) / size : 0;
+}
+
+// Read entry IDX of SIZE bytes of the table at offset BASE in section SEC with COUNT
+// entries (see tableEntries), returns false if the entry is outside of the section
+inline bool readTableEntry(const char* sec, unsigned long base, unsigned long count,
+                           unsigned long long idx, int size, uint64_t& val)
+{
+	if (idx >= count)
+		return false;
+	byte* p = (byte*)sec + base + idx * size;
+	val = RDsize(p, size);
+	return true;
+}
+
 enum AttrClass
 {
 	Invalid,
@@ -111,11 +219,23 @@ struct DWARF_CompilationUnit
 {
 	unsigned int unit_length; // 12 byte in DWARF-64
 	unsigned short version;
-	unsigned int debug_abbrev_offset; // 8 byte in DWARF-64
-	byte address_size;
+	unsigned int debug_abbrev_offset; // 8 byte in DWARF-64, use getAbbrevOffset()
+	byte address_size;                // use getAddressSize()
 
 	bool isDWARF64() const { return unit_length == ~0; }
 	int refSize() const { return unit_length == ~0 ? 8 : 4; }
+
+	// DWARF5 adds the unit type and moves the address size before the abbreviation offset
+	byte getUnitType() const;
+	byte getAddressSize() const { return version >= 5 ? ((byte*)this)[7] : address_size; }
+	unsigned int getAbbrevOffset() const
+	{
+		return version >= 5 ? *(unsigned int*)((byte*)this + 8) : debug_abbrev_offset;
+	}
+	// size of the unit header, depending on version and unit type
+	int getHeaderSize() const;
+	byte* getFirstDIE() const { return (byte*)this + getHeaderSize(); }
+	byte* getEnd() const { return (byte*)this + sizeof(unit_length) + unit_length; }
 };
 
 struct DWARF_FileName
@@ -153,11 +273,13 @@ struct DWARF_InfoData
 	unsigned long pclo;
 	unsigned long pchi;
 	unsigned long ranges; // -1u when attribute is not present
+	unsigned long stmt_list; // -1u when attribute is not present
 	unsigned long pcentry;
 	byte* type;
 	byte* containing_type;
 	byte* specification;
 	byte* abstract_origin;
+	byte* signature; // type in a type unit completing this declaration
 	unsigned long inlined;
 	bool external;
 	DWARF_Attribute location;
@@ -189,11 +311,13 @@ struct DWARF_InfoData
 		pclo = 0;
 		pchi = 0;
 		ranges = ~0;
+		stmt_list = ~0;
 		pcentry = 0;
 		type = 0;
 		containing_type = 0;
 		specification = 0;
 		abstract_origin = 0;
+		signature = 0;
 		inlined = 0;
 		external = 0;
 		member_location.type = Invalid;
@@ -320,10 +444,12 @@ struct DWARF_LineState
 	unsigned long last_addr;
 	std::vector<mspdb::LineInfoEntry> lineInfo;
 	unsigned int lineInfo_file;
+	std::vector<struct DWARF_LineBlock>* blocks; // collects the lines instead of adding them to the module
 
 	DWARF_LineState()
 	{
 		file_ptr = nullptr;
+		blocks = nullptr;
 		seg_offset = 0x400000;
 		last_addr = 0;
 		lineInfo_file = 0;
@@ -382,7 +508,19 @@ struct Location
 	bool is_regrel() const { return type == RegRel; }
 };
 
+// Summary of a location list
+struct LOCSummary
+{
+	Location ebp;     // first location relative to the frame pointer, if any
+	Location longest; // location valid for the largest address range
+
+	// preferred location for the frame base
+	const Location& best() const { return ebp.is_invalid() ? longest : ebp; }
+};
+
 class PEImage;
+class ConversionCache;
+struct DWARF_AbbrevCache;
 
 // Attempts to partially evaluate DWARF location expressions.
 // The only supported expressions are those, whose result may be represented
@@ -392,23 +530,79 @@ Location decodeLocation(const PEImage& img, const DWARF_Attribute& attr, const L
 void mergeAbstractOrigin(DWARF_InfoData& id, DWARF_CompilationUnit* cu);
 void mergeSpecification(DWARF_InfoData& id, DWARF_CompilationUnit* cu);
 
+// Tables of a DWARF5 unit referenced by indexed forms, resolved from the
+// DW_AT_*_base attributes of the unit DIE
+struct DWARF_UnitBases
+{
+	unsigned long str_offsets_base; // first entry of the unit in .debug_str_offsets
+	unsigned long addr_base;        // first entry of the unit in .debug_addr
+	unsigned long rnglists_base;    // offset table of the unit in .debug_rnglists
+	unsigned long loclists_base;    // offset table of the unit in .debug_loclists
+	// entries from the bases to the end of the sections, the limits of the indexed forms
+	unsigned long str_offsets_count;
+	unsigned long addr_count;
+	unsigned long rnglists_count;
+	unsigned long loclists_count;
+};
+
+// Tree structure of the DIEs of a unit in the order of .debug_info, including the
+// null entries terminating the lists of children. The entries are kept in parallel
+// arrays, so skipping subtrees is an index hop and the abbreviation lookup is done once.
+struct DIETable
+{
+	DWARF_CompilationUnit* cu;
+	std::vector<byte*> entryPtr;  // start of the entries, ascending
+	std::vector<byte*> abbrev;    // abbreviation of the entry, NULL for null entries
+	std::vector<int> nextSibling; // entry following the subtree of the entry
+	byte* end;                    // end of the entries read successfully
+
+	// index of the entry at PTR, -1 if there is none
+	int find(byte* ptr) const;
+};
+
 // Debug Information Entry Cursor
 class DIECursor
 {
 public:
 	DWARF_CompilationUnit* cu;
+	const DWARF_UnitBases* bases;
 	byte* ptr;
 	int level;
 	bool hasChild; // indicates whether the last read DIE has children
 	byte* sibling;
 
+	// structure of the unit if it is cached, index of the entry at PTR
+	const DIETable* table;
+	int index;
+
 	byte* getDWARFAbbrev(unsigned off, unsigned findcode);
+	static const DWARF_UnitBases* getUnitBases(DWARF_CompilationUnit* cu);
+
+	// resolve indexed forms through the unit tables
+	const char* readStrx(unsigned idx);
+	unsigned long readAddrx(unsigned idx);
+	unsigned long readListx(const char* sec, unsigned long base, unsigned long count, unsigned idx);
+
+	DIECursor(DWARF_CompilationUnit* cu_, byte* ptr, const DWARF_UnitBases* bases_);
 
 public:
 
-	static void setContext(PEImage* img_);
+	// the abbreviations found are saved to CACHE when the context changes again, and
+	// taken from it if the next image has the same .debug_abbrev
+	static void setContext(PEImage* img_, DWARF_AbbrevCache* cache = 0);
+
+	// All units of .debug_info and .debug_types, ordered by address
+	static const std::vector<DWARF_CompilationUnit*>& getUnits();
+	// Find the unit containing PTR, NULL if none
+	static DWARF_CompilationUnit* findUnit(byte* ptr);
+	// Find the type DIE of a type unit by its signature, NULL if not found
+	static byte* findTypeSignature(unsigned long long signature);
 
-	// Create a new DIECursor
+	// Build the DIETable of CU used by cursors on CU created afterwards, replacing
+	// the table of the previously cached unit. NULL releases the table.
+	static void cacheUnit(DWARF_CompilationUnit* cu);
+
+	// Create a new DIECursor, CU is replaced by the unit containing PTR if PTR is outside of CU
 	DIECursor(DWARF_CompilationUnit* cu_, byte* ptr);
 
 	// Goto next sibling DIE.  If the last read DIE had any children, they will be skipped over.
@@ -427,8 +621,53 @@ public:
 	bool readNext(DWARF_InfoData& id, bool stopAtNull = false);
 };
 
+// collect the DIEs of functions and variables listed in the accelerated name tables
+// (.debug_names and .debug_gnu_pubnames) and the units covered by them (their first
+// byte in .debug_info), both sorted and without duplicates. Returns false if there are
+// no such tables. .debug_pubnames is not used, as it doesn't list static functions
+// and variables.
+bool readDWARFPubNames(const PEImage& img, std::vector<byte*>& dies, std::vector<byte*>& units);
+
+// lines of a source file in an address range, the arguments of Mod::AddLines
+struct DWARF_LineBlock
+{
+	std::string file;
+	unsigned short segment;
+	unsigned int offset; // of the first line in the segment
+	unsigned int length; // of the address range minus 1
+	unsigned short line; // of the first line
+	std::vector<mspdb::LineInfoEntry> lines; // relative to offset and line
+};
+
+// line blocks passed from the thread interpreting the line programs to the thread
+// adding them to the module, in the order of the line programs
+class DWARF_LineQueue
+{
+public:
+	DWARF_LineQueue() : closed(false), ok(true) {}
+
+	void push(std::vector<DWARF_LineBlock>& blocks); // takes the blocks
+	void close(bool success);
+
+	// wait for the blocks of the next line program, false after the last one
+	bool pop(std::vector<DWARF_LineBlock>& blocks);
+	bool succeeded() const { return ok; }
+
+private:
+	std::deque<std::vector<DWARF_LineBlock>> pending;
+	bool closed;
+	bool ok;
+	std::mutex lock;
+	std::condition_variable ready;
+};
+
 // iterate over DWARF debug_line information
 // if mod is null, print them out, otherwise add to module
-bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod);
+// if offsets is given, only the line programs at these sorted offsets are interpreted
+// if queue is given, the lines of each line program are pushed to it instead of mod
+// if cache is given, line programs interpreted by previous conversions are taken from it
+bool interpretDWARFLines(const PEImage& img, mspdb::Mod* mod, const std::vector<unsigned long>* offsets = 0,
+                         DWARF_LineQueue* queue = 0, ConversionCache* cache = 0);
+bool addDWARFLineBlocks(mspdb::Mod* mod, const std::vector<DWARF_LineBlock>& blocks);
 
 #endif
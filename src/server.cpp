@@ -0,0 +1,216 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "server.h"
+
+#include <stdio.h>
+
+// Request: version, number of strings, working directory and arguments.
+// Response: exit code and error message. Strings are UTF-8 with their length in front.
+static const DWORD kProtocolVersion = 1;
+static const DWORD kMaxArgs = 256;
+static const DWORD kMaxString = 0x10000;
+
+tstring serverPipeName(const TCHAR* name)
+{
+	tstring pipe = TEXT("\\\\.\\pipe\\cv2pdb-");
+	if (name && *name)
+		return pipe + name;
+
+	TCHAR user[256];
+	DWORD len = GetEnvironmentVariable(TEXT("USERNAME"), user, 256);
+	return pipe + (len > 0 && len < 256 ? user : TEXT("server"));
+}
+
+static bool readPipe(HANDLE pipe, void* data, DWORD size)
+{
+	char* p = (char*)data;
+	while (size > 0)
+	{
+		DWORD read;
+		if (!ReadFile(pipe, p, size, &read, 0) || read == 0)
+			return false;
+		p += read;
+		size -= read;
+	}
+	return true;
+}
+
+static bool writePipe(HANDLE pipe, const void* data, DWORD size)
+{
+	DWORD written;
+	return WriteFile(pipe, data, size, &written, 0) && written == size;
+}
+
+static bool readString(HANDLE pipe, std::string& s)
+{
+	DWORD len;
+	if (!readPipe(pipe, &len, sizeof(len)) || len > kMaxString)
+		return false;
+	s.resize(len);
+	return len == 0 || readPipe(pipe, &s[0], len);
+}
+
+static bool writeString(HANDLE pipe, const std::string& s)
+{
+	DWORD len = (DWORD)s.size();
+	return writePipe(pipe, &len, sizeof(len)) && (len == 0 || writePipe(pipe, s.data(), len));
+}
+
+static HANDLE createPipe(const tstring& name, bool first)
+{
+	// the first instance fails if another server uses the name
+	return CreateNamedPipe(name.c_str(), PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+	                       PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+	                       PIPE_UNLIMITED_INSTANCES, 4096, 4096, 0, 0);
+}
+
+bool ConversionServer::run(const TCHAR* name)
+{
+	tstring pipename = serverPipeName(name);
+	converter.cache = &cache;
+
+	HANDLE pipe = createPipe(pipename, true);
+	if (pipe == INVALID_HANDLE_VALUE)
+	{
+		errorMessage = toUTF8(pipename.c_str());
+		errorMessage += GetLastError() == ERROR_ACCESS_DENIED ? ": server already running" : ": cannot create pipe";
+		return setError(errorMessage.c_str());
+	}
+	printf("cv2pdb server listening on " SARG "\n", pipename.c_str());
+	fflush(stdout);
+
+	for (;;)
+	{
+		if (!ConnectNamedPipe(pipe, 0) && GetLastError() != ERROR_PIPE_CONNECTED)
+		{
+			CloseHandle(pipe);
+			errorMessage = toUTF8(pipename.c_str()) + ": cannot connect to client";
+			return setError(errorMessage.c_str());
+		}
+		// the next client connects to a new instance while this one is served
+		HANDLE next = createPipe(pipename, false);
+
+		if (serve(pipe))
+			FlushFileBuffers(pipe);
+		DisconnectNamedPipe(pipe);
+		CloseHandle(pipe);
+
+		pipe = next;
+		if (pipe == INVALID_HANDLE_VALUE)
+		{
+			errorMessage = toUTF8(pipename.c_str()) + ": cannot create pipe";
+			return setError(errorMessage.c_str());
+		}
+	}
+}
+
+bool ConversionServer::serve(HANDLE pipe)
+{
+	DWORD header[2];
+	if (!readPipe(pipe, header, sizeof(header)))
+		return false;
+
+	DWORD status = 1;
+	std::string message;
+	if (header[0] != kProtocolVersion || header[1] == 0 || header[1] > kMaxArgs)
+		message = "cv2pdb client and server versions differ";
+	else
+	{
+		std::vector<tstring> args;
+		for (DWORD i = 0; i < header[1]; i++)
+		{
+			std::string arg;
+			if (!readString(pipe, arg))
+				return false;
+			args.push_back(fromUTF8(arg));
+		}
+		status = convert(args, message);
+	}
+	return writePipe(pipe, &status, sizeof(status)) && writeString(pipe, message);
+}
+
+int ConversionServer::convert(const std::vector<tstring>& args, std::string& message)
+{
+	// relative paths are relative to the working directory of the client
+	if (!SetCurrentDirectory(args[0].c_str()))
+	{
+		message = toUTF8(args[0].c_str()) + ": cannot change to directory";
+		return 1;
+	}
+
+	// options as on the command line, the strings stay valid during the conversion
+	ConverterOptions opts;
+	size_t a = 1;
+	for (; a < args.size() && args[a][0] == '-'; a++)
+	{
+		if (args[a] == TEXT("--"))
+		{
+			a++;
+			break;
+		}
+		if (const char* err = opts.parse(args[a].c_str()))
+		{
+			message = err + toUTF8(args[a].c_str());
+			return 1;
+		}
+	}
+	size_t files = args.size() - a;
+	if (files < 1 || files > 3)
+	{
+		message = "<exe-file> [new-exe-file] [pdb-file] expected";
+		return 1;
+	}
+
+	const TCHAR* exename = args[a].c_str();
+	const TCHAR* outname = files > 1 && !args[a + 1].empty() ? args[a + 1].c_str() : 0;
+	const TCHAR* pdbname = files > 2 ? args[a + 2].c_str() : 0;
+
+	converter.options = opts;
+	DWORD start = GetTickCount();
+	if (!converter.convert(exename, outname, pdbname))
+	{
+		message = converter.getLastError();
+		printf("%s\n", message.c_str());
+		fflush(stdout);
+		return 1;
+	}
+	printf(SARG ": converted in %lu ms\n", exename, GetTickCount() - start);
+	fflush(stdout);
+	return 0;
+}
+
+int runClient(const TCHAR* name, const std::vector<tstring>& args, std::string& message)
+{
+	tstring pipename = serverPipeName(name);
+	HANDLE pipe;
+	for (;;)
+	{
+		pipe = CreateFile(pipename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0);
+		if (pipe != INVALID_HANDLE_VALUE)
+			break;
+		// all instances are busy until the server creates the next one
+		if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipe(pipename.c_str(), NMPWAIT_WAIT_FOREVER))
+			return -1;
+	}
+
+	TCHAR cwd[MAX_PATH];
+	DWORD len = GetCurrentDirectory(MAX_PATH, cwd);
+	DWORD header[2] = { kProtocolVersion, (DWORD)args.size() + 1 };
+	bool ok = len > 0 && len < MAX_PATH && writePipe(pipe, header, sizeof(header)) && writeString(pipe, toUTF8(cwd));
+	for (size_t i = 0; ok && i < args.size(); i++)
+		ok = writeString(pipe, toUTF8(args[i].c_str()));
+
+	DWORD status = 1;
+	ok = ok && readPipe(pipe, &status, sizeof(status)) && readString(pipe, message);
+	CloseHandle(pipe);
+	if (!ok)
+	{
+		message = toUTF8(pipename.c_str()) + ": lost connection to the server";
+		return 1;
+	}
+	return (int)status;
+}
@@ -0,0 +1,44 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "LastError.h"
+#include "converter.h"
+
+#include <string>
+#include <vector>
+
+// Conversion server (--server) and its client (--client). The client sends its command
+// line and working directory through a named pipe, the server converts the image with
+// the mspdb DLL, the record buffers and the ConversionCache of the previous conversions
+// still in memory. Requests are served one after the other, warnings are printed by
+// the server and errors are returned to the client.
+
+// pipe of the server NAME, of the current user if NAME is NULL or empty
+tstring serverPipeName(const TCHAR* name);
+
+class ConversionServer : public LastError
+{
+public:
+	// serve requests until the process is terminated, false if the pipe cannot be created
+	bool run(const TCHAR* name);
+
+private:
+	bool serve(HANDLE pipe);
+	int convert(const std::vector<tstring>& args, std::string& message);
+
+	Converter converter;
+	ConversionCache cache;
+	std::string errorMessage;
+};
+
+// let the server NAME convert with the command line ARGS (without --client). Returns
+// the exit code and error message of the conversion, -1 if no server is running.
+int runClient(const TCHAR* name, const std::vector<tstring>& args, std::string& message);
+
+#endif //__SERVER_H__
@@ -0,0 +1,140 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "spill.h"
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+// in front of the records, keeps them aligned to the size of 4 pointers
+struct RecordBlock
+{
+	size_t size;    // bytes available for the records
+	HANDLE file;    // temporary file, INVALID_HANDLE_VALUE if allocated with malloc
+	HANDLE mapping;
+	void* reserved;
+};
+
+static HANDLE createSpillFile()
+{
+	TCHAR dir[MAX_PATH], name[MAX_PATH];
+	DWORD len = GetTempPath(MAX_PATH, dir);
+	if (len == 0 || len >= MAX_PATH || !GetTempFileName(dir, TEXT("cv2"), 0, name))
+		return INVALID_HANDLE_VALUE;
+
+	// deleted by the system when the handle is closed, even if the process is killed
+	HANDLE file = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, 0, CREATE_ALWAYS,
+	                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, 0);
+	if (file == INVALID_HANDLE_VALUE)
+		DeleteFile(name);
+	return file;
+}
+
+// map the file with room for SIZE bytes of records, extending it if necessary
+static RecordBlock* mapSpillFile(HANDLE file, size_t size)
+{
+	unsigned long long total = sizeof(RecordBlock) + (unsigned long long)size;
+	HANDLE mapping = CreateFileMapping(file, 0, PAGE_READWRITE, (DWORD)(total >> 32), (DWORD)total, 0);
+	if (!mapping)
+		return 0;
+	RecordBlock* blk = (RecordBlock*) MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)total);
+	if (!blk)
+	{
+		CloseHandle(mapping);
+		return 0;
+	}
+	blk->size = size;
+	blk->file = file;
+	blk->mapping = mapping;
+	return blk;
+}
+
+static void unmapSpillFile(RecordBlock* blk)
+{
+	HANDLE mapping = blk->mapping;
+	UnmapViewOfFile(blk);
+	CloseHandle(mapping);
+}
+
+void* reallocRecords(void* p, size_t size, size_t threshold)
+{
+	RecordBlock* blk = p ? (RecordBlock*)p - 1 : 0;
+	if (blk && blk->file != INVALID_HANDLE_VALUE)
+	{
+		// the records are kept in the file, a new view just covers more of it.
+		// Both views show the same header, so remember the old mapping first.
+		HANDLE mapping = blk->mapping;
+		RecordBlock* nblk = mapSpillFile(blk->file, size);
+		if (!nblk)
+			return 0;
+		UnmapViewOfFile(blk);
+		CloseHandle(mapping);
+		return nblk + 1;
+	}
+
+	if (threshold && size >= threshold)
+	{
+		HANDLE file = createSpillFile();
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			RecordBlock* nblk = mapSpillFile(file, size);
+			if (nblk)
+			{
+				if (blk)
+				{
+					memcpy(nblk + 1, p, blk->size < size ? blk->size : size);
+					free(blk);
+				}
+				return nblk + 1;
+			}
+			CloseHandle(file);
+		}
+		// no temporary file, keep the records in memory
+	}
+
+	blk = (RecordBlock*) realloc(blk, sizeof(RecordBlock) + size);
+	if (!blk)
+		return 0;
+	blk->size = size;
+	blk->file = INVALID_HANDLE_VALUE;
+	blk->mapping = 0;
+	return blk + 1;
+}
+
+void freeRecords(void* p)
+{
+	if (!p)
+		return;
+	RecordBlock* blk = (RecordBlock*)p - 1;
+	if (blk->file != INVALID_HANDLE_VALUE)
+	{
+		HANDLE file = blk->file;
+		unmapSpillFile(blk);
+		CloseHandle(file);
+	}
+	else
+		free(blk);
+}
+
+void releaseRecords(void* p, size_t used)
+{
+	if (!p)
+		return;
+	RecordBlock* blk = (RecordBlock*)p - 1;
+	if (blk->file == INVALID_HANDLE_VALUE)
+		return;
+
+	// whole pages only, records are still appended to the last one
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t bytes = (sizeof(RecordBlock) + used) & ~(size_t)(info.dwPageSize - 1);
+	if (bytes == 0)
+		return;
+	FlushViewOfFile(blk, bytes);
+	// unlocking pages that are not locked removes them from the working set
+	VirtualUnlock(blk, bytes);
+}
@@ -0,0 +1,24 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __SPILL_H__
+#define __SPILL_H__
+
+#include <stddef.h>
+
+// Allocation of the type and symbol record buffers. Buffers growing beyond the
+// threshold (derived from --max-memory, 0 for no limit) are moved to a temporary
+// file and mapped into memory: their pages are written to the file and dropped
+// by the system instead of using RAM or the page file. Below the threshold,
+// the buffers are allocated with malloc.
+void* reallocRecords(void* p, size_t size, size_t threshold);
+void freeRecords(void* p);
+
+// write the pages of a buffer before USED to its file and remove them from the
+// working set, they are read back when accessed again
+void releaseRecords(void* p, size_t used);
+
+#endif //__SPILL_H__
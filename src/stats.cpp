@@ -0,0 +1,271 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "stats.h"
+
+#include <psapi.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#pragma comment(lib, "psapi.lib")
+
+#ifdef UNICODE
+#define T_fopen	_wfopen
+#else
+#define T_fopen	fopen
+#endif
+
+thread_local ConversionStats convStats;
+thread_local WarningHandler warningHandler;
+thread_local void* warningContext;
+
+void warning(const char* fmt, ...)
+{
+	char msg[1024];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	if (warningHandler)
+		warningHandler(warningContext, msg);
+	else
+		printf("warning: %s\n", msg);
+}
+
+static double wallTime()
+{
+	static LARGE_INTEGER freq;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER cnt;
+	QueryPerformanceCounter(&cnt);
+	return (double)cnt.QuadPart / freq.QuadPart;
+}
+
+static double cpuTime()
+{
+	FILETIME create, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7; // 100ns units
+}
+
+void ConversionStats::clear()
+{
+	enabled = false;
+	tracing = false;
+	phases.clear();
+	events.clear();
+	units = dies = abbrevHits = abbrevMisses = 0;
+	typesEmitted = typesDeduplicated = 0;
+	symbols = publics = lineRows = 0;
+	cachedLinePrograms = 0;
+	curPhase = 0;
+	curWall = curCPU = 0;
+}
+
+void ConversionStats::beginPhase(const char* name)
+{
+	if (!enabled)
+		return;
+
+	double wall = wallTime();
+	double cpu = cpuTime();
+	if (curPhase)
+	{
+		Phase phase = { curPhase, wall - curWall, cpu - curCPU };
+		phases.push_back(phase);
+
+		if (tracing)
+		{
+			TraceEvent event;
+			event.cat = "phase";
+			event.name = curPhase;
+			event.offset = 0;
+			event.start = curWall;
+			event.duration = wall - curWall;
+			event.thread = GetCurrentThreadId();
+			event.dies = event.rows = 0;
+			addEvent(event);
+		}
+	}
+	curPhase = name;
+	curWall = wall;
+	curCPU = cpu;
+}
+
+void ConversionStats::addEvent(const TraceEvent& event)
+{
+	std::lock_guard<std::mutex> lock(eventsLock);
+	events.push_back(event);
+}
+
+void ConversionStats::add(const ConversionStats& other)
+{
+	units += other.units;
+	dies += other.dies;
+	abbrevHits += other.abbrevHits;
+	abbrevMisses += other.abbrevMisses;
+	typesEmitted += other.typesEmitted;
+	typesDeduplicated += other.typesDeduplicated;
+	symbols += other.symbols;
+	publics += other.publics;
+	lineRows += other.lineRows;
+	cachedLinePrograms += other.cachedLinePrograms;
+
+	std::lock_guard<std::mutex> lock(eventsLock);
+	events.insert(events.end(), other.events.begin(), other.events.end());
+}
+
+void ConversionTask::join()
+{
+	if (!thread.joinable())
+		return;
+	thread.join();
+	convStats.add(stats);
+	stats.clear();
+}
+
+static std::string jsonString(const std::string& str)
+{
+	std::string res = "\"";
+	for (size_t i = 0; i < str.size(); i++)
+	{
+		char c = str[i];
+		if (c == '"' || c == '\\')
+			res += '\\';
+		if ((unsigned char)c < 0x20)
+			c = ' ';
+		res += c;
+	}
+	return res + "\"";
+}
+
+static std::string jsonString(const TCHAR* s)
+{
+#ifdef UNICODE
+	char buf[3 * MAX_PATH];
+	if (!WideCharToMultiByte(CP_UTF8, 0, s, -1, buf, sizeof(buf), 0, 0))
+		buf[0] = 0;
+	return jsonString(std::string(buf));
+#else
+	return jsonString(std::string(s));
+#endif
+}
+
+bool ConversionStats::write(const TCHAR* path, const TCHAR* input) const
+{
+	FILE* f = T_fopen(path, TEXT("w"));
+	if (!f)
+		return false;
+
+	PROCESS_MEMORY_COUNTERS mem;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem)))
+		mem.PeakWorkingSetSize = 0;
+
+	double wall = 0, cpu = 0;
+	fprintf(f, "{\n");
+	fprintf(f, "  \"input\": %s,\n", jsonString(input).c_str());
+	fprintf(f, "  \"phases\": [");
+	for (size_t i = 0; i < phases.size(); i++)
+	{
+		fprintf(f, "%s\n    { \"name\": \"%s\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f }",
+		        i ? "," : "", phases[i].name, phases[i].wall * 1000, phases[i].cpu * 1000);
+		wall += phases[i].wall;
+		cpu += phases[i].cpu;
+	}
+	fprintf(f, "\n  ],\n");
+	fprintf(f, "  \"wall_ms\": %.3f,\n", wall * 1000);
+	fprintf(f, "  \"cpu_ms\": %.3f,\n", cpu * 1000);
+	fprintf(f, "  \"peak_rss_bytes\": %llu,\n", (unsigned long long)mem.PeakWorkingSetSize);
+	fprintf(f, "  \"counters\": {\n");
+	fprintf(f, "    \"units\": %llu,\n", units);
+	fprintf(f, "    \"dies\": %llu,\n", dies);
+	fprintf(f, "    \"abbrev_hits\": %llu,\n", abbrevHits);
+	fprintf(f, "    \"abbrev_misses\": %llu,\n", abbrevMisses);
+	fprintf(f, "    \"types_emitted\": %llu,\n", typesEmitted);
+	fprintf(f, "    \"types_deduplicated\": %llu,\n", typesDeduplicated);
+	fprintf(f, "    \"symbols\": %llu,\n", symbols);
+	fprintf(f, "    \"publics\": %llu,\n", publics);
+	fprintf(f, "    \"line_rows\": %llu,\n", lineRows);
+	fprintf(f, "    \"cached_line_programs\": %llu\n", cachedLinePrograms);
+	fprintf(f, "  }\n");
+	fprintf(f, "}\n");
+	return fclose(f) == 0;
+}
+
+bool ConversionStats::writeTrace(const TCHAR* path) const
+{
+	FILE* f = T_fopen(path, TEXT("w"));
+	if (!f)
+		return false;
+
+	// timestamps in microseconds relative to the first event
+	double base = events.empty() ? 0 : events[0].start;
+	for (size_t i = 1; i < events.size(); i++)
+		base = min(base, events[i].start);
+
+	fprintf(f, "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const TraceEvent& ev = events[i];
+		fprintf(f, "%s\n  { \"ph\": \"X\", \"cat\": \"%s\", \"name\": \"%s\", \"pid\": 1, \"tid\": %lu, \"ts\": %.1f, \"dur\": %.1f",
+		        i ? "," : "", ev.cat, ev.name, ev.thread, (ev.start - base) * 1e6, ev.duration * 1e6);
+		if (strcmp(ev.cat, "phase") != 0)
+		{
+			fprintf(f, ", \"args\": { ");
+			if (!ev.unit.empty())
+				fprintf(f, "\"unit\": %s, ", jsonString(ev.unit).c_str());
+			fprintf(f, "\"offset\": \"0x%lx\", \"dies\": %llu, \"rows\": %llu }", ev.offset, ev.dies, ev.rows);
+		}
+		fprintf(f, " }");
+	}
+	fprintf(f, "\n] }\n");
+	return fclose(f) == 0;
+}
+
+TraceSpan::TraceSpan(const char* cat, const char* name)
+{
+	start = -1;
+	if (!convStats.tracing)
+		return;
+
+	event.cat = cat;
+	event.name = name;
+	event.offset = 0;
+	event.thread = GetCurrentThreadId();
+	event.dies = convStats.dies;
+	event.rows = convStats.lineRows;
+	start = wallTime();
+}
+
+TraceSpan::~TraceSpan()
+{
+	if (!active())
+		return;
+
+	event.start = start;
+	event.duration = wallTime() - start;
+	event.dies = convStats.dies - event.dies;
+	event.rows = convStats.lineRows - event.rows;
+	convStats.addEvent(event);
+}
+
+void TraceSpan::setUnit(const char* unit, unsigned long offset)
+{
+	if (!active())
+		return;
+	if (unit)
+		event.unit = unit;
+	event.offset = offset;
+}
@@ -0,0 +1,138 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <windows.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Phase timings and counters of a conversion, written as JSON by --stats=<file>.
+// The counters are always maintained, the phases are only timed if enabled.
+// With --trace=<file>, the phases and TraceSpans are written as Chrome trace events.
+struct ConversionStats
+{
+	struct Phase
+	{
+		const char* name;
+		double wall; // seconds
+		double cpu;  // user and kernel time of the process in seconds
+	};
+
+	struct TraceEvent
+	{
+		const char* cat;
+		const char* name;
+		std::string unit;        // name of the compilation unit, if any
+		unsigned long offset;    // section offset of the unit or line program
+		double start, duration;  // seconds
+		unsigned long thread;
+		unsigned long long dies; // DIEs decoded during the span
+		unsigned long long rows; // line number rows added during the span
+	};
+
+	bool enabled; // time the phases
+	bool tracing; // record trace events
+	std::vector<Phase> phases;
+	std::vector<TraceEvent> events;
+	std::mutex eventsLock;
+
+	unsigned long long units;             // compilation units converted
+	unsigned long long dies;              // DIEs decoded
+	unsigned long long abbrevHits;        // abbreviations found in the cache
+	unsigned long long abbrevMisses;      // abbreviations searched in .debug_abbrev
+	unsigned long long typesEmitted;      // type DIEs converted to a type record
+	unsigned long long typesDeduplicated; // type DIEs mapped to the record of another DIE
+	unsigned long long symbols;           // symbol records added to modules
+	unsigned long long publics;           // public symbols added
+	unsigned long long lineRows;          // rows of the line number tables
+	unsigned long long cachedLinePrograms; // line programs taken from the cache of a previous conversion
+
+	ConversionStats() { clear(); }
+	void clear();
+
+	// end the current phase and start timing phase NAME (a string literal), NULL only ends it
+	void beginPhase(const char* name);
+	void endPhase() { beginPhase(0); }
+
+	bool write(const TCHAR* path, const TCHAR* input) const;
+	bool writeTrace(const TCHAR* path) const;
+
+	void addEvent(const TraceEvent& event);
+	// add the counters and trace events of OTHER, the phases are not merged
+	void add(const ConversionStats& other);
+
+private:
+	const char* curPhase;
+	double curWall;
+	double curCPU;
+};
+
+// statistics of the conversion running on the current thread
+extern thread_local ConversionStats convStats;
+
+// Warnings of the conversion running on the current thread are printed to stdout, unless
+// a handler is installed (batch workers print them together with the result of the image)
+typedef void (*WarningHandler)(void* context, const char* msg);
+extern thread_local WarningHandler warningHandler;
+extern thread_local void* warningContext;
+
+// report a warning, FMT is a printf format without the "warning: " prefix and newline
+void warning(const char* fmt, ...);
+
+// Trace event of the work done from construction to destruction, only recorded
+// with --trace. CAT and NAME must be string literals.
+class TraceSpan
+{
+public:
+	TraceSpan(const char* cat, const char* name);
+	~TraceSpan();
+
+	void setUnit(const char* unit, unsigned long offset);
+	bool active() const { return start >= 0; }
+
+private:
+	ConversionStats::TraceEvent event;
+	double start;
+};
+
+// Part of a conversion running on another thread. The counters and trace events of
+// the thread are added to the statistics of the thread joining the task, warnings go
+// to the handler of the thread starting it.
+class ConversionTask
+{
+public:
+	~ConversionTask() { join(); }
+
+	template<class F> void start(F fn)
+	{
+		join();
+		bool enabled = convStats.enabled;
+		bool tracing = convStats.tracing;
+		WarningHandler handler = warningHandler;
+		void* context = warningContext;
+		thread = std::thread([this, fn, enabled, tracing, handler, context]()
+		{
+			convStats.enabled = enabled;
+			convStats.tracing = tracing;
+			warningHandler = handler;
+			warningContext = context;
+			fn();
+			stats.add(convStats);
+		});
+	}
+	// wait for the task to finish, does nothing if it is not running
+	void join();
+
+private:
+	std::thread thread;
+	ConversionStats stats;
+};
+
+#endif //__STATS_H__
@@ -8,16 +8,39 @@
 
 #include "symutil.h"
 #include "demangle.h"
+#include "cache.h"
 
 extern "C" {
 #include "mscvpdb.h"
 }
 
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
-char dotReplacementChar = '@';
-bool demangleSymbols = true;
-bool useTypedefEnum = false;
+thread_local char dotReplacementChar = '@';
+thread_local bool demangleSymbols = true;
+thread_local bool useTypedefEnum = false;
+
+// demangle NAME in place, through the cache of the server if any
+static void demangleName(char* name, int maxlen)
+{
+	if (!conversionCache)
+	{
+		d_demangle(name, name, maxlen, true);
+		return;
+	}
+	char key[16];
+	sprintf(key, "%d:", maxlen);
+	std::string& demangled = conversionCache->demangled[key + std::string(name)];
+	if (demangled.empty())
+	{
+		d_demangle(name, name, maxlen, true);
+		demangled = name;
+	}
+	else
+		strcpy(name, demangled.c_str());
+}
 
 int dsym2c(const BYTE* p, int len, char* cname, int maxclen)
 {
@@ -97,7 +120,7 @@ int dsym2c(const BYTE* p, int len, char* cname, int maxclen)
 	cname[cpos] = 0;
 	if(demangleSymbols)
 		if (cname[0] == '_' && cname[1] == 'D' && isdigit(cname[2]))
-			d_demangle(cname, cname, maxclen, true);
+			demangleName(cname, maxclen);
 
 #if 1
 	for(int i = 0; i < cpos; i++)
@@ -135,7 +158,7 @@ int dstrlen(const BYTE* &p, bool cstr)
 
 char* p2c(const BYTE* p, int idx)
 {
-	static char cname[4][2560];
+	static thread_local char cname[4][2560];
 	int len = pstrlen(p);
 
 #if 1
@@ -31,8 +31,9 @@ int pstrcpy_v(bool v3, BYTE* d, const BYTE* s);
 int cstrcpy_v(bool v3, BYTE* d, const char* s);
 bool dstrcmp(const BYTE* s1, bool cstr1, const BYTE* s2, bool cstr2);
 
-extern char dotReplacementChar;
-extern bool demangleSymbols;
-extern bool useTypedefEnum;
+// options of the conversion running on the current thread, see ConverterOptions
+extern thread_local char dotReplacementChar;
+extern thread_local bool demangleSymbols;
+extern thread_local bool useTypedefEnum;
 
 #endif //__SYMUTIL_H__
@@ -0,0 +1,156 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#include "watch.h"
+
+#include <stdio.h>
+
+// time without changes before the image is considered complete
+static const DWORD kQuietMilliseconds = 300;
+
+static std::wstring toWide(const TCHAR* s)
+{
+#ifdef UNICODE
+	return s;
+#else
+	std::wstring w;
+	int len = MultiByteToWideChar(CP_ACP, 0, s, -1, 0, 0);
+	if (len > 1)
+	{
+		w.resize(len);
+		MultiByteToWideChar(CP_ACP, 0, s, -1, &w[0], len);
+		w.resize(len - 1);
+	}
+	return w;
+#endif
+}
+
+bool ImageWatcher::FileState::read(const TCHAR* path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &data))
+		return false;
+	size = ((ULONGLONG)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	lastWrite = data.ftLastWriteTime;
+	return true;
+}
+
+bool ImageWatcher::FileState::operator==(const FileState& other) const
+{
+	return size == other.size && CompareFileTime(&lastWrite, &other.lastWrite) == 0;
+}
+
+bool ImageWatcher::run(const TCHAR* exename, const TCHAR* outname, const TCHAR* pdbname)
+{
+	TCHAR path[MAX_PATH];
+	TCHAR* filepart = 0;
+	DWORD len = GetFullPathName(exename, MAX_PATH, path, &filepart);
+	if (len == 0 || len >= MAX_PATH || !filepart)
+	{
+		errorMessage = toUTF8(exename) + ": invalid file name";
+		return setError(errorMessage.c_str());
+	}
+	std::wstring filename = toWide(filepart);
+	tstring dirname(path, filepart);
+
+	HANDLE dir = CreateFile(dirname.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                        0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+	if (dir == INVALID_HANDLE_VALUE)
+	{
+		errorMessage = toUTF8(dirname.c_str()) + ": cannot watch directory";
+		return setError(errorMessage.c_str());
+	}
+
+	converter.options = options;
+	converter.cache = &cache;
+	printf("watching " SARG "\n", path);
+	fflush(stdout);
+
+	FileState state;
+	if (waitUntilComplete(path, state))
+	{
+		convert(exename, outname, pdbname);
+		state.read(path); // after rewriting the image
+	}
+
+	for (;;)
+	{
+		// changes after the last call are buffered by the system until the next one
+		if (!waitForChange(dir, filename))
+		{
+			CloseHandle(dir);
+			errorMessage = toUTF8(dirname.c_str()) + ": cannot watch directory";
+			return setError(errorMessage.c_str());
+		}
+
+		// skip the rewrite of the image by the conversion itself
+		FileState last = state;
+		if (!waitUntilComplete(path, state) || state == last)
+			continue;
+		convert(exename, outname, pdbname);
+		state.read(path);
+	}
+}
+
+bool ImageWatcher::waitForChange(HANDLE dir, const std::wstring& filename)
+{
+	DWORD buffer[16384];
+	for (;;)
+	{
+		DWORD bytes = 0;
+		if (!ReadDirectoryChangesW(dir, buffer, sizeof(buffer), FALSE,
+		                           FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+		                           &bytes, 0, 0))
+			return false;
+		if (bytes == 0)
+			return true; // the buffer overflowed, the image might have changed
+
+		for (BYTE* p = (BYTE*)buffer; ; )
+		{
+			FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)p;
+			std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+			if (_wcsicmp(name.c_str(), filename.c_str()) == 0)
+				return true;
+			if (info->NextEntryOffset == 0)
+				break;
+			p += info->NextEntryOffset;
+		}
+	}
+}
+
+bool ImageWatcher::waitUntilComplete(const TCHAR* path, FileState& state)
+{
+	if (!state.read(path))
+		return false;
+	for (;;)
+	{
+		Sleep(kQuietMilliseconds);
+		FileState now;
+		if (!now.read(path))
+			return false; // removed, wait for the linker to create it again
+		if (now == state)
+		{
+			// the linker might still have it open without writing
+			HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+				return true;
+			}
+		}
+		state = now;
+	}
+}
+
+void ImageWatcher::convert(const TCHAR* exename, const TCHAR* outname, const TCHAR* pdbname)
+{
+	DWORD start = GetTickCount();
+	if (converter.convert(exename, outname, pdbname))
+		printf(SARG ": converted in %lu ms\n", exename, GetTickCount() - start);
+	else
+		printf("%s\n", converter.getLastError());
+	fflush(stdout);
+}
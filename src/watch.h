@@ -0,0 +1,50 @@
+// Convert DMD CodeView debug information to PDB files
+// Copyright (c) 2009-2010 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include "LastError.h"
+#include "converter.h"
+
+#include <string>
+
+// Watch mode (--watch): the image is converted and converted again whenever the linker
+// has rewritten it. The directory of the image is monitored for changes, a conversion
+// starts when the file has not changed for a moment and the linker has closed it.
+// Line programs and abbreviations of unchanged compilation units are taken from the
+// ConversionCache of the previous conversions.
+class ImageWatcher : public LastError
+{
+public:
+	ConverterOptions options;
+
+	// convert EXENAME until the process is terminated, false if it cannot be watched.
+	// The arguments are those of Converter::convert().
+	bool run(const TCHAR* exename, const TCHAR* outname, const TCHAR* pdbname);
+
+private:
+	// size and time of the last write of a file
+	struct FileState
+	{
+		ULONGLONG size;
+		FILETIME lastWrite;
+
+		FileState() : size(0) { lastWrite.dwLowDateTime = lastWrite.dwHighDateTime = 0; }
+		bool read(const TCHAR* path);
+		bool operator==(const FileState& other) const;
+	};
+
+	bool waitForChange(HANDLE dir, const std::wstring& filename);
+	bool waitUntilComplete(const TCHAR* path, FileState& state);
+	void convert(const TCHAR* exename, const TCHAR* outname, const TCHAR* pdbname);
+
+	Converter converter;
+	ConversionCache cache;
+	std::string errorMessage;
+};
+
+#endif //__WATCH_H__
@@ -0,0 +1,187 @@
+// Convert DMD CodeView/DWARF debug information to PDB files
+// Copyright (c) 2009-2012 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+//
+// throughput benchmark of the DWARF conversion on synthetic images
+//   nmake dwarfbench
+//   dwarfbench [-u<units>] [-d<dies-per-unit>] [-t<type-depth>] [-i<inline-percent>]
+//              [-l<line-rows>] [-v<version>] [-e[h]] [-x] [-p] [-n<iterations>] [-o<exe-file>]
+//
+// The image is generated in memory (see dwarfgen.h) and converted to a
+// temporary PDB file with the same phases as cv2pdb. The best time of each
+// phase is reported together with the throughput in MB of debug information
+// and DIEs per second. -e emits .eh_frame instead of .debug_frame, -eh also
+// its .eh_frame_hdr. -x uses the indexed string and address forms of DWARF5
+// (with -v5) as clang does. -p adds .debug_gnu_pubnames. -o also writes the image, e.g. to compare with
+// "cv2pdb --stats=<file>" or other DWARF consumers.
+
+#include "../src/PEImage.h"
+#include "../src/cv2pdb.h"
+#include "../src/readDwarf.h"
+#include "../src/stats.h"
+#include "dwarfgen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+
+static void fatal(const char* msg, const char* arg)
+{
+	printf("%s%s\n", msg, arg);
+	exit(1);
+}
+
+static unsigned long long walkDIEs(PEImage& img)
+{
+	unsigned long long cnt = 0;
+	DIECursor::setContext(&img);
+	const std::vector<DWARF_CompilationUnit*>& units = DIECursor::getUnits();
+	for (size_t u = 0; u < units.size(); u++)
+	{
+		DIECursor cursor(units[u], units[u]->getFirstDIE());
+		DWARF_InfoData id;
+		while (cursor.readNext(id))
+			cnt++;
+	}
+	DIECursor::setContext(0);
+	return cnt;
+}
+
+// one conversion, the phases are recorded in convStats
+static void convert(const std::vector<char>& image, const TCHAR* pdbname)
+{
+	convStats.beginPhase("loadImage");
+	PEImage img;
+	if (!img.readBuffer(image.data(), (unsigned long)image.size()))
+		fatal("cannot load image: ", img.getLastError());
+	// same as PEImage::loadExe
+	if (!img.initCVPtr(true) && !img.initDbgPtr(true) && !img.initDWARFPtr(true))
+		fatal("cannot load image: ", img.getLastError());
+
+	convStats.beginPhase("walkDIEs");
+	walkDIEs(img);
+
+	// the CFI index is built on another thread during the following phases
+	convStats.beginPhase("startCFIIndex");
+	CV2PDB cv2pdb(img);
+
+	convStats.beginPhase("openPDB");
+	DeleteFile(pdbname);
+	if (!cv2pdb.openPDB(pdbname, 0))
+		fatal("cannot create PDB: ", cv2pdb.getLastError());
+
+	convStats.beginPhase("relocateDebugLineInfo");
+	if (!img.relocateDebugLineInfo(0x400000))
+		fatal("relocateDebugLineInfo: ", img.getLastError());
+
+	convStats.beginPhase("createDWARFModules");
+	if (!cv2pdb.createDWARFModules())
+		fatal("createDWARFModules: ", cv2pdb.getLastError());
+
+	convStats.beginPhase("addDWARFTypes");
+	if (!cv2pdb.addDWARFTypes())
+		fatal("addDWARFTypes: ", cv2pdb.getLastError());
+
+	convStats.beginPhase("addDWARFLines");
+	if (!cv2pdb.addDWARFLines())
+		fatal("addDWARFLines: ", cv2pdb.getLastError());
+
+	convStats.beginPhase("addDWARFPublics");
+	if (!cv2pdb.addDWARFPublics())
+		fatal("addDWARFPublics: ", cv2pdb.getLastError());
+
+	convStats.beginPhase("cleanup"); // commits the PDB
+	cv2pdb.cleanup(true);
+	convStats.endPhase();
+}
+
+int main(int argc, char* argv[])
+{
+	DwarfGenOptions opts;
+	int iterations = 5;
+	const char* outname = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (arg[0] != '-' || !arg[1])
+			fatal("unknown argument: ", arg);
+		int val = atoi(arg + 2);
+		switch (arg[1])
+		{
+		case 'u': opts.units = val; break;
+		case 'd': opts.diesPerUnit = val; break;
+		case 't': opts.typeDepth = val; break;
+		case 'i': opts.inlinePct = val; break;
+		case 'l': opts.lineRows = val; break;
+		case 'v': opts.version = val; break;
+		case 'e': opts.ehFrame = true; opts.ehFrameHdr = arg[2] == 'h'; break;
+		case 'x': opts.indexed = true; break;
+		case 'p': opts.pubnames = true; break;
+		case 'n': iterations = val; break;
+		case 'o': outname = arg + 2; break;
+		default: fatal("unknown option: ", arg);
+		}
+	}
+	if (opts.units < 1 || opts.diesPerUnit < 1 || opts.typeDepth < 0 || opts.lineRows < 1 || iterations < 1
+	    || (opts.version != 4 && opts.version != 5))
+		fatal("invalid options", "");
+
+	DwarfGen gen(opts);
+	std::vector<char> image = gen.generate();
+	double mb = (gen.debugInfoSize() + gen.debugLineSize() + gen.frameSize()) / (1024.0 * 1024.0);
+	printf("%d units, %llu DIEs, DWARF %d, %s: .debug_info %zu, .debug_line %zu, frame %zu bytes\n",
+	       opts.units, gen.countDIEs(), opts.version, opts.ehFrame ? (opts.ehFrameHdr ? ".eh_frame+hdr" : ".eh_frame") : ".debug_frame",
+	       gen.debugInfoSize(), gen.debugLineSize(), gen.frameSize());
+
+	if (outname)
+	{
+		FILE* f = fopen(outname, "wb");
+		if (!f || fwrite(image.data(), 1, image.size(), f) != image.size() || fclose(f) != 0)
+			fatal("cannot write ", outname);
+	}
+
+	CoInitialize(nullptr);
+	TCHAR pdbname[MAX_PATH];
+	if (!GetFullPathName(TEXT("dwarfbench.pdb"), MAX_PATH, pdbname, 0))
+		fatal("cannot determine PDB file name", "");
+
+	// best time of each phase, in order of appearance
+	std::vector<const char*> names;
+	std::map<const char*, double> best;
+	unsigned long long dies = 0;
+	for (int it = 0; it < iterations; it++)
+	{
+		convStats.clear();
+		convStats.enabled = true;
+		convert(image, pdbname);
+		dies = convStats.dies;
+		for (size_t p = 0; p < convStats.phases.size(); p++)
+		{
+			const ConversionStats::Phase& phase = convStats.phases[p];
+			if (best.find(phase.name) == best.end())
+			{
+				names.push_back(phase.name);
+				best[phase.name] = phase.wall;
+			}
+			else if (phase.wall < best[phase.name])
+				best[phase.name] = phase.wall;
+		}
+	}
+	DeleteFile(pdbname);
+
+	// DIEs are decoded by walkDIEs, mapTypes and createTypes, report them against the total
+	double total = 0;
+	printf("  %-24s %10s %10s\n", "phase", "ms", "MB/s");
+	for (size_t p = 0; p < names.size(); p++)
+	{
+		double t = best[names[p]];
+		total += t;
+		printf("  %-24s %10.2f %10.1f\n", names[p], t * 1000, t > 0 ? mb / t : 0);
+	}
+	printf("  %-24s %10.2f %10.1f  %.2f M DIEs/s\n", "total", total * 1000, total > 0 ? mb / total : 0,
+	       total > 0 ? dies / total / 1e6 : 0);
+	return 0;
+}
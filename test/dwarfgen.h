@@ -0,0 +1,788 @@
+// Convert DMD CodeView/DWARF debug information to PDB files
+// Copyright (c) 2009-2012 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+//
+// Generator of synthetic x64 PE images with DWARF debug information for
+// benchmarks. The shape of the debug information is set by DwarfGenOptions:
+// each compilation unit gets structs linked into a type graph, typedef/const/
+// volatile chains over them, global variables and functions with parameters,
+// locals and inlined calls, one line number program and call frame information
+// in .debug_frame or .eh_frame. The functions and variables are also listed in
+// the COFF symbol table, as in images linked by MinGW.
+
+#ifndef __DWARFGEN_H__
+#define __DWARFGEN_H__
+
+#include "../src/dwarf.h"
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+struct DwarfGenOptions
+{
+	int units;       // number of compilation units
+	int diesPerUnit; // approximate number of DIEs per unit
+	int typeDepth;   // length of the typedef/const/volatile chains and struct links
+	int inlinePct;   // percentage of functions with an inlined call
+	int lineRows;    // rows of the line number program per unit
+	int version;     // DWARF version 4 or 5
+	bool ehFrame;    // .eh_frame instead of .debug_frame
+	bool ehFrameHdr; // with ehFrame: .eh_frame_hdr with the binary search table of the FDEs
+	bool indexed;    // DWARF5: strings and addresses as DW_FORM_strx and DW_FORM_addrx, as emitted by clang
+	bool pubnames;   // .debug_gnu_pubnames with the functions and global variables
+
+	DwarfGenOptions()
+	: units(100), diesPerUnit(1000), typeDepth(4), inlinePct(25), lineRows(2000), version(4), ehFrame(false), ehFrameHdr(false), indexed(false),
+	  pubnames(false)
+	{}
+};
+
+class DwarfGen
+{
+public:
+	static const unsigned long long kImageBase = 0x400000;
+	static const unsigned int kTextRVA = 0x1000;
+
+	explicit DwarfGen(const DwarfGenOptions& opts) : opts(opts) {}
+
+	// build the image, returns the file contents
+	std::vector<char> generate()
+	{
+		info.clear();
+		abbrev.clear();
+		line.clear();
+		str.clear();
+		frame.clear();
+		frameHdr.clear();
+		pubnames.clear();
+		strings.clear();
+		strOffsets.clear();
+		addr.clear();
+		strIndex.clear();
+		if (indexed())
+		{
+			// one table for all units, at the default bases after the headers
+			put4(strOffsets, 0); // unit_length, patched below
+			put2(strOffsets, 5);
+			put2(strOffsets, 0);
+			put4(addr, 0);
+			put2(addr, 5);
+			put1(addr, 8);
+			put1(addr, 0);
+		}
+		symbols.clear();
+		dies = 0;
+		textSize = 0;
+
+		writeAbbrev();
+		std::vector<std::vector<Function>> unitFuncs(opts.units);
+		for (int u = 0; u < opts.units; u++)
+			writeUnit(u, unitFuncs[u]);
+
+		// .eh_frame follows .text, its address is needed for pc-relative pointers
+		textSize = (textSize + 0xfff) & ~0xfff;
+		writeFrame(unitFuncs);
+		if (indexed())
+		{
+			set4(strOffsets, 0, (unsigned int)strOffsets.size() - 4);
+			set4(addr, 0, (unsigned int)addr.size() - 4);
+		}
+		return buildImage();
+	}
+
+	unsigned long long countDIEs() const { return dies; }
+	size_t debugInfoSize() const { return info.size(); }
+	size_t debugLineSize() const { return line.size(); }
+	size_t frameSize() const { return frame.size(); }
+
+private:
+	enum Abbrev
+	{
+		kCompileUnit = 1, kBaseType, kStruct, kMember, kPointer, kTypedef, kConst, kVolatile,
+		kArray, kSubrange, kSubprogram, kParameter, kVariable, kAbstractSubprogram,
+		kAbstractParameter, kInlined, kInlinedParameter, kGlobalVariable,
+	};
+	struct Function
+	{
+		unsigned int rva;
+		unsigned int size;
+		int line;
+	};
+
+	DwarfGenOptions opts;
+	std::vector<unsigned char> info, abbrev, line, str, frame, frameHdr, pubnames;
+	std::vector<unsigned char> strOffsets, addr; // .debug_str_offsets and .debug_addr
+	std::map<std::string, unsigned int> strings;
+	std::map<std::string, unsigned int> strIndex; // entries of .debug_str_offsets
+	std::vector<std::pair<std::string, unsigned int>> symbols; // name and RVA
+	unsigned long long dies;
+	unsigned int textSize;
+
+	static void put1(std::vector<unsigned char>& v, unsigned int x) { v.push_back((unsigned char)x); }
+	static void put2(std::vector<unsigned char>& v, unsigned int x) { put1(v, x); put1(v, x >> 8); }
+	static void put4(std::vector<unsigned char>& v, unsigned int x) { put2(v, x); put2(v, x >> 16); }
+	static void put8(std::vector<unsigned char>& v, unsigned long long x) { put4(v, (unsigned int)x); put4(v, (unsigned int)(x >> 32)); }
+	static void set4(std::vector<unsigned char>& v, size_t pos, unsigned int x)
+	{
+		for (int i = 0; i < 4; i++)
+			v[pos + i] = (unsigned char)(x >> (8 * i));
+	}
+	static void uleb(std::vector<unsigned char>& v, unsigned long long x)
+	{
+		do
+		{
+			unsigned char b = x & 0x7f;
+			x >>= 7;
+			put1(v, x ? b | 0x80 : b);
+		} while (x);
+	}
+	static void sleb(std::vector<unsigned char>& v, long long x)
+	{
+		for (;;)
+		{
+			unsigned char b = x & 0x7f;
+			x >>= 7;
+			if ((x == 0 && !(b & 0x40)) || (x == -1 && (b & 0x40)))
+			{
+				put1(v, b);
+				return;
+			}
+			put1(v, b | 0x80);
+		}
+	}
+	static void cstr(std::vector<unsigned char>& v, const char* s)
+	{
+		v.insert(v.end(), s, s + strlen(s) + 1);
+	}
+
+	unsigned int strp(const std::string& s)
+	{
+		std::map<std::string, unsigned int>::iterator it = strings.find(s);
+		if (it != strings.end())
+			return it->second;
+		unsigned int off = (unsigned int)str.size();
+		cstr(str, s.c_str());
+		strings[s] = off;
+		return off;
+	}
+
+	bool indexed() const { return opts.version >= 5 && opts.indexed; }
+
+	// attribute of form DW_FORM_strp or DW_FORM_strx
+	void putStr(const std::string& s)
+	{
+		if (!indexed())
+		{
+			put4(info, strp(s));
+			return;
+		}
+		std::map<std::string, unsigned int>::iterator it = strIndex.find(s);
+		if (it == strIndex.end())
+		{
+			it = strIndex.insert(std::make_pair(s, (unsigned int)strIndex.size())).first;
+			put4(strOffsets, strp(s));
+		}
+		uleb(info, it->second);
+	}
+
+	// attribute of form DW_FORM_addr or DW_FORM_addrx
+	void putAddr(unsigned long long a)
+	{
+		if (!indexed())
+		{
+			put8(info, a);
+			return;
+		}
+		uleb(info, (addr.size() - 8) / 8);
+		put8(addr, a);
+	}
+
+	////////////////////////////////////////////////////////////
+	void abbrevEntry(int code, int tag, bool children, const int* attrForms)
+	{
+		uleb(abbrev, code);
+		uleb(abbrev, tag);
+		put1(abbrev, children ? DW_CHILDREN_yes : DW_CHILDREN_no);
+		for (; attrForms[0]; attrForms += 2)
+		{
+			int form = attrForms[1];
+			if (indexed() && form == DW_FORM_strp)
+				form = DW_FORM_strx;
+			else if (indexed() && form == DW_FORM_addr)
+				form = DW_FORM_addrx;
+			uleb(abbrev, attrForms[0]);
+			uleb(abbrev, form);
+		}
+		put1(abbrev, 0);
+		put1(abbrev, 0);
+	}
+
+	void writeAbbrev()
+	{
+		static const int cu[] = { DW_AT_producer, DW_FORM_strp, DW_AT_language, DW_FORM_data2, DW_AT_name, DW_FORM_strp,
+		                          DW_AT_comp_dir, DW_FORM_strp, DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_data8,
+		                          DW_AT_stmt_list, DW_FORM_sec_offset, 0 };
+		static const int base[] = { DW_AT_byte_size, DW_FORM_data1, DW_AT_encoding, DW_FORM_data1, DW_AT_name, DW_FORM_strp, 0 };
+		static const int strct[] = { DW_AT_name, DW_FORM_strp, DW_AT_byte_size, DW_FORM_data1, DW_AT_sibling, DW_FORM_ref4, 0 };
+		static const int member[] = { DW_AT_name, DW_FORM_strp, DW_AT_type, DW_FORM_ref4, DW_AT_data_member_location, DW_FORM_data1, 0 };
+		static const int pointer[] = { DW_AT_byte_size, DW_FORM_data1, DW_AT_type, DW_FORM_ref4, 0 };
+		static const int tdef[] = { DW_AT_name, DW_FORM_strp, DW_AT_type, DW_FORM_ref4, 0 };
+		static const int type[] = { DW_AT_type, DW_FORM_ref4, 0 };
+		static const int array[] = { DW_AT_type, DW_FORM_ref4, DW_AT_sibling, DW_FORM_ref4, 0 };
+		static const int subrange[] = { DW_AT_type, DW_FORM_ref4, DW_AT_upper_bound, DW_FORM_data1, 0 };
+		static const int subprogram[] = { DW_AT_external, DW_FORM_flag_present, DW_AT_name, DW_FORM_strp,
+		                                  DW_AT_type, DW_FORM_ref4, DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_data8,
+		                                  DW_AT_frame_base, DW_FORM_exprloc, DW_AT_sibling, DW_FORM_ref4, 0 };
+		static const int param[] = { DW_AT_name, DW_FORM_strp, DW_AT_type, DW_FORM_ref4, DW_AT_location, DW_FORM_exprloc, 0 };
+		static const int absprogram[] = { DW_AT_name, DW_FORM_strp, DW_AT_type, DW_FORM_ref4, DW_AT_inline, DW_FORM_data1, 0 };
+		static const int absparam[] = { DW_AT_name, DW_FORM_strp, DW_AT_type, DW_FORM_ref4, 0 };
+		static const int inlined[] = { DW_AT_abstract_origin, DW_FORM_ref4, DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_data8,
+		                               DW_AT_call_file, DW_FORM_data1, DW_AT_call_line, DW_FORM_udata, 0 };
+		static const int inlparam[] = { DW_AT_abstract_origin, DW_FORM_ref4, DW_AT_location, DW_FORM_exprloc, 0 };
+		static const int global[] = { DW_AT_name, DW_FORM_strp, DW_AT_type, DW_FORM_ref4, DW_AT_external, DW_FORM_flag_present,
+		                              DW_AT_location, DW_FORM_exprloc, 0 };
+
+		abbrevEntry(kCompileUnit, DW_TAG_compile_unit, true, cu);
+		abbrevEntry(kBaseType, DW_TAG_base_type, false, base);
+		abbrevEntry(kStruct, DW_TAG_structure_type, true, strct);
+		abbrevEntry(kMember, DW_TAG_member, false, member);
+		abbrevEntry(kPointer, DW_TAG_pointer_type, false, pointer);
+		abbrevEntry(kTypedef, DW_TAG_typedef, false, tdef);
+		abbrevEntry(kConst, DW_TAG_const_type, false, type);
+		abbrevEntry(kVolatile, DW_TAG_volatile_type, false, type);
+		abbrevEntry(kArray, DW_TAG_array_type, true, array);
+		abbrevEntry(kSubrange, DW_TAG_subrange_type, false, subrange);
+		abbrevEntry(kSubprogram, DW_TAG_subprogram, true, subprogram);
+		abbrevEntry(kParameter, DW_TAG_formal_parameter, false, param);
+		abbrevEntry(kVariable, DW_TAG_variable, false, param);
+		abbrevEntry(kAbstractSubprogram, DW_TAG_subprogram, true, absprogram);
+		abbrevEntry(kAbstractParameter, DW_TAG_formal_parameter, false, absparam);
+		abbrevEntry(kInlined, DW_TAG_inlined_subroutine, true, inlined);
+		abbrevEntry(kInlinedParameter, DW_TAG_formal_parameter, false, inlparam);
+		abbrevEntry(kGlobalVariable, DW_TAG_variable, false, global);
+		put1(abbrev, 0);
+	}
+
+	////////////////////////////////////////////////////////////
+	// start a DIE, returns its offset in the unit
+	unsigned int die(size_t unitStart, int code)
+	{
+		dies++;
+		unsigned int off = (unsigned int)(info.size() - unitStart);
+		uleb(info, code);
+		return off;
+	}
+
+	// entry of .debug_gnu_pubnames: DIE offset in the unit, symbol kind, name
+	void pubName(unsigned int off, int kind, const char* name)
+	{
+		if (!opts.pubnames)
+			return;
+		put4(pubnames, off);
+		put1(pubnames, kind << 4);
+		pubnames.insert(pubnames.end(), name, name + strlen(name) + 1);
+	}
+
+	void fbreg(int off)
+	{
+		std::vector<unsigned char> expr;
+		put1(expr, DW_OP_fbreg);
+		sleb(expr, off);
+		uleb(info, expr.size());
+		info.insert(info.end(), expr.begin(), expr.end());
+	}
+
+	void writeUnit(int u, std::vector<Function>& funcs)
+	{
+		char name[64];
+		size_t start = info.size();
+		size_t pubStart = pubnames.size();
+		if (opts.pubnames)
+		{
+			put4(pubnames, 0); // unit_length, patched below
+			put2(pubnames, 2);
+			put4(pubnames, (unsigned int)start);
+			put4(pubnames, 0); // debug_info_length, patched below
+		}
+		put4(info, 0); // unit_length, patched below
+		put2(info, opts.version);
+		if (opts.version >= 5)
+		{
+			put1(info, DW_UT_compile);
+			put1(info, 8);
+			put4(info, 0); // abbrev_offset
+		}
+		else
+		{
+			put4(info, 0);
+			put1(info, 8);
+		}
+
+		// functions are placed after the previous unit, sized for the line rows
+		int estFuncs = opts.diesPerUnit / 12 + 1;
+		int rowsPerFunc = opts.lineRows / estFuncs + 1;
+		unsigned int funcSize = ((rowsPerFunc * 4 + 16) + 15) & ~15;
+		unsigned int unitRVA = kTextRVA + textSize;
+
+		sprintf(name, "unit%d.cpp", u);
+		die(start, kCompileUnit);
+		putStr("cv2pdb dwarfgen");
+		put2(info, DW_LANG_C_plus_plus);
+		putStr(name);
+		putStr("c:\\build");
+		putAddr(kImageBase + unitRVA);
+		size_t highpc = info.size();
+		put8(info, 0); // patched below
+		put4(info, (unsigned int)line.size());
+
+		unsigned int intType = die(start, kBaseType);
+		put1(info, 4);
+		put1(info, DW_ATE_signed);
+		putStr("int");
+		unsigned int charType = die(start, kBaseType);
+		put1(info, 1);
+		put1(info, DW_ATE_signed_char);
+		putStr("char");
+
+		// function to be inlined
+		unsigned int absFunc = die(start, kAbstractSubprogram);
+		sprintf(name, "inlined%d", u);
+		putStr(name);
+		put4(info, intType);
+		put1(info, DW_INL_declared_inlined);
+		unsigned int absParam = die(start, kAbstractParameter);
+		putStr("x");
+		put4(info, intType);
+		put1(info, 0);
+
+		unsigned int prevStruct = 0;
+		unsigned int limit = (unsigned int)(dies + opts.diesPerUnit);
+		for (int n = 0; dies < limit; n++)
+		{
+			// struct with a link to the previous struct and an array
+			unsigned int link = prevStruct ? prevStruct : intType;
+			unsigned int ptr = die(start, kPointer);
+			put1(info, 8);
+			put4(info, link);
+
+			unsigned int arr = die(start, kArray);
+			put4(info, charType);
+			size_t arrSibling = info.size();
+			put4(info, 0);
+			die(start, kSubrange);
+			put4(info, intType);
+			put1(info, 15);
+			put1(info, 0);
+			set4(info, arrSibling, (unsigned int)(info.size() - start));
+
+			unsigned int strct = die(start, kStruct);
+			sprintf(name, "S%d_%d", u, n);
+			putStr(name);
+			put1(info, 32);
+			size_t strctSibling = info.size();
+			put4(info, 0);
+			static const char* members[] = { "value", "next", "text" };
+			unsigned int memberTypes[] = { intType, ptr, arr };
+			unsigned int memberOffsets[] = { 0, 8, 16 };
+			for (int m = 0; m < 3; m++)
+			{
+				die(start, kMember);
+				putStr(members[m]);
+				put4(info, memberTypes[m]);
+				put1(info, memberOffsets[m]);
+			}
+			put1(info, 0);
+			set4(info, strctSibling, (unsigned int)(info.size() - start));
+			prevStruct = (n % (opts.typeDepth + 1)) == opts.typeDepth ? 0 : strct;
+
+			// typedef/const/volatile chain over the struct
+			unsigned int type = strct;
+			for (int d = 0; d < opts.typeDepth; d++)
+			{
+				unsigned int td = die(start, kTypedef);
+				sprintf(name, "T%d_%d_%d", u, n, d);
+				putStr(name);
+				put4(info, type);
+				type = die(start, (d & 1) ? kVolatile : kConst);
+				put4(info, td);
+			}
+			unsigned int typePtr = die(start, kPointer);
+			put1(info, 8);
+			put4(info, type);
+
+			// global variable
+			unsigned int var = die(start, kGlobalVariable);
+			sprintf(name, "g%d_%d", u, n);
+			putStr(name);
+			pubName(var, GDB_INDEX_SYMBOL_KIND_VARIABLE, name);
+			put4(info, strct);
+			uleb(info, 9);
+			put1(info, DW_OP_addr);
+			put8(info, kImageBase + kTextRVA); // not relocated to a data section
+			symbols.push_back(std::make_pair(std::string(name), kTextRVA));
+
+			// function
+			Function f = { unitRVA + (unsigned int)funcs.size() * funcSize, funcSize, 10 + n * 100 };
+			funcs.push_back(f);
+			unsigned int func = die(start, kSubprogram);
+			sprintf(name, "f%d_%d", u, n);
+			putStr(name);
+			pubName(func, GDB_INDEX_SYMBOL_KIND_FUNCTION, name);
+			symbols.push_back(std::make_pair(std::string(name), f.rva));
+			put4(info, intType);
+			putAddr(kImageBase + f.rva);
+			put8(info, f.size);
+			uleb(info, 1);
+			put1(info, DW_OP_call_frame_cfa);
+			size_t funcSibling = info.size();
+			put4(info, 0);
+
+			die(start, kParameter);
+			putStr("self");
+			put4(info, typePtr);
+			fbreg(-24);
+			die(start, kParameter);
+			putStr("count");
+			put4(info, intType);
+			fbreg(-28);
+			die(start, kVariable);
+			putStr("local");
+			put4(info, strct);
+			fbreg(-64);
+			if ((n * 37 + u * 11) % 100 < opts.inlinePct)
+			{
+				die(start, kInlined);
+				put4(info, absFunc);
+				putAddr(kImageBase + f.rva + 8);
+				put8(info, 8);
+				put1(info, 1);
+				uleb(info, f.line + 2);
+				die(start, kInlinedParameter);
+				put4(info, absParam);
+				fbreg(-32);
+				put1(info, 0);
+			}
+			put1(info, 0);
+			set4(info, funcSibling, (unsigned int)(info.size() - start));
+		}
+		put1(info, 0);
+		set4(info, start, (unsigned int)(info.size() - start - 4));
+		if (opts.pubnames)
+		{
+			put4(pubnames, 0);
+			set4(pubnames, pubStart, (unsigned int)(pubnames.size() - pubStart - 4));
+			set4(pubnames, pubStart + 10, (unsigned int)(info.size() - start));
+		}
+
+		unsigned int unitSize = (unsigned int)funcs.size() * funcSize;
+		for (int i = 0; i < 8; i++)
+			info[highpc + i] = (unsigned char)((unsigned long long)unitSize >> (8 * i));
+		textSize += unitSize;
+
+		writeLines(u, funcs, rowsPerFunc);
+	}
+
+	////////////////////////////////////////////////////////////
+	void writeLines(int u, const std::vector<Function>& funcs, int rowsPerFunc)
+	{
+		static const unsigned char opcodeLengths[12] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+		const int lineBase = -5, lineRange = 14, opcodeBase = 13;
+		char name[64];
+		sprintf(name, "unit%d.cpp", u);
+
+		size_t start = line.size();
+		put4(line, 0); // unit_length
+		put2(line, opts.version);
+		if (opts.version >= 5)
+		{
+			put1(line, 8); // address_size
+			put1(line, 0); // segment_selector_size
+		}
+		size_t headerLength = line.size();
+		put4(line, 0);
+		put1(line, 1); // minimum_instruction_length
+		if (opts.version >= 4)
+			put1(line, 1); // maximum_operations_per_instruction
+		put1(line, 1); // default_is_stmt
+		put1(line, (unsigned char)lineBase);
+		put1(line, lineRange);
+		put1(line, opcodeBase);
+		line.insert(line.end(), opcodeLengths, opcodeLengths + 12);
+		if (opts.version >= 5)
+		{
+			put1(line, 1); // directory_entry_format
+			uleb(line, DW_LNCT_path);
+			uleb(line, DW_FORM_string);
+			uleb(line, 2);
+			cstr(line, "c:\\build");
+			cstr(line, "src");
+			put1(line, 2); // file_name_entry_format
+			uleb(line, DW_LNCT_path);
+			uleb(line, DW_FORM_string);
+			uleb(line, DW_LNCT_directory_index);
+			uleb(line, DW_FORM_udata);
+			uleb(line, 2);
+			cstr(line, name);
+			uleb(line, 1);
+			cstr(line, name); // file 1 is used as in DWARF 4
+			uleb(line, 1);
+		}
+		else
+		{
+			cstr(line, "src");
+			put1(line, 0);
+			cstr(line, name);
+			uleb(line, 1);
+			uleb(line, 0);
+			uleb(line, 0);
+			put1(line, 0);
+		}
+		set4(line, headerLength, (unsigned int)(line.size() - headerLength - 4));
+
+		int curLine = 1;
+		unsigned int addr = 0;
+		for (size_t f = 0; f < funcs.size(); f++)
+		{
+			put1(line, 0); // DW_LNE_set_address
+			uleb(line, 9);
+			put1(line, DW_LNE_set_address);
+			put8(line, kImageBase + funcs[f].rva);
+			put1(line, DW_LNS_advance_line);
+			sleb(line, funcs[f].line - curLine);
+			put1(line, DW_LNS_copy);
+			curLine = funcs[f].line;
+			addr = funcs[f].rva;
+			for (int r = 1; r < rowsPerFunc; r++)
+			{
+				// one line and 4 bytes further
+				put1(line, (1 - lineBase) + lineRange * 4 + opcodeBase);
+				curLine++;
+				addr += 4;
+			}
+		}
+		if (!funcs.empty())
+		{
+			put1(line, DW_LNS_advance_pc);
+			uleb(line, funcs.back().rva + funcs.back().size - addr);
+		}
+		put1(line, 0);
+		uleb(line, 1);
+		put1(line, DW_LNE_end_sequence);
+		set4(line, start, (unsigned int)(line.size() - start - 4));
+	}
+
+	////////////////////////////////////////////////////////////
+	void pad(size_t start)
+	{
+		while ((frame.size() - start) % 8)
+			put1(frame, DW_CFA_nop);
+	}
+
+	void writeFrame(const std::vector<std::vector<Function>>& unitFuncs)
+	{
+		unsigned int frameRVA = kTextRVA + textSize;
+
+		size_t cie = frame.size();
+		put4(frame, 0);
+		put4(frame, opts.ehFrame ? 0 : 0xffffffff);
+		put1(frame, 1); // version
+		cstr(frame, opts.ehFrame ? "zR" : "");
+		uleb(frame, 1);  // code alignment
+		sleb(frame, -8); // data alignment
+		put1(frame, 16); // return address register
+		if (opts.ehFrame)
+		{
+			uleb(frame, 1);
+			put1(frame, DW_EH_PE_pcrel | DW_EH_PE_sdata4);
+		}
+		put1(frame, DW_CFA_def_cfa);
+		uleb(frame, 7);
+		uleb(frame, 8);
+		put1(frame, DW_CFA_offset | 16);
+		uleb(frame, 1);
+		pad(cie + 4);
+		set4(frame, cie, (unsigned int)(frame.size() - cie - 4));
+
+		std::vector<std::pair<unsigned int, unsigned int>> table; // RVAs of the functions and FDEs
+		for (size_t u = 0; u < unitFuncs.size(); u++)
+			for (size_t f = 0; f < unitFuncs[u].size(); f++)
+			{
+				const Function& func = unitFuncs[u][f];
+				size_t fde = frame.size();
+				table.push_back(std::make_pair(func.rva, frameRVA + (unsigned int)fde));
+				put4(frame, 0);
+				if (opts.ehFrame)
+				{
+					put4(frame, (unsigned int)(frame.size() - cie)); // relative to this field
+					put4(frame, func.rva - (frameRVA + (unsigned int)frame.size()));
+					put4(frame, func.size);
+					uleb(frame, 0); // augmentation data
+				}
+				else
+				{
+					put4(frame, (unsigned int)cie);
+					put8(frame, kImageBase + func.rva);
+					put8(frame, func.size);
+				}
+				put1(frame, DW_CFA_advance_loc | 1);
+				put1(frame, DW_CFA_def_cfa_offset);
+				uleb(frame, 16);
+				put1(frame, DW_CFA_offset | 6);
+				uleb(frame, 2);
+				put1(frame, DW_CFA_advance_loc | 3);
+				put1(frame, DW_CFA_def_cfa_register);
+				uleb(frame, 6);
+				pad(fde + 4);
+				set4(frame, fde, (unsigned int)(frame.size() - fde - 4));
+			}
+		if (opts.ehFrame)
+			put4(frame, 0); // terminator
+
+		if (opts.ehFrame && opts.ehFrameHdr)
+		{
+			// .eh_frame_hdr follows .eh_frame
+			unsigned int hdrRVA = frameRVA + (((unsigned int)frame.size() + 0xfff) & ~0xfff);
+			std::sort(table.begin(), table.end());
+			put1(frameHdr, 1); // version
+			put1(frameHdr, DW_EH_PE_pcrel | DW_EH_PE_sdata4);
+			put1(frameHdr, DW_EH_PE_udata4);
+			put1(frameHdr, DW_EH_PE_datarel | DW_EH_PE_sdata4);
+			put4(frameHdr, frameRVA - (hdrRVA + (unsigned int)frameHdr.size()));
+			put4(frameHdr, (unsigned int)table.size());
+			for (size_t i = 0; i < table.size(); i++)
+			{
+				put4(frameHdr, table[i].first - hdrRVA);
+				put4(frameHdr, table[i].second - hdrRVA);
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////
+	std::vector<char> buildImage()
+	{
+		struct Section
+		{
+			const char* name;
+			const std::vector<unsigned char>* data;
+			unsigned int size;
+		};
+		std::vector<Section> sections;
+		Section text = { ".text", 0, textSize };
+		sections.push_back(text);
+		Section fr = { opts.ehFrame ? ".eh_frame" : ".debug_frame", &frame, (unsigned int)frame.size() };
+		sections.push_back(fr);
+		if (!frameHdr.empty())
+		{
+			Section hdr = { ".eh_frame_hdr", &frameHdr, (unsigned int)frameHdr.size() };
+			sections.push_back(hdr);
+		}
+		Section dbg[] = { { ".debug_abbrev", &abbrev }, { ".debug_info", &info }, { ".debug_line", &line }, { ".debug_str", &str },
+		                  { ".debug_str_offsets", &strOffsets }, { ".debug_addr", &addr } };
+		for (int i = 0; i < (indexed() ? 6 : 4); i++)
+		{
+			dbg[i].size = (unsigned int)dbg[i].data->size();
+			sections.push_back(dbg[i]);
+		}
+		if (opts.pubnames)
+		{
+			Section pub = { ".debug_gnu_pubnames", &pubnames, (unsigned int)pubnames.size() };
+			sections.push_back(pub);
+		}
+
+		const unsigned int fileAlign = 0x200, sectAlign = 0x1000;
+		int nsec = (int)sections.size();
+		unsigned int hdrSize = sizeof(IMAGE_DOS_HEADER) + sizeof(IMAGE_NT_HEADERS64) + nsec * sizeof(IMAGE_SECTION_HEADER);
+		hdrSize = (hdrSize + fileAlign - 1) & ~(fileAlign - 1);
+
+		std::vector<IMAGE_SECTION_HEADER> hdrs(nsec);
+		memset(hdrs.data(), 0, nsec * sizeof(IMAGE_SECTION_HEADER));
+		std::string strtab(4, '\0');
+		unsigned int off = hdrSize, rva = kTextRVA;
+		for (int s = 0; s < nsec; s++)
+		{
+			if (strlen(sections[s].name) <= 8)
+				memcpy(hdrs[s].Name, sections[s].name, strlen(sections[s].name));
+			else
+			{
+				// long section names are stored in the COFF string table
+				sprintf((char*)hdrs[s].Name, "/%d", (int)strtab.size());
+				strtab += sections[s].name;
+				strtab += '\0';
+			}
+			hdrs[s].Misc.VirtualSize = sections[s].size;
+			hdrs[s].VirtualAddress = rva;
+			hdrs[s].SizeOfRawData = (sections[s].size + fileAlign - 1) & ~(fileAlign - 1);
+			hdrs[s].PointerToRawData = off;
+			hdrs[s].Characteristics = s == 0 ? IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ
+			                                 : IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | (s > 1 ? IMAGE_SCN_MEM_DISCARDABLE : 0);
+			off += hdrs[s].SizeOfRawData;
+			rva += (sections[s].size + sectAlign - 1) & ~(sectAlign - 1);
+		}
+		// symbols of the .text section
+		std::vector<IMAGE_SYMBOL> syms(symbols.size());
+		memset(syms.data(), 0, syms.size() * sizeof(IMAGE_SYMBOL));
+		for (size_t i = 0; i < symbols.size(); i++)
+		{
+			const std::string& symname = symbols[i].first;
+			if (symname.size() <= 8)
+				memcpy(syms[i].N.ShortName, symname.data(), symname.size());
+			else
+			{
+				syms[i].N.Name.Long = (DWORD)strtab.size();
+				strtab += symname;
+				strtab += '\0';
+			}
+			syms[i].Value = symbols[i].second - kTextRVA;
+			syms[i].SectionNumber = 1;
+			syms[i].StorageClass = IMAGE_SYM_CLASS_EXTERNAL;
+		}
+		unsigned int symsize = (unsigned int)syms.size() * IMAGE_SIZEOF_SYMBOL;
+		unsigned int strsize = (unsigned int)strtab.size();
+		memcpy(&strtab[0], &strsize, 4);
+
+		std::vector<char> img(off + symsize + strsize);
+		IMAGE_DOS_HEADER* dos = (IMAGE_DOS_HEADER*)img.data();
+		dos->e_magic = IMAGE_DOS_SIGNATURE;
+		dos->e_lfanew = sizeof(IMAGE_DOS_HEADER);
+
+		IMAGE_NT_HEADERS64* nt = (IMAGE_NT_HEADERS64*)(img.data() + sizeof(IMAGE_DOS_HEADER));
+		nt->Signature = IMAGE_NT_SIGNATURE;
+		nt->FileHeader.Machine = IMAGE_FILE_MACHINE_AMD64;
+		nt->FileHeader.NumberOfSections = (WORD)nsec;
+		nt->FileHeader.PointerToSymbolTable = off;
+		nt->FileHeader.NumberOfSymbols = (DWORD)syms.size();
+		nt->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER64);
+		nt->FileHeader.Characteristics = IMAGE_FILE_EXECUTABLE_IMAGE | IMAGE_FILE_LARGE_ADDRESS_AWARE;
+		IMAGE_OPTIONAL_HEADER64& opt = nt->OptionalHeader;
+		opt.Magic = IMAGE_NT_OPTIONAL_HDR64_MAGIC;
+		opt.SizeOfCode = textSize;
+		opt.AddressOfEntryPoint = kTextRVA;
+		opt.BaseOfCode = kTextRVA;
+		opt.ImageBase = kImageBase;
+		opt.SectionAlignment = sectAlign;
+		opt.FileAlignment = fileAlign;
+		opt.MajorOperatingSystemVersion = 6;
+		opt.MajorSubsystemVersion = 6;
+		opt.SizeOfImage = rva;
+		opt.SizeOfHeaders = hdrSize;
+		opt.Subsystem = IMAGE_SUBSYSTEM_WINDOWS_CUI;
+		opt.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+		memcpy(nt + 1, hdrs.data(), nsec * sizeof(IMAGE_SECTION_HEADER));
+
+		for (int s = 1; s < nsec; s++)
+			memcpy(img.data() + hdrs[s].PointerToRawData, sections[s].data->data(), sections[s].size);
+		for (size_t i = 0; i < syms.size(); i++)
+			memcpy(img.data() + off + i * IMAGE_SIZEOF_SYMBOL, &syms[i], IMAGE_SIZEOF_SYMBOL);
+		memcpy(img.data() + off + symsize, strtab.data(), strsize);
+		return img;
+	}
+};
+
+#endif //__DWARFGEN_H__
@@ -0,0 +1,140 @@
+// Convert DMD CodeView/DWARF debug information to PDB files
+// Copyright (c) 2009-2012 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+//
+// libFuzzer harness for the DWARF readers (DIECursor, location expressions,
+// line number programs and call frame information)
+//   nmake fuzz_dwarf
+//
+// The input is a list of sections, each given by a byte selecting the section
+// name, a 4 byte little endian length and the section data. It is wrapped into
+// a COFF object file and passed through the same code as "cv2pdb file.obj".
+
+#include "../src/PEImage.h"
+#include "../src/cv2pdb.h"
+#include "../src/readDwarf.h"
+#include "../src/dwarf.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const char* sectionNames[] =
+{
+	".debug_info", ".debug_abbrev", ".debug_line", ".debug_line_str", ".debug_str",
+	".debug_str_offsets", ".debug_addr", ".debug_types", ".debug_ranges", ".debug_rnglists",
+	".debug_loc", ".debug_loclists", ".debug_frame", ".eh_frame", ".debug_aranges",
+	".eh_frame_hdr",
+};
+static const int kNumSectionNames = sizeof(sectionNames) / sizeof(sectionNames[0]);
+
+// build a COFF object file with a .text section and the sections in DATA
+static std::vector<char> buildObject(const unsigned char* data, size_t size)
+{
+	std::vector<int> names;
+	std::vector<std::pair<const unsigned char*, unsigned long>> sections;
+	while (size >= 5)
+	{
+		int name = data[0] % kNumSectionNames;
+		unsigned long len = data[1] | data[2] << 8 | data[3] << 16 | (unsigned long)data[4] << 24;
+		data += 5;
+		size -= 5;
+		if (len > size)
+			len = (unsigned long)size;
+		names.push_back(name);
+		sections.push_back(std::make_pair(data, len));
+		data += len;
+		size -= len;
+	}
+
+	const unsigned long textSize = 0x100;
+	int nsec = (int)sections.size() + 1;
+	unsigned long off = sizeof(IMAGE_FILE_HEADER) + nsec * sizeof(IMAGE_SECTION_HEADER);
+
+	std::vector<IMAGE_SECTION_HEADER> hdrs(nsec);
+	std::string strtab(4, '\0');
+	memset(hdrs.data(), 0, nsec * sizeof(IMAGE_SECTION_HEADER));
+	memcpy(hdrs[0].Name, ".text", 5);
+	hdrs[0].SizeOfRawData = textSize;
+	hdrs[0].PointerToRawData = off;
+	hdrs[0].Characteristics = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ;
+	off += textSize;
+	for (int s = 1; s < nsec; s++)
+	{
+		// section names longer than 8 characters are stored in the string table
+		sprintf((char*)hdrs[s].Name, "/%d", (int)strtab.size());
+		strtab += sectionNames[names[s - 1]];
+		strtab += '\0';
+		hdrs[s].SizeOfRawData = sections[s - 1].second;
+		hdrs[s].PointerToRawData = off;
+		hdrs[s].Characteristics = IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_DISCARDABLE;
+		off += sections[s - 1].second;
+	}
+	unsigned long strsize = (unsigned long)strtab.size();
+	memcpy(&strtab[0], &strsize, 4);
+
+	IMAGE_FILE_HEADER fhdr;
+	memset(&fhdr, 0, sizeof(fhdr));
+	fhdr.Machine = IMAGE_FILE_MACHINE_AMD64;
+	fhdr.NumberOfSections = (WORD)nsec;
+	fhdr.PointerToSymbolTable = off; // no symbols, string table follows immediately
+	fhdr.NumberOfSymbols = 0;
+
+	std::vector<char> obj(off + strsize);
+	memcpy(obj.data(), &fhdr, sizeof(fhdr));
+	memcpy(obj.data() + sizeof(fhdr), hdrs.data(), nsec * sizeof(IMAGE_SECTION_HEADER));
+	for (int s = 1; s < nsec; s++)
+		memcpy(obj.data() + hdrs[s].PointerToRawData, sections[s - 1].first, sections[s - 1].second);
+	memcpy(obj.data() + off, strtab.data(), strsize);
+	return obj;
+}
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+	freopen("NUL", "w", stdout); // discard warnings and the line number dump
+	return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size)
+{
+	if (size > (1 << 20))
+		return 0;
+	std::vector<char> obj = buildObject(data, size);
+
+	PEImage img;
+	if (!img.readBuffer(obj.data(), (unsigned long)obj.size()) || !img.initDWARFObject())
+		return 0;
+
+	DIECursor::setContext(&img);
+	{
+		CV2PDB cv(img); // builds the CFI index
+		const std::vector<DWARF_CompilationUnit*>& units = DIECursor::getUnits();
+		for (size_t u = 0; u < units.size(); u++)
+		{
+			DIECursor::cacheUnit((size & 1) ? units[u] : 0); // both with and without DIETable
+			DIECursor cursor(units[u], units[u]->getFirstDIE());
+			DWARF_InfoData id;
+			for (int n = 0; n < 100000 && cursor.readNext(id); n++)
+			{
+				if (id.specification)
+					mergeSpecification(id, cursor.cu);
+				if (id.abstract_origin)
+					mergeAbstractOrigin(id, cursor.cu);
+
+				Location frameBase = decodeLocation(img, id.frame_base, 0, DW_AT_frame_base);
+				decodeLocation(img, id.location, &frameBase);
+				decodeLocation(img, id.member_location, 0, DW_AT_data_member_location);
+				if (id.tag == DW_TAG_subprogram && id.pclo < id.pchi)
+					cv.getProcCFA(id.pclo, id.pchi);
+				if (id.hasChild && (n & 1))
+					cursor.gotoSibling();
+			}
+		}
+		DIECursor::cacheUnit(0);
+		interpretDWARFLines(img, 0);
+	}
+	DIECursor::setContext(0);
+	return 0;
+}
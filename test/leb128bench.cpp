@@ -0,0 +1,89 @@
+// Convert DMD CodeView/DWARF debug information to PDB files
+// Copyright (c) 2009-2012 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+//
+// microbenchmark of the LEB128 decoders in readDwarf.h
+//   nmake leb128bench
+
+#include "../src/readDwarf.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static const int kValues = 1 << 20;
+static const int kRounds = 50;
+
+// encode KVALUES values, PERCENT1 of them fit into a single byte, the rest use 2 to 5 bytes
+static std::vector<byte> makeData(int percent1, bool sign)
+{
+	std::vector<byte> data;
+	srand(42);
+	for (int i = 0; i < kValues; i++)
+	{
+		int len = rand() % 100 < percent1 ? 1 : 2 + (rand() % 100 < 70 ? 0 : rand() % 4);
+		unsigned int v = ((unsigned)rand() << 16 | rand()) & (len >= 5 ? ~0u : (1u << (7 * len)) - 1);
+		if (sign)
+			v &= (len >= 5 ? ~0u : (1u << (7 * len - 1)) - 1); // keep sign bit clear to fit
+		for (int b = 0; b < len; b++)
+			data.push_back((byte)((v >> (7 * b)) & 0x7f) | (b < len - 1 ? 0x80 : 0));
+	}
+	data.resize(data.size() + 16); // padding, as for PEImage sections
+	return data;
+}
+
+template<typename T>
+static double bench(const char* name, std::vector<byte>& data, T (*decode)(byte*&))
+{
+	unsigned long long sum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < kRounds; r++)
+	{
+		byte* p = data.data();
+		for (int i = 0; i < kValues; i++)
+			sum += decode(p);
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	double ns = std::chrono::duration<double, std::nano>(end - start).count() / ((double)kValues * kRounds);
+	printf("  %-16s %6.2f ns/value (checksum %llx)\n", name, ns, sum);
+	return ns;
+}
+
+static unsigned int pairDecode(byte* &p)
+{
+	unsigned int a, b;
+	LEB128x2(p, a, b);
+	return a + b;
+}
+static unsigned int pairScalar(byte* &p)
+{
+	unsigned int a = LEB128_scalar(p);
+	return a + LEB128_scalar(p);
+}
+
+int main()
+{
+	static const int dist[] = { 100, 90, 50, 0 };
+	for (int d = 0; d < sizeof(dist) / sizeof(dist[0]); d++)
+	{
+		printf("%d%% single byte values:\n", dist[d]);
+		std::vector<byte> udata = makeData(dist[d], false);
+		double s = bench("LEB128_scalar", udata, LEB128_scalar);
+		double f = bench("LEB128", udata, LEB128);
+		printf("  speedup %.2f\n", s / f);
+
+		std::vector<byte> sdata = makeData(dist[d], true);
+		s = bench("SLEB128_scalar", sdata, SLEB128_scalar);
+		f = bench("SLEB128", sdata, SLEB128);
+		printf("  speedup %.2f\n", s / f);
+
+		// pairs, as in abbreviation attribute lists (kValues is even)
+		s = bench("2x LEB128_scalar", udata, pairScalar);
+		f = bench("LEB128x2", udata, pairDecode);
+		printf("  speedup %.2f\n", s / f);
+	}
+	return 0;
+}
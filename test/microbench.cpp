@@ -0,0 +1,362 @@
+// Convert DMD CodeView/DWARF debug information to PDB files
+// Copyright (c) 2009-2012 by Rainer Schuetze, All Rights Reserved
+//
+// License for redistribution is given by the Artistic License 2.0
+// see file LICENSE for further details
+//
+// microbenchmarks of the DWARF decoders and symbol helpers
+//   nmake microbench
+//   microbench [filter]
+//
+// Each benchmark runs until it has taken at least kMinTime and reports the
+// time per operation. The inputs are fixed: the DWARF data is produced by
+// dwarfgen.h with the options below, the location expressions and symbol
+// names are listed here. Only benchmarks with FILTER in their name are run.
+
+#include "../src/PEImage.h"
+#include "../src/cv2pdb.h"
+#include "../src/readDwarf.h"
+#include "../src/symutil.h"
+#include "../src/demangle.h"
+#include "dwarfgen.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static const double kMinTime = 0.2; // seconds
+
+static PEImage* img;
+static CV2PDB* cv;
+
+// a benchmark executes N operations and returns a checksum, so the work is not optimized away
+typedef unsigned long long (*BenchFunc)(int n);
+
+static void run(const char* filter, const char* name, BenchFunc func)
+{
+	if (filter && !strstr(name, filter))
+		return;
+	unsigned long long sum = 0;
+	double secs = 0;
+	int n = 1;
+	for (;;)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		sum += func(n);
+		auto end = std::chrono::high_resolution_clock::now();
+		secs = std::chrono::duration<double>(end - start).count();
+		if (secs >= kMinTime || n >= (1 << 30))
+			break;
+		// aim for 1.5 times the minimum time, but grow by 10 at most
+		double scale = secs > 0 ? kMinTime * 1.5 / secs : 10;
+		n = (int)(n * (scale < 10 ? scale : 10)) + 1;
+	}
+	printf("  %-32s %10.2f ns/op %12d ops (checksum %llx)\n", name, secs * 1e9 / n, n, sum);
+}
+
+////////////////////////////////////////////////////////////
+// LEB128 values with the distribution of a .debug_info section: mostly one byte,
+// some with 2 to 5 bytes
+static std::vector<byte> lebData;
+static const int kLEBValues = 1 << 16;
+
+static void makeLEBData()
+{
+	srand(42);
+	for (int i = 0; i < kLEBValues; i++)
+	{
+		int len = rand() % 100 < 80 ? 1 : 2 + rand() % 4;
+		unsigned int v = ((unsigned)rand() << 16 | rand()) & (len >= 5 ? 0x7fffffff : (1u << (7 * len - 1)) - 1);
+		for (int b = 0; b < len; b++)
+			lebData.push_back((byte)((v >> (7 * b)) & 0x7f) | (b < len - 1 ? 0x80 : 0));
+	}
+	lebData.resize(lebData.size() + PEImage::kSectionPadding);
+}
+
+static unsigned long long benchLEB128(int n)
+{
+	unsigned long long sum = 0;
+	byte* p = lebData.data();
+	for (int i = 0, k = 0; i < n; i++, k++)
+	{
+		if (k == kLEBValues)
+			p = lebData.data(), k = 0;
+		sum += LEB128(p);
+	}
+	return sum;
+}
+
+static unsigned long long benchSLEB128(int n)
+{
+	unsigned long long sum = 0;
+	byte* p = lebData.data();
+	for (int i = 0, k = 0; i < n; i++, k++)
+	{
+		if (k == kLEBValues)
+			p = lebData.data(), k = 0;
+		sum += SLEB128(p);
+	}
+	return sum;
+}
+
+// sizes of the fixed size forms, cycling through 1, 2, 4 and 8 bytes
+static unsigned long long benchRDsize(int n)
+{
+	static const int sizes[4] = { 4, 1, 8, 2 };
+	unsigned long long sum = 0;
+	byte* p = lebData.data();
+	byte* end = lebData.data() + kLEBValues - 8;
+	for (int i = 0; i < n; i++)
+	{
+		if (p >= end)
+			p = lebData.data();
+		sum += RDsize(p, sizes[i & 3]);
+	}
+	return sum;
+}
+
+////////////////////////////////////////////////////////////
+static unsigned long long benchAbbrevHit(int n)
+{
+	DWARF_CompilationUnit* cu = DIECursor::getUnits()[0];
+	DIECursor cursor(cu, cu->getFirstDIE());
+	unsigned long long sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += (size_t)cursor.getDWARFAbbrev(0, 1 + i % 18);
+	return sum;
+}
+
+// codes not in the table, each lookup searches all abbreviations of the unit
+static unsigned long long benchAbbrevMiss(int n)
+{
+	DWARF_CompilationUnit* cu = DIECursor::getUnits()[0];
+	DIECursor cursor(cu, cu->getFirstDIE());
+	unsigned long long sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += (size_t)cursor.getDWARFAbbrev(0, 100 + (i & 7));
+	return sum;
+}
+
+// all DIEs of the first units, counting each DIE as an operation
+static unsigned long long walkUnits(int n)
+{
+	const std::vector<DWARF_CompilationUnit*>& units = DIECursor::getUnits();
+	unsigned long long sum = 0;
+	DWARF_InfoData id;
+	for (int i = 0; i < n; )
+		for (size_t u = 0; u < units.size() && i < n; u++)
+		{
+			DIECursor cursor(units[u], units[u]->getFirstDIE());
+			for (; i < n && cursor.readNext(id); i++)
+				sum += id.tag;
+		}
+	return sum;
+}
+
+static unsigned long long benchReadNext(int n)
+{
+	DIECursor::cacheUnit(0);
+	return walkUnits(n);
+}
+
+static unsigned long long benchReadNextTable(int n)
+{
+	// the table is built once, as for the repeated traversals of createTypes
+	DWARF_CompilationUnit* cu = DIECursor::getUnits()[0];
+	DIECursor::cacheUnit(cu);
+	unsigned long long sum = 0;
+	DWARF_InfoData id;
+	for (int i = 0; i < n; )
+	{
+		DIECursor cursor(cu, cu->getFirstDIE());
+		for (; i < n && cursor.readNext(id); i++)
+			sum += id.tag;
+	}
+	DIECursor::cacheUnit(0);
+	return sum;
+}
+
+////////////////////////////////////////////////////////////
+// common location expressions, as emitted by gcc and clang
+static const byte exprFbreg[] = { DW_OP_fbreg, 0x68 };          // fbreg -24
+static const byte exprBreg[] = { DW_OP_breg6, 0x10 };           // rbp + 16
+static const byte exprReg[] = { DW_OP_reg3 };                   // rbx
+static const byte exprAddr[] = { DW_OP_addr, 0x00, 0x10, 0x40, 0, 0, 0, 0, 0 };
+static const byte exprCFA[] = { DW_OP_call_frame_cfa };
+static const byte exprMember[] = { DW_OP_plus_uconst, 0x90, 0x01 }; // member at offset 144
+
+static Location decodeExpr(const byte* expr, unsigned len, const Location* frameBase, int at = 0)
+{
+	DWARF_Attribute attr;
+	attr.type = ExprLoc;
+	attr.expr.ptr = (byte*)expr;
+	attr.expr.len = len;
+	return decodeLocation(*img, attr, frameBase, at);
+}
+
+static unsigned long long benchDecodeLocation(int n)
+{
+	Location frameBase = { Location::RegRel, 6, 16 };
+	unsigned long long sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		Location loc;
+		switch (i % 6)
+		{
+		case 0: loc = decodeExpr(exprFbreg, sizeof(exprFbreg), &frameBase); break;
+		case 1: loc = decodeExpr(exprBreg, sizeof(exprBreg), &frameBase); break;
+		case 2: loc = decodeExpr(exprReg, sizeof(exprReg), &frameBase); break;
+		case 3: loc = decodeExpr(exprAddr, sizeof(exprAddr), &frameBase); break;
+		case 4: loc = decodeExpr(exprCFA, sizeof(exprCFA), 0, DW_AT_frame_base); break;
+		case 5: loc = decodeExpr(exprMember, sizeof(exprMember), 0, DW_AT_data_member_location); break;
+		}
+		sum += loc.type + loc.reg + loc.off;
+	}
+	return sum;
+}
+
+////////////////////////////////////////////////////////////
+// function ranges of the generated image
+static std::vector<std::pair<unsigned int, unsigned int>> procRanges;
+
+static void collectProcRanges()
+{
+	const std::vector<DWARF_CompilationUnit*>& units = DIECursor::getUnits();
+	for (size_t u = 0; u < units.size(); u++)
+	{
+		DIECursor cursor(units[u], units[u]->getFirstDIE());
+		DWARF_InfoData id;
+		while (cursor.readNext(id))
+			if (id.tag == DW_TAG_subprogram && id.pclo < id.pchi)
+				procRanges.push_back(std::make_pair((unsigned int)id.pclo, (unsigned int)id.pchi));
+	}
+}
+
+// CFIIndex::lookup and readFDE, getProcCFA does not use the table of build_cfa_table yet
+static unsigned long long benchCFILookup(int n)
+{
+	unsigned long long sum = 0;
+	size_t k = 0;
+	for (int i = 0; i < n; i++)
+	{
+		const std::pair<unsigned int, unsigned int>& r = procRanges[k];
+		k = (k + 7919) % procRanges.size(); // jump around in the index
+		Location cfa = cv->getProcCFA(r.first, r.second);
+		sum += cfa.reg + cfa.off;
+	}
+	return sum;
+}
+
+////////////////////////////////////////////////////////////
+static unsigned long long benchFindSymbol(int n)
+{
+	static const char* names[] = { "f0_1", "g3_20", "f17_42", "f40_3" };
+	unsigned long long sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		unsigned long off;
+		bool dllimport;
+		sum += img->findSymbol(names[i & 3], off, dllimport) + off;
+	}
+	return sum;
+}
+
+// not found, tries the "_", "__imp_" and "__imp__" prefixes
+static unsigned long long benchFindSymbolMiss(int n)
+{
+	static const char* names[] = { "printf", "_D3std5stdio6writefFAyaZv" };
+	unsigned long long sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		unsigned long off;
+		bool dllimport;
+		sum += img->findSymbol(names[i & 1], off, dllimport);
+	}
+	return sum;
+}
+
+////////////////////////////////////////////////////////////
+// D symbols, including templates and the compressed name emitted by old versions of DMD
+static const char* dSymbols[] =
+{
+	"_D3std5stdio6writefFAyaZv",
+	"_D4test3fooAa",
+	"_D8demangle4testFLC6ObjectLDFLiZiZi",
+	"_D4test34__T3barVG3uw3_616263VG3wd3_646566Z1xi",
+	"_D4test58__T9factorialVde67666666666666860140VG5aa5_68656c6c6fVPvnZ9factorialf",
+	"_D3std9algorithm9iteration__T9MapResultS_DQBm10functional__T8unaryFunVAyaa5_612b2b31VQpa1_61Z7unaryFunTAiZQCy5frontMFNaNbNdNiNfZi",
+};
+static const char dCompressed[] = "_D12intellisen\xd1" "11LibraryInfo14findDe\xeaitionMFKS\x80\x8f\xaf" "0SearchDataZA\x80\x91\x9d\x80\x8a\xbb"
+                                  "8count\x80\x83\x90MFAyaP\x80\x8f\xaa" "9JSONscopeH\x80\x83\x93S3std4json\x80\x85\x98ValueZb";
+static const int kDSymbols = sizeof(dSymbols) / sizeof(dSymbols[0]);
+
+static unsigned long long benchDsym2c(int n)
+{
+	char buf[kMaxNameLen];
+	unsigned long long sum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		int k = i % (kDSymbols + 1);
+		const char* sym = k < kDSymbols ? dSymbols[k] : dCompressed;
+		int len = k < kDSymbols ? (int)strlen(sym) : (int)sizeof(dCompressed) - 1;
+		sum += dsym2c((const BYTE*)sym, len, buf, sizeof(buf));
+	}
+	return sum;
+}
+
+static unsigned long long benchDemangle(int n)
+{
+	char buf[kMaxNameLen];
+	unsigned long long sum = 0;
+	for (int i = 0; i < n; i++)
+		if (d_demangle(dSymbols[i % kDSymbols], buf, sizeof(buf), true))
+			sum += buf[0];
+	return sum;
+}
+
+////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+	const char* filter = argc > 1 ? argv[1] : 0;
+
+	// 50 units of 2000 DIEs, the abbreviations are those of typical C++ code
+	DwarfGenOptions opts;
+	opts.units = 50;
+	opts.diesPerUnit = 2000;
+	DwarfGen gen(opts);
+	std::vector<char> image = gen.generate();
+
+	img = new PEImage;
+	if (!img->readBuffer(image.data(), (unsigned long)image.size())
+	    || (!img->initCVPtr(true) && !img->initDbgPtr(true) && !img->initDWARFPtr(true)))
+	{
+		printf("cannot load generated image: %s\n", img->getLastError());
+		return 1;
+	}
+	img->createSymbolCache();
+	DIECursor::setContext(img);
+	cv = new CV2PDB(*img);
+	makeLEBData();
+	collectProcRanges();
+
+	run(filter, "LEB128", benchLEB128);
+	run(filter, "SLEB128", benchSLEB128);
+	run(filter, "RDsize", benchRDsize);
+	run(filter, "getDWARFAbbrev/hit", benchAbbrevHit);
+	run(filter, "getDWARFAbbrev/miss", benchAbbrevMiss);
+	run(filter, "readNext", benchReadNext);
+	run(filter, "readNext/DIETable", benchReadNextTable);
+	run(filter, "decodeLocation", benchDecodeLocation);
+	run(filter, "CFIIndex::lookup", benchCFILookup);
+	run(filter, "findSymbol/hit", benchFindSymbol);
+	run(filter, "findSymbol/miss", benchFindSymbolMiss);
+	run(filter, "dsym2c", benchDsym2c);
+	run(filter, "d_demangle", benchDemangle);
+
+	delete cv;
+	DIECursor::setContext(0);
+	delete img;
+	return 0;
+}